@@ -0,0 +1,328 @@
+/*
+ * ai.c
+ *
+ * Author: Andrew Wilson
+ *
+ * The computer player's placement density search - see ai.h.
+ */
+
+#include "ai.h"
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "aitables.h"
+#include "game.h"
+#include "ledmatrix.h"
+#include "timer1.h"
+
+// Weight of a placement for each unsunk hit it covers (a placement that
+// covers none has weight 1)
+#define HIT_WEIGHT 32
+
+// Placements are numbered 0 to 127 for each ship: bit 6 is set for
+// vertical ones, bits 3 to 5 are the row and bits 0 to 2 the column of
+// the top left end
+#define NUM_PLACEMENTS 128
+#define PLACEMENT_VERTICAL 64
+
+// ship lengths indexed by ship type, as in fleets.c
+static const uint8_t ship_lengths[SHIP_MASK + 1] PROGMEM = {0, 6, 4, 3,
+                                                            3, 2, 2, 0};
+
+// AiState.book_moves once a book move has hit or the book has run out
+#define OFF_BOOK 0xFF
+
+// Work out what is known from the human's grid and start the search over
+static void start_search(AiState* ai,
+                         uint8_t grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS]) {
+  ai->remaining = 0;
+  for (uint8_t ship = CARRIER; ship <= SUBMARINE; ship++) {
+    ai->remaining |= 1 << ship;
+  }
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    ai->blocked[row] = 0;
+    ai->hits[row] = 0;
+    ai->unhit[row] = 0;
+  }
+
+  // only look at cells that have been fired at - the rest would be
+  // cheating
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++) {
+      uint8_t cell = grid[row][col];
+      uint8_t bit = 1 << col;
+      if (!(cell & HIT)) {
+        ai->unhit[row] |= bit;
+      } else if (cell & SUNK) {
+        ai->remaining &= ~(1 << (cell & SHIP_MASK));
+        ai->blocked[row] |= bit | (bit << 1) | (bit >> 1);
+        if (row > 0) {
+          ai->blocked[row - 1] |= bit;
+        }
+        if (row < GRID_NUM_ROWS - 1) {
+          ai->blocked[row + 1] |= bit;
+        }
+      } else if (cell & SHIP_MASK) {
+        ai->hits[row] |= bit;
+      } else {
+        ai->blocked[row] |= bit;
+      }
+    }
+  }
+
+  // the ready move until the search finds better is the first cell that
+  // hasn't been fired at, top row first
+  ai->best_density = 0;
+  for (int8_t row = GRID_NUM_ROWS - 1; row >= 0; row--) {
+    if (ai->unhit[row]) {
+      uint8_t col = 0;
+      while (!(ai->unhit[row] & (1 << col))) {
+        col++;
+      }
+      ai->best_row = row;
+      ai->best_col = col;
+      break;
+    }
+  }
+
+  ai->placements_total = 0;
+  for (uint8_t ship = CARRIER; ship <= SUBMARINE; ship++) {
+    if (ai->remaining & (1 << ship)) {
+      uint8_t length = pgm_read_byte(&ship_lengths[ship]);
+      ai->placements_total +=
+          2 * GRID_NUM_ROWS * (GRID_NUM_COLUMNS + 1 - length);
+    }
+  }
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++) {
+      ai->density[row][col] = 0;
+    }
+  }
+  ai->ship = CARRIER;
+  ai->placement = 0;
+  ai->complete = 0;
+  ai->placements_done = 0;
+  ai->slices = 0;
+  ai->from_table = 0;
+}
+
+// Make move n of a packed table (see aitables.h) the final move, so there
+// is nothing to search. Returns 0 if that cell has been fired at already.
+static uint8_t move_from_table(AiState* ai, const uint8_t* table,
+                               uint8_t n) {
+  uint16_t bit = n * AI_TABLE_CELL_BITS;
+  const uint8_t* bytes = table + bit / 8;
+  uint16_t packed = pgm_read_byte(bytes) | (pgm_read_byte(bytes + 1) << 8);
+  uint8_t cell = (packed >> (bit & 7)) & ((1 << AI_TABLE_CELL_BITS) - 1);
+  uint8_t row = cell >> 3;
+  uint8_t col = cell & 7;
+  if (!(ai->unhit[row] & (1 << col))) {
+    return 0;
+  }
+  ai->best_row = row;
+  ai->best_col = col;
+  ai->complete = 1;
+  ai->from_table = 1;
+  return 1;
+}
+
+static void add_weight(AiState* ai, uint8_t row, uint8_t col,
+                       uint8_t weight) {
+  uint16_t density = ai->density[row][col] + weight;
+  ai->density[row][col] = density;
+  if (density > ai->best_density) {
+    ai->best_density = density;
+    ai->best_row = row;
+    ai->best_col = col;
+  }
+}
+
+static uint8_t count_bits(uint8_t bits) {
+  uint8_t count = 0;
+  while (bits) {
+    bits &= bits - 1;
+    count++;
+  }
+  return count;
+}
+
+// Add the weight of one placement of a ship of the given length. Returns
+// 0 if the ship doesn't fit on the grid there, 1 if it does (whether or
+// not it could be there).
+static uint8_t try_placement(AiState* ai, uint8_t length,
+                             uint8_t placement) {
+  uint8_t row = (placement >> 3) & 7;
+  uint8_t col = placement & 7;
+
+  if (!(placement & PLACEMENT_VERTICAL)) {
+    if (col + length > GRID_NUM_COLUMNS) {
+      return 0;
+    }
+    uint8_t cells = (uint8_t)(((1 << length) - 1) << col);
+    if (ai->blocked[row] & cells) {
+      return 1;
+    }
+    uint8_t hits = count_bits(ai->hits[row] & cells);
+    uint8_t weight = hits ? hits * HIT_WEIGHT : 1;
+    uint8_t open = ai->unhit[row] & cells;
+    for (uint8_t c = col; c < col + length; c++) {
+      if (open & (1 << c)) {
+        add_weight(ai, row, c, weight);
+      }
+    }
+    return 1;
+  }
+
+  if (row + length > GRID_NUM_ROWS) {
+    return 0;
+  }
+  uint8_t bit = 1 << col;
+  uint8_t hits = 0;
+  for (uint8_t r = row; r < row + length; r++) {
+    if (ai->blocked[r] & bit) {
+      return 1;
+    }
+    if (ai->hits[r] & bit) {
+      hits++;
+    }
+  }
+  uint8_t weight = hits ? hits * HIT_WEIGHT : 1;
+  for (uint8_t r = row; r < row + length; r++) {
+    if (ai->unhit[r] & bit) {
+      add_weight(ai, r, col, weight);
+    }
+  }
+  return 1;
+}
+
+void ai_reset(AiState* ai, uint8_t grid[8][8]) {
+  ai->last_placements_done = 0;
+  ai->last_placements_total = 0;
+  ai->last_slices = 0;
+  ai->moves = 0;
+  ai->full_searches = 0;
+  ai->table_moves = 0;
+  start_search(ai, grid);
+  ai->book_moves = move_from_table(ai, ai_book, 0) ? 0 : OFF_BOOK;
+}
+
+// Try the next placement. Returns 0 once there are none left.
+static uint8_t search_step(AiState* ai) {
+  while (ai->ship <= SUBMARINE && !(ai->remaining & (1 << ai->ship))) {
+    ai->ship++;
+  }
+  if (ai->ship > SUBMARINE) {
+    ai->complete = 1;
+    return 0;
+  }
+  uint8_t length = pgm_read_byte(&ship_lengths[ai->ship]);
+  ai->placements_done += try_placement(ai, length, ai->placement);
+  if (++ai->placement == NUM_PLACEMENTS) {
+    ai->placement = 0;
+    ai->ship++;
+  }
+  return 1;
+}
+
+uint8_t ai_think(AiState* ai) {
+  if (ai->complete) {
+    return 0;
+  }
+  if (ai->slices < UINT8_MAX) {
+    ai->slices++;
+  }
+
+  // stop between placements once the slice is used up
+  uint16_t start = get_cycle_count();
+  do {
+    if (!search_step(ai)) {
+      return 0;
+    }
+  } while ((uint16_t)(get_cycle_count() - start) <
+           AI_SLICE_CYCLES / CYCLES_PER_COUNT);
+  return 1;
+}
+
+void ai_finish(AiState* ai) {
+  if (!ai->complete && ai->slices < UINT8_MAX) {
+    ai->slices++;
+  }
+  while (search_step(ai)) {
+  }
+}
+
+void ai_best_move(const AiState* ai, uint8_t* row, uint8_t* col) {
+  *row = ai->best_row;
+  *col = ai->best_col;
+}
+
+void ai_best_moves(const AiState* ai, uint8_t n, uint8_t shots[8]) {
+  shots[ai->best_row] |= 1 << ai->best_col;
+  uint8_t colour = (ai->best_row + ai->best_col) & 1;
+  for (uint8_t taken = 1; taken < n; taken++) {
+    // the heaviest cell left, looked at in a scattered order (29 is odd,
+    // so i * 29 visits every cell) so that ties are spread over the grid
+    uint8_t found = 0;
+    uint8_t best_cell = 0;
+    uint8_t best_on_colour = 0;
+    uint16_t best_density = 0;
+    for (uint8_t i = 0; i < GRID_NUM_ROWS * GRID_NUM_COLUMNS; i++) {
+      uint8_t cell = (i * 29) & (GRID_NUM_ROWS * GRID_NUM_COLUMNS - 1);
+      uint8_t row = cell >> 3;
+      uint8_t col = cell & 7;
+      if (!(ai->unhit[row] & ~shots[row] & (1 << col))) {
+        continue;
+      }
+      uint16_t density = ai->density[row][col];
+      uint8_t on_colour = ((row + col) & 1) == colour;
+      if (!found || density > best_density ||
+          (density == best_density && on_colour > best_on_colour)) {
+        found = 1;
+        best_cell = cell;
+        best_on_colour = on_colour;
+        best_density = density;
+      }
+    }
+    if (!found) {
+      return;
+    }
+    shots[best_cell >> 3] |= 1 << (best_cell & 7);
+  }
+}
+
+void ai_next_turn(AiState* ai, uint8_t grid[8][8]) {
+  ai->last_placements_done = ai->placements_done;
+  ai->last_placements_total = ai->placements_total;
+  ai->last_slices = ai->slices;
+  if (ai->moves < UINT8_MAX) {
+    ai->moves++;
+    if (ai->from_table) {
+      ai->table_moves++;
+    } else if (ai->complete) {
+      ai->full_searches++;
+    }
+  }
+  uint8_t hit = grid[ai->best_row][ai->best_col] & SHIP_MASK;
+  start_search(ai, grid);
+
+  // stay on the book while its moves miss, and reply to the first hit
+  // from the table too
+  if (ai->book_moves != OFF_BOOK) {
+    if (hit) {
+      move_from_table(ai, ai_first_hit_replies, ai->book_moves);
+      ai->book_moves = OFF_BOOK;
+    } else if (++ai->book_moves == AI_BOOK_LENGTH ||
+               !move_from_table(ai, ai_book, ai->book_moves)) {
+      ai->book_moves = OFF_BOOK;
+    }
+  }
+}
+
+void ai_report(const AiState* ai) {
+  printf_P(PSTR("\nAI: last move searched %u of %u placements in %u slices, "
+                "%u of %u moves fully searched and %u from tables\n"),
+           ai->last_placements_done, ai->last_placements_total, ai->last_slices,
+           ai->full_searches, ai->moves, ai->table_moves);
+}
@@ -0,0 +1,102 @@
+/*
+ * ai.h
+ *
+ * Author: Andrew Wilson
+ *
+ * The computer player. It works out where to fire from a placement density:
+ * every way each of the human's unsunk ships could still lie, given the
+ * misses, hits and sunk ships so far, adds weight to the cells it covers
+ * (much more weight if it covers a hit that isn't sunk yet), and the unhit
+ * cell with the most weight is the best shot.
+ *
+ * The search is done a slice at a time while the game waits for the human
+ * (see events_set_idle() in events.h) and there is always a move ready, so
+ * the computer fires straight away when the human does, with whatever was
+ * searched by then. Until its first hit, and for the move after it, the
+ * computer plays from tables made in advance (see aitables.h) and doesn't
+ * search at all.
+ */
+
+#ifndef AI_H_
+#define AI_H_
+
+#include <stdint.h>
+
+// Longest a slice of search may take, in CPU cycles. A slice is only
+// stopped between placements, so it can overrun by one placement (a few
+// hundred cycles).
+#define AI_SLICE_CYCLES 8000
+
+// Everything the computer player knows and where its search is up to
+typedef struct {
+  // What is known about the human's grid, one bit per column for each
+  // row: cells no ship can be on (misses, sunk ships and the cells next
+  // to them, as ships never touch), hits on ships that aren't sunk, and
+  // cells that haven't been fired at
+  uint8_t blocked[8];
+  uint8_t hits[8];
+  uint8_t unhit[8];
+  // bit n is set if ship type n isn't sunk
+  uint8_t remaining;
+
+  // where the search is up to
+  uint8_t ship;
+  uint8_t placement;
+  uint8_t complete;
+  uint16_t density[8][8];
+
+  // the move that is ready
+  uint8_t best_row, best_col;
+  uint16_t best_density;
+
+  // how much was searched for this move, or whether it came from the
+  // tables (see aitables.h) instead
+  uint16_t placements_done;
+  uint16_t placements_total;
+  uint8_t slices;
+  uint8_t from_table;
+
+  // the number of opening book moves fired so far, which have all missed
+  uint8_t book_moves;
+
+  // the same for the last move, and the number of moves and how they
+  // were chosen
+  uint16_t last_placements_done;
+  uint16_t last_placements_total;
+  uint8_t last_slices;
+  uint8_t moves;
+  uint8_t full_searches;
+  uint8_t table_moves;
+} AiState;
+
+// Forget everything and start searching for the first move on grid (the
+// human's). Call when a new game starts, after the fleet has been placed.
+void ai_reset(AiState* ai, uint8_t grid[8][8]);
+
+// Search for up to AI_SLICE_CYCLES. Returns 1 if there is more to search,
+// 0 once the move is final.
+uint8_t ai_think(AiState* ai);
+
+// Search to the end, however long it takes
+void ai_finish(AiState* ai);
+
+// The best move found so far, as a row and column of the grid. There is
+// always one, even if no search has been done.
+void ai_best_move(const AiState* ai, uint8_t* row, uint8_t* col);
+
+// Add the best move and the n - 1 next best unhit cells to shots (one bit
+// per column for each row), for a salvo. They all come from the search
+// done so far for this move, so this takes no longer however big n is.
+// Cells with no weight (none at all for a move from the tables) come
+// last, those on the best move's colour of a checkerboard first.
+void ai_best_moves(const AiState* ai, uint8_t n, uint8_t shots[8]);
+
+// Start searching for the next move. Call after each computer move, once
+// its result is in grid.
+void ai_next_turn(AiState* ai, uint8_t grid[8][8]);
+
+// Print how much of the search was done for the last move, how many moves
+// had a full search and how many came from the tables
+void ai_report(const AiState* ai);
+
+#endif /* AI_H_ */
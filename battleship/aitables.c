@@ -0,0 +1,17 @@
+/*
+ * aitables.c
+ *
+ * Generated by tools/ai_tables - do not edit. See aitables.h.
+ */
+
+#include "aitables.h"
+
+#include <avr/pgmspace.h>
+
+// Opening book (row,column of each move)
+// 0,2 7,5 2,7 5,0 0,6 1,5 0,4 1,3 2,4 3,6
+const uint8_t ai_book[AI_TABLE_BYTES] PROGMEM = {0x42, 0x7f, 0xa1, 0x46, 0x43, 0x2c, 0x94, 0x07};
+
+// Replies to a first hit on each book move
+// 0,3 7,4 3,7 4,0 0,5 1,3 0,5 3,3 4,4 2,0
+const uint8_t ai_first_hit_replies[AI_TABLE_BYTES] PROGMEM = {0x03, 0xff, 0x81, 0xc5, 0x52, 0x6c, 0x24, 0x04};
@@ -0,0 +1,36 @@
+/*
+ * aitables.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Moves for the computer player worked out in advance on the host by
+ * tools/ai_tables, which counts every way the whole fleet can lie (all six
+ * ships at once, not touching) given the shots so far. aitables.c is
+ * generated by it; see readme.md to regenerate it.
+ *
+ * Each table holds AI_BOOK_LENGTH cells (row * 8 + column of human_grid),
+ * packed into 6 bits each: cell n is in bits 6n to 6n + 5, counting from
+ * bit 0 of the first byte.
+ */
+
+#ifndef AITABLES_H_
+#define AITABLES_H_
+
+#include <stdint.h>
+
+// Number of moves in the opening book
+#define AI_BOOK_LENGTH 10
+
+// Bits in each packed cell, and bytes in each table (with a spare byte so
+// a cell can always be read as two bytes)
+#define AI_TABLE_CELL_BITS 6
+#define AI_TABLE_BYTES (AI_BOOK_LENGTH * AI_TABLE_CELL_BITS / 8 + 1)
+
+// The opening book: move n is the best shot when the n moves before it
+// were the book's and all missed
+extern const uint8_t ai_book[AI_TABLE_BYTES];
+
+// Reply n is the best shot after book move n made the first hit
+extern const uint8_t ai_first_hit_replies[AI_TABLE_BYTES];
+
+#endif /* AITABLES_H_ */
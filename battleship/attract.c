@@ -0,0 +1,223 @@
+/*
+ * attract.c
+ *
+ * Author: Andrew Wilson
+ *
+ * The computer playing itself on the start screen - see attract.h.
+ */
+
+#include "attract.h"
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#include "ai.h"
+#include "events.h"
+#include "fleets.h"
+#include "game.h"
+#include "ledmatrix.h"
+#include "log.h"
+#include "swtimer.h"
+#include "terminalio.h"
+
+typedef uint8_t GridRow[GRID_NUM_COLUMNS];
+
+// Frames a sunken ship blinks for, and the end of a game is shown for
+#define SINK_FRAMES 6
+#define GAME_OVER_FRAMES 20
+
+// What the next frame does
+#define PHASE_NEW_GAME 0
+#define PHASE_AIM 1
+#define PHASE_FIRE 2
+#define PHASE_SINK 3
+#define PHASE_GAME_OVER 4
+
+// The game given to attract_start(). The left fleet is in its human_grid
+// and the right one in its computer_grid, drawn as in a game. Each side has
+// an AI of its own that it keeps from one turn to the next, as the computer
+// does in a game, so both follow the opening book and each searches on
+// while the other fires: the left fleet's is the game's, the right fleet's
+// is here.
+static GameState* game;
+static AiState right_ai;
+
+static uint8_t frame_timer = SWTIMER_NONE;
+static uint8_t phase;
+static uint8_t frames_left;
+static uint16_t games;
+
+// The side firing (0 for the left fleet, which fires at computer_grid,
+// and 1 for the right), where it is firing and the ship it has sunk
+static uint8_t side;
+static uint8_t shot_row, shot_col;
+static uint8_t sinking;
+
+// The grid side fires at, and its player number as check_for_sunken_ships()
+// takes it
+static GridRow* target(void) {
+  return side ? game->human_grid : game->computer_grid;
+}
+
+static uint8_t target_player(void) { return !side; }
+
+// Draw a cell of the grid side is firing at
+static void draw_target_cell(uint8_t row, uint8_t col, PixelColour colour) {
+  if (side) {
+    ledmatrix_draw_pixel_in_human_grid(col, row, colour);
+  } else {
+    // the computer grid is drawn upside down, as in a game
+    ledmatrix_draw_pixel_in_computer_grid(col, 7 - row, colour);
+  }
+}
+
+static PixelColour cell_colour(uint8_t cell) {
+  if (cell & HIT) {
+    return (cell & SHIP_MASK) ? COLOUR_RED : COLOUR_GREEN;
+  }
+  return (cell & SHIP_MASK) ? COLOUR_ORANGE : COLOUR_BLACK;
+}
+
+// Returns 1 if every ship on grid has been sunk
+static uint8_t fleet_sunk(uint8_t grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS]) {
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++) {
+      if ((grid[row][col] & SHIP_MASK) && !(grid[row][col] & SUNK)) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+// The AI of a side
+static AiState* side_ai(uint8_t of_side) {
+  return of_side ? &right_ai : game->ai;
+}
+
+// Search for the side about to fire, then for the other side's next move
+static uint8_t think(void) {
+  return ai_think(side_ai(side)) || ai_think(side_ai(!side));
+}
+
+// Hand over to the other side
+static void next_turn(void) {
+  side = !side;
+  phase = PHASE_AIM;
+}
+
+static void new_game(void) {
+  uint8_t left = games % NUM_FLEET_LAYOUTS;
+  uint8_t right = (games + 1) % NUM_FLEET_LAYOUTS;
+  fleet_load(left, game->human_grid);
+  fleet_load(right, game->computer_grid);
+  ledmatrix_clear();
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++) {
+      if (game->human_grid[row][col] & SHIP_MASK) {
+        ledmatrix_draw_pixel_in_human_grid(col, row, COLOUR_ORANGE);
+      }
+      if (game->computer_grid[row][col] & SHIP_MASK) {
+        ledmatrix_draw_pixel_in_computer_grid(col, 7 - row, COLOUR_ORANGE);
+      }
+    }
+  }
+  log_at_P(LOG_INFO, 1, ATTRACT_LOG_BOTTOM, PSTR("Game %u: %S against %S\n"),
+           games + 1, fleet_name(left), fleet_name(right));
+  ai_reset(side_ai(0), game->computer_grid);
+  ai_reset(side_ai(1), game->human_grid);
+
+  // the sides take turns to go first, and side is switched before the
+  // first turn
+  side = !(games & 1);
+  next_turn();
+}
+
+// Blink (or, once the blinking is over, draw) the ship being sunk
+static void draw_sinking(uint8_t on) {
+  GridRow* grid = target();
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++) {
+      if ((grid[row][col] & (SHIP_MASK | SUNK)) == (sinking | SUNK)) {
+        draw_target_cell(row, col, on ? COLOUR_YELLOW : COLOUR_RED);
+      }
+    }
+  }
+}
+
+// Software timer callback: show the next frame
+static void frame(void) {
+  GridRow* grid = target();
+  uint8_t* cell = &grid[shot_row][shot_col];
+  switch (phase) {
+    case PHASE_NEW_GAME:
+      new_game();
+      break;
+
+    case PHASE_AIM:
+      // whatever the AI has found by now (it has had at least a frame)
+      ai_best_move(side_ai(side), &shot_row, &shot_col);
+      draw_target_cell(shot_row, shot_col, COLOUR_YELLOW);
+      phase = PHASE_FIRE;
+      break;
+
+    case PHASE_FIRE:
+      *cell |= HIT;
+      if (*cell & SHIP_MASK) {
+        check_for_sunken_ships(target_player(), grid);
+      }
+      // the AI starts on its next move, once it knows how this one went
+      ai_next_turn(side_ai(side), grid);
+      draw_target_cell(shot_row, shot_col, cell_colour(*cell));
+      if (*cell & SUNK) {
+        sinking = *cell & SHIP_MASK;
+        frames_left = SINK_FRAMES;
+        phase = PHASE_SINK;
+      } else {
+        next_turn();
+      }
+      break;
+
+    case PHASE_SINK:
+      draw_sinking(--frames_left & 1);
+      if (frames_left) {
+        break;
+      }
+      if (fleet_sunk(grid)) {
+        log_at_P(LOG_INFO, 1, ATTRACT_LOG_BOTTOM,
+                 PSTR("Game %u: the %S fleet wins\n"), games + 1,
+                 side ? PSTR("right") : PSTR("left"));
+        frames_left = GAME_OVER_FRAMES;
+        phase = PHASE_GAME_OVER;
+      } else {
+        next_turn();
+      }
+      break;
+
+    case PHASE_GAME_OVER:
+      if (--frames_left == 0) {
+        games++;
+        phase = PHASE_NEW_GAME;
+      }
+      break;
+  }
+}
+
+void attract_start(GameState* board) {
+  game = board;
+  open_battle_log(ATTRACT_LOG_TOP, ATTRACT_LOG_BOTTOM);
+  phase = PHASE_NEW_GAME;
+  frame();
+  events_set_idle(think);
+  frame_timer = swtimer_start(ATTRACT_FRAME_MS, ATTRACT_FRAME_MS, frame);
+}
+
+void attract_stop(void) {
+  if (frame_timer == SWTIMER_NONE) {
+    return;
+  }
+  swtimer_cancel(frame_timer);
+  frame_timer = SWTIMER_NONE;
+  events_set_idle(0);
+  enable_scrolling_for_whole_display();
+}
@@ -0,0 +1,52 @@
+/*
+ * attract.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Attract mode: while the start screen waits for a player, the computer
+ * plays classic games against itself, its two fleets side by side on the
+ * LED matrix and its sunken ships in a battle log under the start screen.
+ * Left running it is also a soak test of the AI, the display and the
+ * terminal output.
+ *
+ * The game is shown a frame at a time from a software timer, every
+ * ATTRACT_FRAME_MS: a shot is aimed in one frame and lands in the next,
+ * and a sunken ship blinks for a few more. The AI searches for the next
+ * shot in the main loop's idle time between frames (see events_set_idle()
+ * in events.h), so input is handled as quickly as in a game. Each frame
+ * draws a handful of pixels, apart from the first of a game, which draws
+ * both fleets, and prints at most a line, dropped rather than waited for
+ * if the terminal is behind (see log.h), so nothing backs up.
+ *
+ * The game is played in the grids of a real game's state (see GameState
+ * in game.h), none of which is used again until the next game is set up.
+ * Its AI plays the left fleet and attract mode has a second one (175 bytes
+ * of SRAM) for the right, so each side plays as the computer does in a
+ * game.
+ */
+
+#ifndef ATTRACT_H_
+#define ATTRACT_H_
+
+#include <stdint.h>
+
+#include "game.h"
+
+// How long a frame is shown, in milliseconds
+#define ATTRACT_FRAME_MS 150
+
+// How long the start screen waits for input before attract mode starts
+#define ATTRACT_DELAY_MS 10000
+
+// Rows of the terminal the battle log scrolls in, under the start screen
+#define ATTRACT_LOG_TOP 19
+#define ATTRACT_LOG_BOTTOM 23
+
+// Start playing, from a new game, in the grids and with the AI of game
+void attract_start(GameState* game);
+
+// Stop playing, leaving the matrix and terminal as they are. Does nothing
+// if attract mode isn't running.
+void attract_stop(void);
+
+#endif /* ATTRACT_H_ */
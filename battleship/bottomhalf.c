@@ -0,0 +1,48 @@
+/*
+ * bottomhalf.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Deferred interrupt work - see bottomhalf.h.
+ */
+
+#include "bottomhalf.h"
+#include "hal.h"
+
+/* Bit n is set while bottom half n is waiting to be run */
+static volatile uint8_t pending;
+static BottomHalf bottom_halves[NUM_BOTTOM_HALVES];
+
+void bh_register(uint8_t id, BottomHalf function)
+{
+	bottom_halves[id] = function;
+}
+
+void bh_schedule(uint8_t id)
+{
+	pending |= 1 << id;
+}
+
+uint8_t bh_pending(void)
+{
+	return pending;
+}
+
+uint8_t bh_run(void)
+{
+	/* Take the whole set at once, anything scheduled from now on is run
+	 * next time */
+	uint8_t interrupts_were_enabled = hal_irq_save();
+	uint8_t to_run = pending;
+	pending = 0;
+	hal_irq_restore(interrupts_were_enabled);
+	
+	for (uint8_t id = 0; id < NUM_BOTTOM_HALVES; id++)
+	{
+		if ((to_run & (1 << id)) && bottom_halves[id])
+		{
+			bottom_halves[id]();
+		}
+	}
+	return to_run;
+}
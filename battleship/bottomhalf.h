@@ -0,0 +1,47 @@
+/*
+ * bottomhalf.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Work deferred from interrupt handlers. An interrupt handler only
+ * captures what it has to (a received character, a button state) and
+ * schedules a bottom half; the bottom half does the rest later in the main
+ * loop with interrupts enabled. That keeps every handler short and of
+ * bounded length, so the 1ms timer 0 tick is never held up.
+ *
+ * Bottom halves are run by bh_run(), which event_wait() (see events.h)
+ * calls before it looks at the event queue or goes to sleep.
+ */
+
+#ifndef BOTTOMHALF_H_
+#define BOTTOMHALF_H_
+
+#include <stdint.h>
+
+/* Bottom halves, in the order they are run */
+#define BH_BUTTONS 0		/* post button pushes as events (buttons.c) */
+#define BH_SERIAL_ECHO 1	/* echo received characters (serialio.c) */
+#define BH_TIMERS 2		/* run expired software timers (swtimer.c) */
+#define BH_LINK 3		/* decode frames from the link (link.c) */
+#define NUM_BOTTOM_HALVES 4
+
+typedef void (*BottomHalf)(void);
+
+/* Set the function run for bottom half id */
+void bh_register(uint8_t id, BottomHalf function);
+
+/* Ask for bottom half id to be run. Called from interrupt handlers (or
+ * with interrupts off). Scheduling it again before it has run has no
+ * further effect.
+ */
+void bh_schedule(uint8_t id);
+
+/* Return non-zero if any bottom half is waiting to be run */
+uint8_t bh_pending(void);
+
+/* Run the bottom halves that have been scheduled, with interrupts
+ * enabled. Returns non-zero if any were run.
+ */
+uint8_t bh_run(void);
+
+#endif /* BOTTOMHALF_H_ */
@@ -5,100 +5,164 @@
  */ 
 
 #include "buttons.h"
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "bottomhalf.h"
+#include "events.h"
+#include "hal.h"
+#include "isrprofile.h"
+#include "timer2.h"
 
-// Global variable to keep track of the last button state so that we 
-// can detect changes when an interrupt fires. The lower 4 bits (0 to 3)
-// will correspond to the last state of port B pins 0 to 3.
-static volatile uint8_t last_button_state;
+// Debounce state. Each button has a 2 bit counter, bit 0 of every
+// counter is kept in debounce_count0 and bit 1 in debounce_count1 (a
+// "vertical" counter), so all of the buttons are counted at once with a
+// few logic operations. A button's counter runs while its pin differs
+// from debounced_state and is reset when they agree, so the debounced
+// state only changes once the pin has read the same for 4 samples.
+static uint8_t debounced_state;
+static uint8_t debounce_count0;
+static uint8_t debounce_count1;
 
-// Our button queue. button_queue[0] is always the head of the queue. If we
-// take something off the queue we just move everything else along. We don't
-// use a circular buffer since it is usually expected that the queue is very
-// short. In most uses it will never have more than 1 element at a time.
-// This button queue can be changed by the interrupt handler below so we should
-// turn off interrupts if we're changing the queue outside the handler.
-#define BUTTON_QUEUE_SIZE 4
-static volatile uint8_t button_queue[BUTTON_QUEUE_SIZE];
-static volatile int8_t queue_length;
+// Hold to repeat settings (in samples) and the state of the button that
+// is repeating (repeat_bit is its bit, 0 if none). Only the most recently
+// pushed button repeats.
+static uint8_t repeat_mask;
+static uint8_t repeat_delay;
+static uint8_t repeat_first_interval;
+static uint8_t repeat_fastest;
+static uint8_t repeat_bit;
+static uint8_t repeat_countdown;
+static uint8_t repeat_interval;
+
+// Buttons pushed (bit n for button n) since the BH_BUTTONS bottom half
+// last posted them. Two pushes of the same button before it runs count as
+// one - the main loop was too busy to keep up with them anyway.
+static volatile uint8_t pending_pushes;
+
+static void post_button_pushes(void);
 
-// Setup interrupt if any of pins B0 to B3 change. We do this
-// using a pin change interrupt. These pins correspond to pin
-// change interrupts PCINT8 to PCINT11 which are covered by
-// Pin change interrupt 1.
 void init_button_interrupts(void)
 {
-	// Enable the interrupt (see datasheet page 77)
-	PCICR |= (1 << PCIE1);
+	// Assume the buttons are up, so a button held down at reset
+	// registers as a push once it has been debounced
+	debounced_state = 0;
+	debounce_count0 = 0xFF;
+	debounce_count1 = 0xFF;
 	
-	// Make sure the interrupt flag is cleared (by writing a 
-	// 1 to it) (see datasheet page 78)
-	PCIFR |= (1 << PCIF1);
+	set_button_repeat((1 << NUM_BUTTONS) - 1, 400, 160, 40);
 	
-	// Choose which pins we're interested in by setting
-	// the relevant bits in the mask register (see datasheet page 78)
-	PCMSK1 |= (1 << PCINT8) | (1 << PCINT9) | (1 << PCINT10) | (1 << PCINT11);	
+	pending_pushes = 0;
+	bh_register(BH_BUTTONS, post_button_pushes);
 	
-	// Empty the button push queue
-	queue_length = 0;
+#ifdef TICKLESS
+	// The buttons are only sampled while one is down. A pin change
+	// starts the sampling (see below).
+	hal_buttons_irq_init();
+#endif
+}
+
+// Convert a time in milliseconds to a number of samples (1 to 255)
+static uint8_t samples(uint16_t ms)
+{
+	uint16_t n = ms / BUTTON_SAMPLE_MS;
+	if (n == 0)
+	{
+		return 1;
+	}
+	return n > 255 ? 255 : n;
 }
 
-int8_t button_pushed(void)
+void set_button_repeat(uint8_t mask, uint16_t delay_ms, uint16_t interval_ms,
+		uint16_t fastest_ms)
 {
-	int8_t return_value = NO_BUTTON_PUSHED;	// Assume no button pushed
+	uint8_t interrupts_were_enabled = hal_irq_save();
+	repeat_mask = mask;
+	repeat_delay = samples(delay_ms);
+	repeat_first_interval = samples(interval_ms);
+	repeat_fastest = samples(fastest_ms);
+	repeat_bit = 0;
+	hal_irq_restore(interrupts_were_enabled);
+}
 
-	if (queue_length > 0)
+// Bottom half: post the pushes the interrupt handler has seen as events,
+// in button order. Interrupts are off while posting since the interrupt
+// handlers post events too.
+static void post_button_pushes(void)
+{
+	uint8_t interrupts_were_enabled = hal_irq_save();
+	uint8_t pushes = pending_pushes;
+	pending_pushes = 0;
+	for (uint8_t pin = 0; pin < NUM_BUTTONS; pin++)
 	{
-		// Remove the first element off the queue and move all the other
-		// entries closer to the front of the queue. We turn off interrupts (if on)
-		// before we make any changes to the queue. If interrupts were on
-		// we turn them back on when done.
-		return_value = button_queue[0];
-		
-		// Save whether interrupts were enabled and turn them off
-		int8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
-		cli();
-		
-		for (uint8_t i = 1; i < queue_length; i++)
+		if (pushes & (1 << pin))
 		{
-			button_queue[i - 1] = button_queue[i];
-		}
-		queue_length--;
-		
-		if (interrupts_were_enabled)
-		{
-			// Turn them back on again
-			sei();
+			event_post(EVENT_BUTTON, pin);
 		}
 	}
-	return return_value;
+	hal_irq_restore(interrupts_were_enabled);
 }
 
-// Interrupt handler for a change on buttons
-ISR(PCINT1_vect)
+// Called from the timer 2 interrupt handler. There are no loops - every
+// button is handled at once with bitwise operations - and the pushes are
+// left for the bottom half to post.
+uint8_t sample_buttons(void)
 {
-	// Get the current state of the buttons. We'll compare this with
-	// the last state to see what has changed.
-	uint8_t button_state = PINB & 0x0F;
+	// Bits that differ from the debounced state count up, the rest are
+	// reset. A counter that wraps around to 0 (after 4 samples) toggles
+	// the debounced state of its button.
+	uint8_t changed = debounced_state ^ hal_buttons_read();
+	debounce_count0 = ~(debounce_count0 & changed);
+	debounce_count1 = debounce_count0 ^ (debounce_count1 & changed);
+	changed &= debounce_count0 & debounce_count1;
+	debounced_state ^= changed;
 	
-	// Iterate over all the buttons and see which ones have changed.
-	// Any button pushes are added to the queue of button pushes (if
-	// there is space). We ignore button releases so we're just looking
-	// for a transition from 0 in the last_button_state bit to a 1 in the 
-	// button_state.
-	for (uint8_t pin = 0; pin < NUM_BUTTONS; pin++)
+	// Buttons that have just been pushed. We ignore button releases.
+	uint8_t pushed = changed & debounced_state;
+	
+	// A newly pushed button that repeats takes over the repeat (the
+	// lowest numbered one if several were pushed at once)
+	uint8_t repeaters = pushed & repeat_mask;
+	if (repeaters)
+	{
+		repeat_bit = repeaters & -repeaters;
+		repeat_countdown = repeat_delay;
+		repeat_interval = repeat_first_interval;
+	}
+	
+	// Repeat the held button, speeding up each time
+	if (repeat_bit && !(debounced_state & repeat_bit))
 	{
-		if (queue_length < BUTTON_QUEUE_SIZE
-				&& (button_state & (1 << pin))
-				&& !(last_button_state & (1 << pin)))
-				{
-			// Add the button push to the queue (and update the
-			// length of the queue
-			button_queue[queue_length++] = pin;
+		repeat_bit = 0;
+	} else if (repeat_bit && !repeaters && --repeat_countdown == 0)
+	{
+		pushed |= repeat_bit;
+		repeat_countdown = repeat_interval;
+		uint8_t faster = repeat_interval - repeat_interval / 4;
+		if (faster == repeat_interval)
+		{
+			faster--;
 		}
+		repeat_interval = faster > repeat_fastest ? faster : repeat_fastest;
 	}
 	
-	// Remember this button state
-	last_button_state = button_state;
+	if (pushed)
+	{
+		pending_pushes |= pushed;
+		bh_schedule(BH_BUTTONS);
+	}
+	
+	// Still busy while any button is down or being debounced (a counter
+	// that is running is not all ones)
+	return debounced_state || (uint8_t)~(debounce_count0 & debounce_count1);
+}
+
+#ifdef TICKLESS
+// A button has changed while they were not being sampled. Sample them
+// until they are all up again - timer 2 turns this interrupt back on
+// then. Bounded: no loops. Budget 40 cycles (see isrprofile.h).
+ISR(PCINT1_vect)
+{
+	ISR_PROFILE_BEGIN();
+	hal_buttons_irq_disable();
+	start_button_sampling();
+	ISR_PROFILE_END(ISR_PCINT1);
 }
+#endif
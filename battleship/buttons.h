@@ -3,8 +3,15 @@
  *
  * Author: Peter Sutton
  *
- * We assume four push buttons (B0 to B3) are connected to pins B0 to B3. We configure
- * pin change interrupts on these pins.
+ * We assume four push buttons (B0 to B3) are connected to pins B0 to B3. The
+ * pins are sampled every BUTTON_SAMPLE_MS from the timer 2 interrupt (see
+ * timer2.c) and debounced, and each push is posted as an EVENT_BUTTON (see
+ * events.h). Holding a button down repeats it, faster the longer it is
+ * held.
+ *
+ * In the tickless mode (TICKLESS defined) the sampling only runs while a
+ * button is down: a pin change interrupt starts it and it stops once all
+ * of the buttons have been released.
  */ 
 
 
@@ -21,18 +28,31 @@
 
 #define NUM_BUTTONS 4
 
-/* Set up pin change interrupts on pins B0 to B3.
+/* Time between samples of the buttons. A button has to read the same
+ * for 4 samples in a row (16ms) before a push or release is accepted.
+ */
+#define BUTTON_SAMPLE_MS 4
+
+/* Reset the debounce state and the repeat settings. The buttons are sampled once timer 2 is started (init_timer2()).
  * It is assumed that global interrupts are off when this function is called
  * and are enabled sometime after this function is called.
  */
 void init_button_interrupts(void);
 
-/* Return the last button pushed (0 to 3) or -1 (NO_BUTTON_PUSHED) if 
- * there are no button pushes to return. (A small queue of button pushes
- * is kept. This function should be called frequently enough to
- * ensure the queue does not overflow. Excess button pushes are
- * discarded.)
+/* Set which buttons repeat when held (bit n for button n) and how: the
+ * first repeat comes delay_ms after the push, the next interval_ms after
+ * that, and each interval after that is a quarter shorter than the one
+ * before until it is down to fastest_ms. Times are rounded down to
+ * multiples of BUTTON_SAMPLE_MS and at most 255 samples. A mask of 0
+ * turns repeating off. The default is all buttons, 400ms, 160ms, 40ms.
+ */
+void set_button_repeat(uint8_t mask, uint16_t delay_ms, uint16_t interval_ms,
+		uint16_t fastest_ms);
+
+/* Sample and debounce the buttons. Called from the timer 2 interrupt
+ * handler every BUTTON_SAMPLE_MS. Returns 0 once all the buttons are up
+ * and settled, non-zero otherwise.
  */
-int8_t button_pushed(void);
+uint8_t sample_buttons(void);
 
 #endif /* BUTTONS_H_ */
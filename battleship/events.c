@@ -0,0 +1,156 @@
+/*
+ * events.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Input event queue - see events.h.
+ */
+
+#include "events.h"
+#include "bottomhalf.h"
+#include "hal.h"
+#include "timer0.h"
+#include "timer1.h"
+
+/* The queue is a ring buffer with a single producer (interrupt context -
+ * interrupt handlers don't interrupt each other) and a single consumer
+ * (the main loop). event_post() only writes queue_head and event_get()
+ * only writes queue_tail. Both are single bytes, so each side reads the
+ * other's index atomically and neither has to turn interrupts off. The
+ * indices run freely and are masked when used, so the queue is full when
+ * they are EVENT_QUEUE_SIZE apart. The size must be a power of 2.
+ */
+#define EVENT_QUEUE_SIZE 16
+static volatile Event event_queue[EVENT_QUEUE_SIZE];
+static volatile uint8_t queue_head;
+static volatile uint8_t queue_tail;
+static volatile uint8_t dropped;
+
+static IdleTask idle_task;
+
+/* The stamp for an event posted now. In the tickless mode the time in
+ * milliseconds takes a 32 bit division to work out (see timer1.c), too
+ * slow for an interrupt handler, so the timer 1 count is kept instead and
+ * event_time_ms() does the conversion. */
+static inline uint16_t time_stamp(void)
+{
+#ifdef TICKLESS
+	return hal_timer1_count();
+#else
+	return (uint16_t)get_current_time();
+#endif
+}
+
+void init_events(void)
+{
+	queue_head = 0;
+	queue_tail = 0;
+	dropped = 0;
+	idle_task = 0;
+}
+
+uint8_t event_post(uint8_t source, uint8_t key)
+{
+	uint8_t head = queue_head;
+	if ((uint8_t)(head - queue_tail) == EVENT_QUEUE_SIZE)
+	{
+		if (dropped < 255)
+		{
+			dropped++;
+		}
+		return 0;
+	}
+	volatile Event* event = &event_queue[head & (EVENT_QUEUE_SIZE - 1)];
+	event->source = source;
+	event->key = key;
+	event->time = time_stamp();
+	
+	/* Publish the event only once it is complete */
+	queue_head = head + 1;
+	return 1;
+}
+
+uint8_t event_get(Event* event)
+{
+	uint8_t tail = queue_tail;
+	if (tail == queue_head)
+	{
+		return 0;
+	}
+	volatile Event* queued = &event_queue[tail & (EVENT_QUEUE_SIZE - 1)];
+	event->source = queued->source;
+	event->key = queued->key;
+	event->time = queued->time;
+	
+	/* Hand the slot back to the producer once it has been copied */
+	queue_tail = tail + 1;
+	return 1;
+}
+
+uint32_t event_time_ms(const Event* event)
+{
+	uint32_t now = get_current_time();
+#ifdef TICKLESS
+	/* Each count is 1024 cycles, 16/125ms */
+	uint16_t age = get_cycle_count() - event->time;
+	return now - (uint32_t)age * 16 / 125;
+#else
+	return now - (uint16_t)((uint16_t)now - event->time);
+#endif
+}
+
+void event_wait(Event* event)
+{
+	uint8_t idle_busy = idle_task != 0;
+	while (1)
+	{
+		/* Finish the work the interrupt handlers have left, which may
+		 * post events */
+		bh_run();
+		
+		/* Check for an event and go to sleep with interrupts off, so an
+		 * event posted or a bottom half scheduled in between wakes us
+		 * rather than being missed. hal_cpu_sleep() turns interrupts
+		 * back on. */
+		hal_irq_disable();
+		if (event_get(event))
+		{
+			hal_irq_enable();
+			return;
+		}
+		if (bh_pending())
+		{
+			hal_irq_enable();
+			continue;
+		}
+		
+		/* Do a slice of background work rather than sleep, then look
+		 * for events again */
+		if (idle_busy)
+		{
+			hal_irq_enable();
+			idle_busy = idle_task();
+			continue;
+		}
+		hal_cpu_sleep();
+	}
+}
+
+void events_clear(void)
+{
+	Event event;
+	while (event_get(&event))
+	{
+		;
+	}
+}
+
+void events_set_idle(IdleTask task)
+{
+	idle_task = task;
+}
+
+uint8_t events_dropped(void)
+{
+	return dropped;
+}
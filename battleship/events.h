@@ -0,0 +1,79 @@
+/*
+ * events.h
+ *
+ * Author: Andrew Wilson
+ *
+ * A single queue of input events. Button pushes (from the timer 2 button
+ * sampling) and characters received on the serial port are both added to
+ * it by their interrupt handlers, and the main loop takes them off one at
+ * a time - sleeping while it is empty - and turns them into game actions
+ * with a keymap (see keymap.h). The link to another board (see link.h)
+ * posts what happens on it too, from its bottom half. Periodic work is
+ * done by software timers instead (see swtimer.h), whose callbacks run
+ * while the main loop waits here.
+ */
+
+#ifndef EVENTS_H_
+#define EVENTS_H_
+
+#include <stdint.h>
+
+/* Where an event came from */
+#define EVENT_BUTTON 0	/* key is the button number (0 to 3) */
+#define EVENT_SERIAL 1	/* key is the character received */
+#define EVENT_LINK 2	/* key is what happened on the link (see link.h) */
+
+typedef struct {
+	uint8_t source;
+	uint8_t key;
+	/* When the event happened, as a tick count that is cheap to read in
+	 * an interrupt handler - see event_time_ms() */
+	uint16_t time;
+} Event;
+
+/* Empty the queue. It is assumed that global interrupts are off when
+ * this function is called.
+ */
+void init_events(void);
+
+/* Add an event to the queue, timestamped now. Interrupt handlers are the
+ * only producers, so this must be called from an interrupt handler (or
+ * with interrupts off). Returns 1 if the event was queued, 0 if it was
+ * dropped because the queue is full.
+ */
+uint8_t event_post(uint8_t source, uint8_t key);
+
+/* Take the next event off the queue. Returns 1 if there was one, 0 if the
+ * queue was empty.
+ */
+uint8_t event_get(Event* event);
+
+/* The get_current_time() at which an event happened. Call it from the
+ * main loop within a few seconds of the event: the stamp wraps around
+ * after 8.3s in the tickless mode and 65s otherwise.
+ */
+uint32_t event_time_ms(const Event* event);
+
+/* Take the next event off the queue, sleeping until there is one. Runs
+ * any bottom halves (see bottomhalf.h) and then the idle task while it
+ * waits. Must be called with interrupts enabled.
+ */
+void event_wait(Event* event);
+
+/* Background work done a slice at a time. Returns non-zero while there is
+ * more to do. */
+typedef uint8_t (*IdleTask)(void);
+
+/* Set the function event_wait() calls while there are no events, instead
+ * of sleeping, for as long as it has work (0 for none). Events are only
+ * looked at between calls, so each call should be short.
+ */
+void events_set_idle(IdleTask task);
+
+/* Discard any events waiting in the queue */
+void events_clear(void);
+
+/* Number of events dropped because the queue was full (saturates at 255) */
+uint8_t events_dropped(void);
+
+#endif /* EVENTS_H_ */
@@ -0,0 +1,91 @@
+/*
+ * fleets.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Fleet layouts held in program memory. Every layout has the same six ships
+ * (carrier 6, cruiser 4, destroyer 3, frigate 3, corvette 2, submarine 2)
+ * and no two ships touch, which check_for_sunken_ships() relies on to find
+ * where each ship ends.
+ */
+
+#include "fleets.h"
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#include "game.h"
+
+// Shorthand for the cells of horizontal ships
+#define CH (CARRIER | HORIZONTAL)
+#define RH (CRUISER | HORIZONTAL)
+#define DH (DESTROYER | HORIZONTAL)
+#define FH (FRIGATE | HORIZONTAL)
+#define VH (CORVETTE | HORIZONTAL)
+#define SH (SUBMARINE | HORIZONTAL)
+#define E SHIP_END
+
+static const uint8_t fleet_layouts[NUM_FLEET_LAYOUTS][GRID_NUM_ROWS]
+                                  [GRID_NUM_COLUMNS] PROGMEM = {
+    // 0: the original human fleet
+    {{SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA},
+     {SEA, CH | E, CH, CH, CH, CH, CH | E, SEA},
+     {SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA},
+     {SEA, SEA, CORVETTE | E, SEA, SEA, SUBMARINE | E, SEA, SEA},
+     {DESTROYER | E, SEA, CORVETTE | E, SEA, SEA, SUBMARINE | E, SEA,
+      FRIGATE | E},
+     {DESTROYER, SEA, SEA, SEA, SEA, SEA, SEA, FRIGATE},
+     {DESTROYER | E, SEA, RH | E, RH, RH, RH | E, SEA, FRIGATE | E},
+     {SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA}},
+    // 1: the original computer fleet (layout 0 upside down)
+    {{SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA},
+     {DESTROYER | E, SEA, RH | E, RH, RH, RH | E, SEA, FRIGATE | E},
+     {DESTROYER, SEA, SEA, SEA, SEA, SEA, SEA, FRIGATE},
+     {DESTROYER | E, SEA, CORVETTE | E, SEA, SEA, SUBMARINE | E, SEA,
+      FRIGATE | E},
+     {SEA, SEA, CORVETTE | E, SEA, SEA, SUBMARINE | E, SEA, SEA},
+     {SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA},
+     {SEA, CH | E, CH, CH, CH, CH, CH | E, SEA},
+     {SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA}},
+    // 2: carrier along the top edge
+    {{CH | E, CH, CH, CH, CH, CH | E, SEA, SEA},
+     {SEA, SEA, SEA, SEA, SEA, SEA, SEA, FRIGATE | E},
+     {CRUISER | E, SEA, DH | E, DH, DH | E, SEA, SEA, FRIGATE},
+     {CRUISER, SEA, SEA, SEA, SEA, SEA, SEA, FRIGATE | E},
+     {CRUISER, SEA, CORVETTE | E, SEA, SH | E, SH | E, SEA, SEA},
+     {CRUISER | E, SEA, CORVETTE | E, SEA, SEA, SEA, SEA, SEA},
+     {SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA},
+     {SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA}},
+    // 3: carrier down the right hand side
+    {{SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA},
+     {SEA, RH | E, RH, RH, RH | E, SEA, SEA, SEA},
+     {SEA, SEA, SEA, SEA, SEA, SEA, CARRIER | E, SEA},
+     {DESTROYER | E, SEA, SEA, SEA, SEA, SEA, CARRIER, SEA},
+     {DESTROYER, SEA, FH | E, FH, FH | E, SEA, CARRIER, SEA},
+     {DESTROYER | E, SEA, SEA, SEA, SEA, SEA, CARRIER, SEA},
+     {SEA, SEA, SEA, SEA, SEA, SEA, CARRIER, SEA},
+     {VH | E, VH | E, SEA, SH | E, SH | E, SEA, CARRIER | E, SEA}},
+};
+
+static const char fleet_name_0[] PROGMEM = "Classic";
+static const char fleet_name_1[] PROGMEM = "Mirror";
+static const char fleet_name_2[] PROGMEM = "Top deck";
+static const char fleet_name_3[] PROGMEM = "Starboard";
+
+static const char* const fleet_names[NUM_FLEET_LAYOUTS] PROGMEM = {
+    fleet_name_0, fleet_name_1, fleet_name_2, fleet_name_3};
+
+void fleet_load(uint8_t layout,
+                uint8_t grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS]) {
+  if (layout >= NUM_FLEET_LAYOUTS) {
+    layout = 0;
+  }
+  memcpy_P(grid, fleet_layouts[layout], GRID_NUM_ROWS * GRID_NUM_COLUMNS);
+}
+
+const char* fleet_name(uint8_t layout) {
+  if (layout >= NUM_FLEET_LAYOUTS) {
+    layout = 0;
+  }
+  return (const char*)pgm_read_ptr(&fleet_names[layout]);
+}
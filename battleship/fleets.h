@@ -0,0 +1,30 @@
+/*
+ * fleets.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Library of fleet layouts stored in flash. Each layout is an 8x8 grid
+ * using the ship encoding in game.h, indexed [row][column] in the same way
+ * as human_grid and computer_grid. Layouts are copied into a grid with
+ * fleet_load() when a game starts so they never occupy SRAM while idle.
+ */
+
+#ifndef FLEETS_H_
+#define FLEETS_H_
+
+#include <stdint.h>
+
+#include "ledmatrix.h"
+
+#define NUM_FLEET_LAYOUTS 4
+
+// Copy fleet layout number layout (0 to NUM_FLEET_LAYOUTS - 1) from flash
+// into grid. Out of range layout numbers load layout 0.
+void fleet_load(uint8_t layout,
+                uint8_t grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS]);
+
+// Return the name of a fleet layout. The returned pointer is to program
+// memory, so print it with printf_P and "%S".
+const char* fleet_name(uint8_t layout);
+
+#endif /* FLEETS_H_ */
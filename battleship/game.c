@@ -10,96 +10,159 @@
 
 #include "game.h"
 
+#include <avr/pgmspace.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "ai.h"
 #include "display.h"
+#include "fleets.h"
 #include "ledmatrix.h"
+#include "link.h"
+#include "log.h"
 #include "string.h"
+#include "telemetry.h"
 #include "terminalio.h"
 
-uint8_t human_grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS];
-uint8_t computer_grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS];
-int8_t cursor_x, cursor_y;
-uint8_t cursor_on;
-uint8_t invalidMoves = 0;
-uint8_t humanConsolePrinter = 2;
-uint8_t computerConsolePrinter = 2;
-uint8_t count = 0;
+static void show_salvo(GameState* game);
+static void show_link_status(const char* message);
+
+// ship names indexed by ship type (ship & SHIP_MASK)
+static const char ship_name_carrier[] PROGMEM = "Carrier";
+static const char ship_name_cruiser[] PROGMEM = "Cruiser";
+static const char ship_name_destroyer[] PROGMEM = "Destroyer";
+static const char ship_name_frigate[] PROGMEM = "Frigate";
+static const char ship_name_corvette[] PROGMEM = "Corvette";
+static const char ship_name_submarine[] PROGMEM = "Submarine";
+static const char ship_name_none[] PROGMEM = "";
+static const char* const ship_names[SHIP_MASK + 1] PROGMEM = {
+    ship_name_none,     ship_name_carrier,  ship_name_cruiser,
+    ship_name_destroyer, ship_name_frigate, ship_name_corvette,
+    ship_name_submarine, ship_name_none};
+
+// game mode names indexed by mode
+static const char mode_name_classic[] PROGMEM = "Classic";
+static const char mode_name_salvo[] PROGMEM = "Salvo";
+static const char mode_name_area[] PROGMEM = "Area strike";
+static const char mode_name_link[] PROGMEM = "Link play";
+static const char* const mode_names[NUM_GAME_MODES] PROGMEM = {
+    mode_name_classic, mode_name_salvo, mode_name_area, mode_name_link};
+
+// SPI bytes sent to draw one pixel, and a whole column of a grid
+#define PIXEL_UPDATE_BYTES 3
+#define COLUMN_UPDATE_BYTES (2 + GRID_NUM_ROWS)
+
+void init_game_state(GameState* game, AiState* ai) {
+  memset(game, 0, sizeof(*game));
+  game->mode = MODE_CLASSIC;
+  select_fleet(game, 0);
+  game->ai = ai;
+}
+
+void select_fleet(GameState* game, uint8_t layout) {
+  // the computer always gets the layout after the human's
+  game->human_fleet = layout % NUM_FLEET_LAYOUTS;
+  game->computer_fleet = (game->human_fleet + 1) % NUM_FLEET_LAYOUTS;
+}
+
+uint8_t selected_fleet(const GameState* game) { return game->human_fleet; }
+
+void use_placed_fleet(GameState* game) { game->human_fleet_placed = 1; }
+
+void select_mode(GameState* game, uint8_t mode) {
+  game->mode = mode % NUM_GAME_MODES;
+}
+
+uint8_t selected_mode(const GameState* game) { return game->mode; }
+
+const char* mode_name(uint8_t mode) {
+  return (const char*)pgm_read_ptr(&mode_names[mode % NUM_GAME_MODES]);
+}
 
 // Initialise the game by resetting the grid and beat
-void initialise_game(void) {
+void initialise_game(GameState* game) {
   // clear the splash screen art
   ledmatrix_clear();
 
   // see "Human Turn" feature for how ships are encoded
-  // fill in the grid with the ships
-  uint8_t initial_human_grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS] = {
-      {SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA},
-      {SEA, CARRIER | HORIZONTAL | SHIP_END, CARRIER | HORIZONTAL,
-       CARRIER | HORIZONTAL, CARRIER | HORIZONTAL, CARRIER | HORIZONTAL,
-       CARRIER | HORIZONTAL | SHIP_END, SEA},
-      {SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA},
-      {SEA, SEA, CORVETTE | SHIP_END, SEA, SEA, SUBMARINE | SHIP_END, SEA, SEA},
-      {DESTROYER | SHIP_END, SEA, CORVETTE | SHIP_END, SEA, SEA,
-       SUBMARINE | SHIP_END, SEA, FRIGATE | SHIP_END},
-      {DESTROYER, SEA, SEA, SEA, SEA, SEA, SEA, FRIGATE},
-      {DESTROYER | SHIP_END, SEA, CRUISER | HORIZONTAL | SHIP_END,
-       CRUISER | HORIZONTAL, CRUISER | HORIZONTAL,
-       CRUISER | HORIZONTAL | SHIP_END, SEA, FRIGATE | SHIP_END},
-      {SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA}};
-  uint8_t initial_computer_grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS] = {
-      {SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA},
-      {DESTROYER | SHIP_END, SEA, CRUISER | HORIZONTAL | SHIP_END,
-       CRUISER | HORIZONTAL, CRUISER | HORIZONTAL,
-       CRUISER | HORIZONTAL | SHIP_END, SEA, FRIGATE | SHIP_END},
-      {DESTROYER, SEA, SEA, SEA, SEA, SEA, SEA, FRIGATE},
-      {DESTROYER | SHIP_END, SEA, CORVETTE | SHIP_END, SEA, SEA,
-       SUBMARINE | SHIP_END, SEA, FRIGATE | SHIP_END},
-      {SEA, SEA, CORVETTE | SHIP_END, SEA, SEA, SUBMARINE | SHIP_END, SEA, SEA},
-      {SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA},
-      {SEA, CARRIER | HORIZONTAL | SHIP_END, CARRIER | HORIZONTAL,
-       CARRIER | HORIZONTAL, CARRIER | HORIZONTAL, CARRIER | HORIZONTAL,
-       CARRIER | HORIZONTAL | SHIP_END, SEA},
-      {SEA, SEA, SEA, SEA, SEA, SEA, SEA, SEA}};
+  // fill in the grid with the ships, copied from the layouts in flash
+  // (the human's may have been placed already, see placement.h)
+  if (!game->human_fleet_placed) {
+    fleet_load(game->human_fleet, game->human_grid);
+  }
+  game->human_fleet_placed = 0;
+  if (game->mode == MODE_LINK) {
+    // the other board's fleet is only found out by firing at it
+    memset(game->computer_grid, SEA, sizeof(game->computer_grid));
+  } else {
+    fleet_load(game->computer_fleet, game->computer_grid);
+  }
   for (uint8_t i = 0; i < GRID_NUM_COLUMNS; i++) {
     for (uint8_t j = 0; j < GRID_NUM_COLUMNS; j++) {
-      human_grid[j][i] = initial_human_grid[j][i];
-      computer_grid[j][i] = initial_computer_grid[j][i];
-      if (human_grid[j][i] & SHIP_MASK) {
+      if (game->human_grid[j][i] & SHIP_MASK) {
         ledmatrix_draw_pixel_in_human_grid(i, j, COLOUR_ORANGE);
       }
     }
   }
-  cursor_x = 3;
-  cursor_y = 3;
-  cursor_on = 1;
-}
+  game->cursor_x = 3;
+  game->cursor_y = 3;
+  game->cursor_on = 1;
+  game->invalid_moves = 0;
+  memset(game->salvo_aim, 0, sizeof(game->salvo_aim));
+
+  // the battle log scrolls on its own from here on
+  open_battle_log(BATTLE_LOG_TOP, BATTLE_LOG_BOTTOM);
 
-void flash_cursor(void) {
-  cursor_on = 1 - cursor_on;
+  // the computer starts working out its first move
+  ai_reset(game->ai, game->human_grid);
 
-  if (cursor_on && (computer_grid[7 - cursor_y][cursor_x] & HIT)) {
-    ledmatrix_draw_pixel_in_computer_grid(cursor_x, cursor_y,
-                                          COLOUR_DARK_YELLOW);
-  } else if (cursor_on) {
-    ledmatrix_draw_pixel_in_computer_grid(cursor_x, cursor_y, COLOUR_YELLOW);
+  if (game->mode == MODE_SALVO) {
+    show_salvo(game);
   }
+  if (game->mode == MODE_LINK) {
+    game->link_turn_ours = 0;
+    game->link_game_over = 0;
+    link_start();
+    show_link_status(PSTR("Waiting for the other player"));
+  }
+}
+
+void open_battle_log(int8_t top, int8_t bottom) {
+  // setting the scroll region homes the cursor, so put it back at the start
+  // of the log's bottom row, where print_sunken_ship() expects it
+  set_scroll_region(top, bottom);
+  move_terminal_cursor(1, bottom);
+}
 
-  else if ((computer_grid[7 - cursor_y][cursor_x] & HIT) &&
-           (computer_grid[7 - cursor_y][cursor_x] &
-            SHIP_MASK))  // test for hit ship here, then duplicate and modify to
-                         // test for sunken ship
-  {
-    ledmatrix_draw_pixel_in_computer_grid(cursor_x, cursor_y, COLOUR_RED);
+// The colour a cell shows when the cursor isn't on it. player is 1 for
+// computer_grid and 0 for human_grid, as for check_for_sunken_ships().
+static PixelColour cell_colour(const GameState* game, uint8_t player,
+                               uint8_t row, uint8_t col) {
+  uint8_t cell =
+      player ? game->computer_grid[row][col] : game->human_grid[row][col];
+  if (cell & HIT) {
+    return (cell & SHIP_MASK) ? COLOUR_RED : COLOUR_GREEN;
   }
+  // the human sees their own ships, and where their salvo is aimed
+  if (player ? (game->salvo_aim[row] & (1 << col)) : (cell & SHIP_MASK)) {
+    return COLOUR_ORANGE;
+  }
+  return COLOUR_BLACK;
+}
+
+void flash_cursor(GameState* game) {
+  int8_t x = game->cursor_x;
+  int8_t y = game->cursor_y;
+  game->cursor_on = 1 - game->cursor_on;
 
-  else if ((computer_grid[7 - cursor_y - 7][cursor_x] & HIT) &&
-           !(computer_grid[7 - cursor_y][cursor_x] & SHIP_MASK)) {
-    ledmatrix_draw_pixel_in_computer_grid(cursor_x, cursor_y, COLOUR_GREEN);
+  if (game->cursor_on && (game->computer_grid[7 - y][x] & HIT)) {
+    ledmatrix_draw_pixel_in_computer_grid(x, y, COLOUR_DARK_YELLOW);
+  } else if (game->cursor_on) {
+    ledmatrix_draw_pixel_in_computer_grid(x, y, COLOUR_YELLOW);
   } else {
-    ledmatrix_draw_pixel_in_computer_grid(cursor_x, cursor_y, COLOUR_BLACK);
+    ledmatrix_draw_pixel_in_computer_grid(x, y,
+                                          cell_colour(game, 1, 7 - y, x));
   }
 }
 
@@ -108,78 +171,47 @@ void flash_cursor(void) {
 // it should end at ( (cursor_x + dx) % WIDTH, (cursor_y + dy) % HEIGHT)
 // the cursor should be displayed after it is moved as well <- TODO need to
 // flash it
-void move_cursor(int8_t dx, int8_t dy) {
+void move_cursor(GameState* game, int8_t dx, int8_t dy) {
   // update board as cursor moves
-  if ((computer_grid[7 - cursor_y][cursor_x] & HIT) &&
-      (computer_grid[7 - cursor_y][cursor_x] & SHIP_MASK)) {
-    ledmatrix_draw_pixel_in_computer_grid(cursor_x, cursor_y, COLOUR_RED);
-  } else if ((computer_grid[7 - cursor_y][cursor_x] & HIT) &&
-             !(computer_grid[7 - cursor_y][cursor_x] & SHIP_MASK)) {
-    ledmatrix_draw_pixel_in_computer_grid(cursor_x, cursor_y, COLOUR_GREEN);
-  } else {
-    ledmatrix_draw_pixel_in_computer_grid(cursor_x, cursor_y, COLOUR_BLACK);
-  }
+  ledmatrix_draw_pixel_in_computer_grid(
+      game->cursor_x, game->cursor_y,
+      cell_colour(game, 1, 7 - game->cursor_y, game->cursor_x));
 
   // move cursor to new position
-  cursor_x += dx;
-  cursor_y += dy;
-  if (cursor_x >= 8) {
-    cursor_x = 0;
+  game->cursor_x += dx;
+  game->cursor_y += dy;
+  if (game->cursor_x >= 8) {
+    game->cursor_x = 0;
   }
-  if (cursor_x < 0) {
-    cursor_x = 7;
+  if (game->cursor_x < 0) {
+    game->cursor_x = 7;
   }
-  if (cursor_y >= 8) {
-    cursor_y = 0;
+  if (game->cursor_y >= 8) {
+    game->cursor_y = 0;
   }
-  if (cursor_y < 0) {
-    cursor_y = 7;
+  if (game->cursor_y < 0) {
+    game->cursor_y = 7;
   }
 }
 
 void print_sunken_ship(uint8_t player, uint8_t ship) {
-  // set up ship types and message variable
-  char ship_type[20];
-  char message[30];
-
-  if ((ship & CARRIER) && !(ship & CRUISER) && !(ship & FRIGATE)) {
-    strcpy(ship_type, "Carrier");
-  } else if ((ship & CRUISER) && !(ship & CARRIER) && !(ship & FRIGATE)) {
-    strcpy(ship_type, "Cruiser");
-  } else if ((ship & DESTROYER) && !(ship & FRIGATE)) {
-    strcpy(ship_type, "Destroyer");
-  } else if ((ship & FRIGATE) && !(ship & CARRIER) && !(ship & CRUISER)) {
-    strcpy(ship_type, "Frigate");
-  } else if ((ship & CORVETTE) && !(ship & CRUISER)) {
-    strcpy(ship_type, "Corvette");
-  } else if (ship & SUBMARINE) {
-    strcpy(ship_type, "Submarine");
-  }
-
-  // char human[] = "You Sunk My %s", ship_type;
-  // char computer[] = "I Sunk Your %s", ship_type;
-
-  // print to the terminal after a ship has been sunk
+  // look up the ship type, the name is in program memory
+  const char* ship_type =
+      (const char*)pgm_read_ptr(&ship_names[ship & SHIP_MASK]);
+
+  // add a line to the battle log after a ship has been sunk. The cursor
+  // waits at the start of the log's bottom row (nothing else leaves it
+  // anywhere else, see log.h), so the line only moves along the row
+  // ("\x1b[nC" moves n columns right) and its newline scrolls the log up
+  // and leaves the cursor there again. Which ships are gone is game state
+  // the player has to see, so these are never dropped
   if (player == 1) {
-	// TODO: delete, print statements for debugging
-    // move_terminal_cursor(60 - strlen(human), humanConsolePrinter);
-    // printf(human);
-    // humanConsolePrinter++;
-    sprintf(message, "You Sunk My %s", ship_type);
-    move_terminal_cursor(80 - strlen(message), humanConsolePrinter);
-    printf("%s\n", message);
-    humanConsolePrinter++;  // Assuming this is a variable managed elsewhere to
-                            // track output position
-    return;
+    // right align against column 80, "You Sunk My " is 12 characters
+    log_at_P(LOG_CRITICAL, LOG_HERE, 0, PSTR("\x1b[%dCYou Sunk My %S\n"),
+             (int)(80 - 12 - 1 - strlen_P(ship_type)), ship_type);
   } else {
-	// TODO: delete, print statements for debugging
-    // move_terminal_cursor(20, computerConsolePrinter);
-    // printf(computer);
-    sprintf(message, "I Sunk Your %s", ship_type);
-    move_terminal_cursor(20, computerConsolePrinter);
-    printf("%s\n", message);
-    computerConsolePrinter++;
-    return;
+    log_at_P(LOG_CRITICAL, LOG_HERE, 0, PSTR("\x1b[19CI Sunk Your %S\n"),
+             ship_type);
   }
 }
 
@@ -196,7 +228,7 @@ void sink_ship(uint8_t player, int8_t col, int8_t row, char direction,
   int8_t length = 0;
 
   if (direction == 'w') {
-    for (row; row >= 0; row--) {
+    for (; row >= 0; row--) {
       if ((grid[row][col] & SHIP_MASK) && !(grid[row][col] & HIT)) {
         miss++;
       } else if ((grid[row][col] & ~HIT) == SEA) {
@@ -206,7 +238,7 @@ void sink_ship(uint8_t player, int8_t col, int8_t row, char direction,
     }
 
   } else if (direction == 's') {
-    for (row; row < 8; row++) {
+    for (; row < 8; row++) {
       if ((grid[row][col] & SHIP_MASK) && !(grid[row][col] & HIT)) {
         miss++;
       } else if ((grid[row][col] & ~HIT) == SEA) {
@@ -216,7 +248,7 @@ void sink_ship(uint8_t player, int8_t col, int8_t row, char direction,
     }
 
   } else if (direction == 'a') {
-    for (col; col > 0; col--) {
+    for (; col >= 0; col--) {
       if ((grid[row][col] & SHIP_MASK) && !(grid[row][col] & HIT)) {
         miss++;
       } else if ((grid[row][col] & ~HIT) == SEA) {
@@ -226,7 +258,7 @@ void sink_ship(uint8_t player, int8_t col, int8_t row, char direction,
     }
 
   } else if (direction == 'd') {
-    for (col; col < 8; col++) {
+    for (; col < 8; col++) {
       if ((grid[row][col] & SHIP_MASK) && !(grid[row][col] & HIT)) {
         miss++;
       } else if ((grid[row][col] & ~HIT) == SEA) {
@@ -275,13 +307,15 @@ void sink_ship(uint8_t player, int8_t col, int8_t row, char direction,
       }
 
     } else if (direction == 's') {
+      // the scan above stopped one past the far end of the ship, step back
+      // onto it so the sea (or the row off the grid) isn't marked as sunk
+      row--;
+      length--;
       while (length >= 0) {
-        // move print cursor -> DELETE debugging
-        move_terminal_cursor(30, count);
-        count++;
-        printf(
-            "Sinking ship at (Column %d, Row %d), length %d direction %c.\n \n",
-            col, row, length, direction);
+        // trace it on the telemetry channel, away from the game terminal
+        telemetry_printf_P(PSTR("Sinking ship at (Column %d, Row %d), "
+                                "length %d direction %c.\n"),
+                           col, row, length, direction);
 
         // sink the ship part
         grid[row][col] |= SUNK;
@@ -289,21 +323,21 @@ void sink_ship(uint8_t player, int8_t col, int8_t row, char direction,
         length--;
         if (length < 0) {
           // this will be sent to print_ship
-          move_terminal_cursor(30, count);
-          count++;
-          printf("Finished sinking ship of original length %d",
-                 original_length);
+          telemetry_printf_P(
+              PSTR("Finished sinking ship of original length %d\n"),
+              original_length);
         }
       }
 
     } else if (direction == 'a') {
+      // likewise, the scan stopped one before the far end
+      col++;
+      length--;
       while (length >= 0) {
-        // move print cursor -> DELETE debugging
-        move_terminal_cursor(30, count);
-        count++;
-        printf(
-            "Sinking ship at (Column %d, Row %d), length %d direction %c.\n \n",
-            col, row, length, direction);
+        // trace it on the telemetry channel, away from the game terminal
+        telemetry_printf_P(PSTR("Sinking ship at (Column %d, Row %d), "
+                                "length %d direction %c.\n"),
+                           col, row, length, direction);
 
         // sink the ship part
         grid[row][col] |= SUNK;
@@ -311,14 +345,17 @@ void sink_ship(uint8_t player, int8_t col, int8_t row, char direction,
         length--;
         if (length < 0) {
           // this will be sent to print_ship
-          move_terminal_cursor(30, count);
-          count++;
-          printf("Finished sinking ship of original length %d",
-                 original_length);
+          telemetry_printf_P(
+              PSTR("Finished sinking ship of original length %d\n"),
+              original_length);
         }
       }
 
     } else if (direction == 'd') {
+      // the scan above stopped one past the far end of the ship, step back
+      // onto it (as for 'w') so the sea beyond isn't marked as sunk
+      col--;
+      length--;
       while (length >= 0) {
         // TODO: delete, print statements for debugging
         // move print cursor
@@ -383,79 +420,332 @@ void check_for_sunken_ships(uint8_t player, uint8_t grid[8][8]) {
   //}
 }
 
-void player_turn(void) {
-  // handle invalid move
-  if (computer_grid[7 - cursor_y][cursor_x] & HIT) {
-    move_terminal_cursor(0, 1);
+// Count the ship types with a cell that isn't sunk
+static uint8_t ships_afloat(uint8_t grid[8][8]) {
+  uint8_t afloat = 0;
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++) {
+      uint8_t cell = grid[row][col];
+      if ((cell & SHIP_MASK) && !(cell & SUNK)) {
+        afloat |= 1 << (cell & SHIP_MASK);
+      }
+    }
+  }
+  uint8_t ships = 0;
+  for (; afloat; afloat &= afloat - 1) {
+    ships++;
+  }
+  return ships;
+}
 
-    char invalidMoveMessage[20] = "Invalid move";
-    uint8_t messageLength = strlen(invalidMoveMessage);
+// Count the cells of grid that haven't been fired at
+static uint8_t unhit_cells(uint8_t grid[8][8]) {
+  uint8_t cells = 0;
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++) {
+      if (!(grid[row][col] & HIT)) {
+        cells++;
+      }
+    }
+  }
+  return cells;
+}
+
+// The number of shots in a salvo fired from own at target: one for each
+// ship still afloat, but no more than there are cells left to fire at
+static uint8_t salvo_size(uint8_t own[8][8], uint8_t target[8][8]) {
+  uint8_t shots = ships_afloat(own);
+  uint8_t cells = unhit_cells(target);
+  return shots < cells ? shots : cells;
+}
 
-    for (uint8_t i = 0;
-         i < invalidMoves && messageLength < sizeof(invalidMoveMessage) - 1;
-         i++) {
-      invalidMoveMessage[messageLength++] = '!';
+// Set the cells of the 3x3 area centred on row and col that haven't been
+// fired at in shots (one bit per column for each row of grid). Returns the
+// number of cells set.
+static uint8_t area_shots(uint8_t grid[8][8], uint8_t row, uint8_t col,
+                          uint8_t shots[GRID_NUM_ROWS]) {
+  uint8_t cells = 0;
+  for (int8_t r = row - 1; r <= row + 1; r++) {
+    for (int8_t c = col - 1; c <= col + 1; c++) {
+      if (r >= 0 && r < GRID_NUM_ROWS && c >= 0 && c < GRID_NUM_COLUMNS &&
+          !(grid[r][c] & HIT)) {
+        shots[r] |= 1 << c;
+        cells++;
+      }
     }
-    invalidMoveMessage[messageLength] = '\0';
+  }
+  return cells;
+}
 
-    printf("%s", invalidMoveMessage);
+// Draw the cells set in shots. A column with more of them than a column
+// update costs in pixel updates is sent as one column update instead.
+static void draw_shots(const GameState* game, uint8_t player,
+                       const uint8_t shots[GRID_NUM_ROWS]) {
+  for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++) {
+    uint8_t bit = 1 << col;
+    uint8_t cells = 0;
+    for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+      if (shots[row] & bit) {
+        cells++;
+      }
+    }
+    if (cells * PIXEL_UPDATE_BYTES > COLUMN_UPDATE_BYTES) {
+      // the computer grid is drawn upside down, see player_turn()
+      MatrixColumn column;
+      for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+        column[player ? 7 - row : row] = cell_colour(game, player, row, col);
+      }
+      ledmatrix_update_column(player ? col + GRID_NUM_COLUMNS : col, column);
+      continue;
+    }
+    for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+      if (!(shots[row] & bit)) {
+        continue;
+      }
+      if (player) {
+        ledmatrix_draw_pixel_in_computer_grid(col, 7 - row,
+                                              cell_colour(game, player, row, col));
+      } else {
+        ledmatrix_draw_pixel_in_human_grid(col, row,
+                                           cell_colour(game, player, row, col));
+      }
+    }
+  }
+}
 
-    if (invalidMoves < 3) {
-      invalidMoves++;
+// Fire every shot of a turn at once: mark the cells set in shots (one bit
+// per column for each row of grid) as hit, look for sunken ships once if
+// any of them hit a ship, then draw them all. player is as for
+// check_for_sunken_ships(), and grid is the grid of game it fires at.
+static void resolve_shots(const GameState* game, uint8_t player,
+                          uint8_t grid[8][8],
+                          const uint8_t shots[GRID_NUM_ROWS]) {
+  uint8_t ship_hit = 0;
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++) {
+      if (shots[row] & (1 << col)) {
+        grid[row][col] |= HIT;
+        ship_hit |= grid[row][col] & SHIP_MASK;
+      }
     }
-    return;
   }
+  if (ship_hit) {
+    check_for_sunken_ships(player, grid);
+  }
+  draw_shots(game, player, shots);
+}
+
+// Count the cells the human's salvo is aimed at
+static uint8_t salvo_aimed(const GameState* game) {
+  uint8_t aimed = 0;
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    for (uint8_t bits = game->salvo_aim[row]; bits; bits &= bits - 1) {
+      aimed++;
+    }
+  }
+  return aimed;
+}
+
+// Show how much of the human's salvo has been aimed
+static void show_salvo(GameState* game) {
+  log_at_P(LOG_CRITICAL, 0, 2, PSTR("Salvo %u/%u "), salvo_aimed(game),
+           salvo_size(game->human_grid, game->computer_grid));
+}
 
-  // draw red for hit green for miss
-  if (computer_grid[7 - cursor_y][cursor_x] != 0) {
-    computer_grid[7 - cursor_y][cursor_x] |= HIT;
-    check_for_sunken_ships(1, computer_grid);
-    ledmatrix_draw_pixel_in_computer_grid(cursor_x, cursor_y, COLOUR_RED);
+void player_turn(GameState* game) {
+  int8_t x = game->cursor_x;
+  uint8_t row = 7 - game->cursor_y;
+  uint8_t shots[GRID_NUM_ROWS] = {0};
+  uint8_t valid;
+  if (game->mode == MODE_AREA) {
+    valid = area_shots(game->computer_grid, row, x, shots);
   } else {
-    computer_grid[7 - cursor_y][cursor_x] |= HIT;
-    ledmatrix_draw_pixel_in_computer_grid(cursor_x, cursor_y, COLOUR_GREEN);
+    valid = !(game->computer_grid[row][x] & HIT);
+    shots[row] = 1 << x;
+  }
+
+  // handle invalid move
+  if (!valid) {
+    // one more '!' for each repeated invalid move
+    log_at_P(LOG_INFO, 0, 1, PSTR("Invalid move%.*s"), game->invalid_moves,
+             "!!!");
+
+    if (game->invalid_moves < 3) {
+      game->invalid_moves++;
+    }
+    return;
   }
 
   // clear terminal and invalid moves value on valid move
-  if (invalidMoves != 0) {
-    move_terminal_cursor(0, 0);
-    printf("                        ");
-    invalidMoves = 0;
+  if (game->invalid_moves != 0) {
+    log_at_P(LOG_INFO, 0, 0, PSTR("                        "));
+    game->invalid_moves = 0;
   }
 
-  computer_turn();
+  // in link play the shot is sent to the other board, and marked when its
+  // result comes back (see handle_link_event())
+  if (game->mode == MODE_LINK) {
+    if (!game->link_turn_ours) {
+      show_link_status(PSTR("Wait for their shot"));
+    } else if (link_fire(row * GRID_NUM_COLUMNS + x)) {
+      game->link_shot = row * GRID_NUM_COLUMNS + x;
+      game->link_turn_ours = 0;
+    }
+    return;
+  }
+
+  // in a salvo each fire aims at (or takes the aim off) one cell, and the
+  // salvo goes once a shot is aimed for every ship the human has afloat
+  if (game->mode == MODE_SALVO) {
+    game->salvo_aim[row] ^= shots[row];
+    if (salvo_aimed(game) <
+        salvo_size(game->human_grid, game->computer_grid)) {
+      ledmatrix_draw_pixel_in_computer_grid(x, game->cursor_y,
+                                            cell_colour(game, 1, row, x));
+      show_salvo(game);
+      return;
+    }
+    memcpy(shots, game->salvo_aim, sizeof(shots));
+    memset(game->salvo_aim, 0, sizeof(game->salvo_aim));
+  }
+
+  resolve_shots(game, 1, game->computer_grid, shots);
+  computer_turn(game);
+  if (game->mode == MODE_SALVO) {
+    show_salvo(game);
+  }
 }
 
-void computer_turn(void) {
-  // step through row, column and hit the first available space that hasn't been
-  // hit yet
-  for (int8_t row = 7; row >= 0; row--) {
-    for (int8_t col = 0; col < 8; col++) {
-      if ((human_grid[row][col] & HIT) == 0) {
-        if ((human_grid[row][col] != 0) && (human_grid[row][col] & SHIP_MASK)) {
-          ledmatrix_draw_pixel_in_human_grid(col, row, COLOUR_RED);
-          human_grid[row][col] |= HIT;
-          check_for_sunken_ships(0, human_grid);
-          return;
-        } else {
-          ledmatrix_draw_pixel_in_human_grid(col, row, COLOUR_GREEN);
-          human_grid[row][col] |= HIT;
-          return;
-        }
-      }
+void computer_turn(GameState* game) {
+  // fire at the best move the AI has found so far (it searches while the
+  // human is thinking, see ai.h), then start it on the next one
+  uint8_t shots[GRID_NUM_ROWS] = {0};
+  uint8_t row, col;
+  ai_best_move(game->ai, &row, &col);
+  if (game->mode == MODE_AREA) {
+    area_shots(game->human_grid, row, col, shots);
+  } else {
+    shots[row] = 1 << col;
+  }
+
+  // the rest of a salvo are the next best cells of the same search, so a
+  // salvo takes no more searching than a single shot
+  if (game->mode == MODE_SALVO) {
+    ai_best_moves(game->ai, salvo_size(game->computer_grid, game->human_grid),
+                  shots);
+  }
+
+  resolve_shots(game, 0, game->human_grid, shots);
+  ai_next_turn(game->ai, game->human_grid);
+}
+
+// Show how a link game is going, in program memory
+static void show_link_status(const char* message) {
+  // "\x1b[K" clears the rest of the line, as clear_to_end_of_line() does
+  log_at_P(LOG_CRITICAL, 0, 2, PSTR("%S\x1b[K"), message);
+}
+
+// End a link game, showing why
+static void end_link_game(GameState* game, const char* message) {
+  game->link_game_over = 1;
+  link_stop();
+  show_link_status(message);
+}
+
+// The other board has fired at the human's fleet: tell it the result
+static void take_link_shot(GameState* game) {
+  uint8_t cell = link_incoming();
+  uint8_t row = cell / GRID_NUM_COLUMNS;
+  uint8_t col = cell % GRID_NUM_COLUMNS;
+  uint8_t shots[GRID_NUM_ROWS] = {0};
+  shots[row] = 1 << col;
+  resolve_shots(game, 0, game->human_grid, shots);
+
+  uint8_t value = game->human_grid[row][col];
+  uint8_t result = LINK_MISS;
+  if (value & SHIP_MASK) {
+    result = LINK_HIT;
+    if (value & SUNK) {
+      result |= LINK_SUNK | (value & SHIP_MASK);
     }
   }
+  if (ships_afloat(game->human_grid) == 0) {
+    result |= LINK_FLEET_SUNK;
+  }
+  link_answer(result);
+
+  if (result & LINK_FLEET_SUNK) {
+    end_link_game(game, PSTR("You lost"));
+  } else {
+    game->link_turn_ours = 1;
+  }
 }
 
+// The result of the human's shot has come back from the other board
+static void mark_link_result(GameState* game) {
+  uint8_t result = link_result();
+  uint8_t row = game->link_shot / GRID_NUM_COLUMNS;
+  uint8_t col = game->link_shot % GRID_NUM_COLUMNS;
+  uint8_t shots[GRID_NUM_ROWS] = {0};
+  shots[row] = 1 << col;
+
+  // the type of ship hit isn't given until it is sunk, so any ship will do
+  game->computer_grid[row][col] |=
+      HIT | ((result & LINK_HIT) ? SHIP_MASK : SEA);
+  draw_shots(game, 1, shots);
+  if (result & LINK_SUNK) {
+    print_sunken_ship(1, result & SHIP_MASK);
+  }
+  if (result & LINK_FLEET_SUNK) {
+    end_link_game(game, PSTR("You won!"));
+  }
+}
+
+void handle_link_event(GameState* game, uint8_t what) {
+  if (game->mode != MODE_LINK || game->link_game_over) {
+    return;
+  }
+  switch (what) {
+    case LINK_CONNECTED:
+      game->link_turn_ours = link_first();
+      break;
+    case LINK_SHOT:
+      take_link_shot(game);
+      break;
+    case LINK_RESULT:
+      mark_link_result(game);
+      break;
+    case LINK_DESYNC:
+      end_link_game(game, PSTR("Out of step with the other board"));
+      break;
+    case LINK_LOST:
+      end_link_game(game, PSTR("Lost the other board"));
+      break;
+  }
+  if (!game->link_game_over) {
+    show_link_status(game->link_turn_ours ? PSTR("Your shot")
+                                          : PSTR("Their shot"));
+  }
+}
+
+uint8_t computer_think(GameState* game) { return ai_think(game->ai); }
+
+void computer_report(const GameState* game) { ai_report(game->ai); }
+
 // Returns 1 if the game is over, 0 otherwise.
-uint8_t is_game_over(void) {
+uint8_t is_game_over(const GameState* game) {
   // Detect if the game is over i.e. if a player has won.
   // return 0;
 
+  // in link play only the other board knows where its ships are
+  if (game->mode == MODE_LINK) {
+    return game->link_game_over;
+  }
+
   for (int8_t row = 7; row >= 0; row--) {
     for (int8_t col = 0; col < 8; col++) {
-      if ((human_grid[row][col] & SHIP_MASK) &&
-          !(human_grid[row][col] & SUNK)) {
+      if ((game->human_grid[row][col] & SHIP_MASK) &&
+          !(game->human_grid[row][col] & SUNK)) {
         return 0;
       }
     }
@@ -463,8 +753,8 @@ uint8_t is_game_over(void) {
 
   for (int8_t row = 7; row >= 0; row--) {
     for (int8_t col = 0; col < 8; col++) {
-      if ((computer_grid[row][col] & SHIP_MASK) &&
-          !(computer_grid[row][col] & SUNK)) {
+      if ((game->computer_grid[row][col] & SHIP_MASK) &&
+          !(game->computer_grid[row][col] & SUNK)) {
         return 0;
       }
     }
@@ -15,23 +15,117 @@
 
 #include <stdint.h>
 
+#include "ai.h"
+#include "ledmatrix.h"
+
+// Everything one game is up to. Nothing in game.c keeps game state of its
+// own, so games are independent of each other (on the host, several can
+// be played at once). The grids come first and the rest is bytes, so
+// there is no padding and a copy, to try a move out on, say, is a plain
+// structure assignment (but see ai below).
+typedef struct {
+  // the human's fleet and what is known of the computer's (in link play,
+  // the other board's), in the encoding below
+  uint8_t human_grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS];
+  uint8_t computer_grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS];
+  // the cells the human has aimed the next salvo at, one bit per column
+  // for each row of computer_grid
+  uint8_t salvo_aim[GRID_NUM_ROWS];
+  // the cursor, where it is drawn on the computer's grid (which is upside
+  // down, so it is on row 7 - cursor_y), whether it is showing, and the
+  // invalid moves in a row
+  int8_t cursor_x, cursor_y;
+  uint8_t cursor_on;
+  uint8_t invalid_moves;
+  // the game mode and fleet layouts (see fleets.h) used by the next call
+  // to initialise_game(), and whether the human has placed their own
+  uint8_t mode;
+  uint8_t human_fleet;
+  uint8_t computer_fleet;
+  uint8_t human_fleet_placed;
+  // in link play, whether it is the human's turn to fire, the cell they
+  // last fired at and whether the game is over
+  uint8_t link_turn_ours;
+  uint8_t link_shot;
+  uint8_t link_game_over;
+  // the computer player. A copy points at the same AiState, so calling
+  // initialise_game(), computer_turn() or computer_think() on a copy
+  // would change the AI of the game it was copied from: only the game
+  // the AI was given to with init_game_state() may call them.
+  AiState* ai;
+} GameState;
+
+// Set game up with the first fleet layouts and the classic mode, played
+// against ai (which may be 0 if computer_turn() is never called)
+void init_game_state(GameState* game, AiState* ai);
+
 // Initialise the game by resetting the grid and beat
-void initialise_game(void);
+void initialise_game(GameState* game);
+
+// Choose the human fleet layout (see fleets.h) for the next game. The
+// computer uses the layout after it.
+void select_fleet(GameState* game, uint8_t layout);
+
+// Returns the human fleet layout chosen with select_fleet()
+uint8_t selected_fleet(const GameState* game);
+
+// Start the next game with the fleet the human placed in human_grid (see
+// placement.h) rather than the chosen layout
+void use_placed_fleet(GameState* game);
+
+// Game modes. In a salvo each player fires one shot a turn for each of
+// their ships still afloat, and in an area strike every cell of the 3x3
+// square centred on the target. In link play the other player is another
+// board (see link.h) instead of the computer, taking turns a shot at a time.
+#define MODE_CLASSIC 0
+#define MODE_SALVO 1
+#define MODE_AREA 2
+#define MODE_LINK 3
+#define NUM_GAME_MODES 4
+
+// Choose the game mode for the next game
+void select_mode(GameState* game, uint8_t mode);
+
+// Returns the game mode chosen with select_mode()
+uint8_t selected_mode(const GameState* game);
+
+// Return the name of a game mode. The returned pointer is to program
+// memory, so print it with printf_P and "%S".
+const char* mode_name(uint8_t mode);
 
 // flash the cursor
-void flash_cursor(void);
+void flash_cursor(GameState* game);
 
 // move the cursor in the x and/or y direction
-void move_cursor(int8_t dx, int8_t dy);
+void move_cursor(GameState* game, int8_t dx, int8_t dy);
 
 // Returns 1 if the game is over, 0 otherwise.
-uint8_t is_game_over(void);
+uint8_t is_game_over(const GameState* game);
 
-// Handles the player turn
-void player_turn(void);
+// Handles the player turn. In a salvo, fire aims at the cursor (or takes
+// the aim off it), and the salvo is fired once it is fully aimed. In link
+// play the shot is sent to the other board, on the human's turn only.
+void player_turn(GameState* game);
 
 // Handles the computer turn
-void computer_turn(void);
+void computer_turn(GameState* game);
+
+// Handle what happened on the link in link play: the key of an EVENT_LINK
+// event (see events.h and link.h)
+void handle_link_event(GameState* game, uint8_t what);
+
+// Let the computer search for its next move for a slice, while waiting for
+// the human (see events_set_idle() in events.h). Returns 1 while it has
+// more to search.
+uint8_t computer_think(GameState* game);
+
+// Print how much the computer searched for its moves (see ai.h)
+void computer_report(const GameState* game);
+
+// The functions below don't take a GameState: they only need the grid
+// that was fired at, which is how attract mode and bitsim_check use them.
+// player is 1 for a computer_grid (the human fired at it) and 0 for a
+// human_grid.
 
 // Check for sunken ships
 void check_for_sunken_ships(uint8_t player, uint8_t grid[8][8]);
@@ -43,6 +137,18 @@ void sink_ship(uint8_t player, int8_t col, int8_t row, char direction,
 // Print to console when a ship is sunk
 void print_sunken_ship(uint8_t player, uint8_t ship);
 
+// Sunken ships are listed in a battle log on the terminal, in rows
+// BATTLE_LOG_TOP to BATTLE_LOG_BOTTOM, which are the terminal's scroll
+// region during a game. A line is written on the (blank) bottom row and its
+// newline scrolls it up, so older lines are never redrawn and the status
+// lines above the log stay where they are.
+#define BATTLE_LOG_TOP 5
+#define BATTLE_LOG_BOTTOM 22
+
+// Make rows top to bottom the battle log instead (attract mode keeps it
+// below the start screen, see attract.h)
+void open_battle_log(int8_t top, int8_t bottom);
+
 #define SEA 0b00000000
 #define CARRIER 0b00000001
 #define CRUISER 0b00000010
@@ -0,0 +1,48 @@
+/*
+ * hal.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Hardware abstraction layer. The drivers (spi.c, serialio.c, uart1.c,
+ * timer0.c, timer1.c, timer2.c and buttons.c) talk to the peripherals only
+ * through the functions declared by the backend included below, so that
+ * the same drivers - and everything above them - can be built for the
+ * ATmega324A or natively on a Linux host.
+ *
+ * hal_avr.h implements the interface with static inline functions that
+ * compile down to the same register accesses the drivers used to make
+ * directly. host/hal_host.h declares the host implementation in
+ * host/hal_host.c, which emulates interrupts with a 1kHz signal.
+ *
+ * Both backends provide:
+ *  - ISR(vector) and the vector names used by the drivers
+ *  - hal_irq_save()/hal_irq_restore() for critical sections, and
+ *    hal_irq_enable()/hal_irq_disable()/hal_irq_enabled()
+ *  - hal_cpu_relax(), to be called in the body of busy-wait loops, and
+ *    hal_cpu_sleep() to wait for an interrupt
+ *  - hal_spi_init()/hal_spi_transfer() for the SPI master, and
+ *    hal_spi_pause() to wait between transfers
+ *  - hal_uart0_*() for USART0 and hal_stdio_attach() to bind stdin and
+ *    stdout to a pair of character functions
+ *  - hal_uart1_*() for USART1, the link to another board or telemetry
+ *  - hal_timer0_start_1ms() for the millisecond tick, or
+ *    hal_timer0_start_cycles()/hal_timer0_count() to count CPU cycles
+ *    (in units of 64) in the tickless mode, which doesn't use it
+ *  - hal_timer1_start_cycles()/hal_timer1_count() to count CPU cycles,
+ *    or hal_timer1_start_ticks() and the overflow and compare functions
+ *    for the deadlines of the tickless mode
+ *  - hal_timer2_start_4ms()/hal_timer2_stop() for the button sampling tick
+ *  - hal_buttons_irq_init()/hal_buttons_read() for the push buttons, and
+ *    hal_buttons_irq_disable()/hal_buttons_irq_enable()
+ */
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#if defined(__AVR__)
+#include "hal_avr.h"
+#else
+#include "hal_host.h"
+#endif
+
+#endif /* HAL_H_ */
@@ -0,0 +1,413 @@
+/*
+ * hal_avr.h
+ *
+ * Author: Andrew Wilson
+ *
+ * ATmega324A backend for the hardware abstraction layer (see hal.h).
+ * Everything here is static inline so using the HAL costs nothing over
+ * accessing the registers directly. Datasheet page numbers refer to the
+ * ATmega324A datasheet.
+ */
+
+#ifndef HAL_AVR_H_
+#define HAL_AVR_H_
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <util/delay_basic.h>
+
+/* System clock rate in Hz */
+#define HAL_SYSCLK 8000000L
+
+/*
+ * Interrupt mask
+ */
+
+/* Disable interrupts, returning whether they were enabled before */
+static inline uint8_t hal_irq_save(void)
+{
+	uint8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	return interrupts_were_enabled;
+}
+
+/* Re-enable interrupts if state (from hal_irq_save()) says they were on */
+static inline void hal_irq_restore(uint8_t state)
+{
+	if (state)
+	{
+		sei();
+	}
+}
+
+static inline uint8_t hal_irq_enabled(void)
+{
+	return bit_is_set(SREG, SREG_I);
+}
+
+static inline void hal_irq_enable(void)
+{
+	sei();
+}
+
+static inline void hal_irq_disable(void)
+{
+	cli();
+}
+
+/* Called from the body of busy-wait loops. Nothing to do on the device
+ * - interrupts fire by themselves. */
+static inline void hal_cpu_relax(void)
+{
+}
+
+/* Enable interrupts and sleep (idle mode - the timers and UART keep
+ * running) until an interrupt has been handled. Call with interrupts
+ * disabled, after checking there is nothing to do: the instruction after
+ * sei is always executed, so an interrupt that is already pending wakes
+ * the CPU as soon as it is asleep instead of being missed. */
+static inline void hal_cpu_sleep(void)
+{
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+}
+
+/*
+ * SPI master
+ */
+
+/* Set up SPI communication as a master. clockdivider should be one of
+ * 2,4,8,16,32,64,128 - invalid values default to the slowest speed. */
+static inline void hal_spi_init(uint8_t clockdivider)
+{
+	// Make the SS, MOSI and SCK pins outputs. These are pins
+	// 4, 5 and 7 of port B on the ATmega324A
+	DDRB |= (1 << DDB7) | (1 << DDB5) | (1 << DDB4);
+	
+	// Set the slave select (SS) line high
+	PORTB |= (1 << PORTB4);
+	
+	// Set up the SPI control registers SPCR and SPSR:
+	// - SPE bit = 1 (SPI is enabled)
+	// - MSTR bit = 1 (Master Mode)
+	SPCR0 = (1 << SPE0) | (1 << MSTR0);
+	
+	// Set SPR0 and SPR1 bits in SPCR and SPI2X bit in SPSR
+	// based on the given clock divider
+	// We consider each bit in turn
+	switch (clockdivider)
+	{
+		case 2: /* FALLTHROUGH */
+		case 8: /* FALLTHROUGH */
+		case 32:
+			SPSR0 = (1 << SPI2X0);
+			break;
+		default:
+			SPSR0 = 0;
+			break;
+	}
+	switch (clockdivider)
+	{
+		case 128:
+			SPCR0 |= (1 << SPR00);
+			/* FALLTHROUGH */
+		case 32: /* FALLTHROUGH */
+		case 64:
+			SPCR0 |= (1 << SPR10);
+			break;
+		case 8: /* FALLTHROUGH */
+		case 16:
+			SPCR0 |= (1 << SPR00);
+			break;
+	}
+	
+	// Take SS (slave select) line low
+	PORTB &= ~(1 << PORTB4);
+}
+
+/* Send a byte and return the byte received. Busy waits for the transfer
+ * to complete. (The final read of SPSR0 followed by a read of SPDR0
+ * will cause the SPIF bit to be reset to 0. See page 173.) */
+static inline uint8_t hal_spi_transfer(uint8_t byte)
+{
+	SPDR0 = byte;
+	while ((SPSR0 & (1 << SPIF0)) == 0)
+	{
+		; // wait
+	}
+	return SPDR0;
+}
+
+/* Busy wait for about the given number of CPU cycles (rounded down to a
+ * multiple of 4) between transfers, to give the slave time to keep up */
+static inline void hal_spi_pause(uint16_t cycles)
+{
+	// _delay_loop_2() takes 4 cycles an iteration, and 65536 for 0
+	if (cycles >= 4)
+	{
+		_delay_loop_2(cycles / 4);
+	}
+}
+
+/*
+ * USART0
+ */
+
+/* Set the baud rate register and enable transmission, reception and the
+ * receive complete interrupt. The data register empty interrupt is left
+ * off until there is something to send. */
+static inline void hal_uart0_init(uint16_t ubrr)
+{
+	UBRR0 = ubrr;
+	UCSR0B = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0);
+}
+
+static inline void hal_uart0_write(uint8_t c)
+{
+	UDR0 = c;
+}
+
+static inline uint8_t hal_uart0_read(void)
+{
+	return UDR0;
+}
+
+/* Whether a character was lost because the last one hadn't been read in
+ * time. Only valid until the character received is read. */
+static inline uint8_t hal_uart0_overrun(void)
+{
+	return (UCSR0A & (1 << DOR0)) != 0;
+}
+
+static inline void hal_uart0_tx_irq_enable(void)
+{
+	UCSR0B |= (1 << UDRIE0);
+}
+
+static inline void hal_uart0_tx_irq_disable(void)
+{
+	UCSR0B &= ~(1 << UDRIE0);
+}
+
+/*
+ * USART1
+ */
+
+/* As hal_uart0_init(). USART1 is on PD2 (RXD1) and PD3 (TXD1), 8 data
+ * bits, no parity and 1 stop bit as after reset. */
+static inline void hal_uart1_init(uint16_t ubrr)
+{
+	UBRR1 = ubrr;
+	UCSR1B = (1 << RXEN1) | (1 << TXEN1) | (1 << RXCIE1);
+}
+
+/* Change the baud rate. A byte being sent when it changes is garbled. */
+static inline void hal_uart1_set_baud(uint16_t ubrr)
+{
+	UBRR1 = ubrr;
+}
+
+/* The transmit complete flag is cleared with each byte (by writing a one
+ * to it, and zeros to the error flags), so it is only set once the last
+ * byte written has left. */
+static inline void hal_uart1_write(uint8_t c)
+{
+	UCSR1A = (UCSR1A & (1 << U2X1)) | (1 << TXC1);
+	UDR1 = c;
+}
+
+/* Whether the last byte written has been sent, stop bit and all */
+static inline uint8_t hal_uart1_tx_done(void)
+{
+	return (UCSR1A & (1 << TXC1)) != 0;
+}
+
+static inline uint8_t hal_uart1_read(void)
+{
+	return UDR1;
+}
+
+static inline void hal_uart1_tx_irq_enable(void)
+{
+	UCSR1B |= (1 << UDRIE1);
+}
+
+static inline void hal_uart1_tx_irq_disable(void)
+{
+	UCSR1B &= ~(1 << UDRIE1);
+}
+
+/* Make stdin and stdout use the given character functions */
+static inline void hal_stdio_attach(int (*put)(char, FILE*),
+		int (*get)(FILE*))
+{
+	static FILE stream;
+	fdev_setup_stream(&stream, put, get, _FDEV_SETUP_RW);
+	stdout = &stream;
+	stdin = &stream;
+}
+
+/*
+ * Timers
+ */
+
+/* Set up timer 0 to generate an output compare A interrupt every 1ms.
+ * We divide the clock by 64 and count up to 124 in CTC mode, i.e. an
+ * interrupt every 64 x 125 clock cycles. */
+static inline void hal_timer0_start_1ms(void)
+{
+	/* Clear the timer */
+	TCNT0 = 0;
+
+	/* Set the output compare value to be 124 */
+	OCR0A = 124;
+	
+	/* Set the timer to clear on compare match (CTC mode)
+	 * and to divide the clock by 64. This starts the timer
+	 * running.
+	 */
+	TCCR0A = (1 << WGM01);
+	TCCR0B = (1 << CS01) | (1 << CS00);
+
+	/* Enable an interrupt on output compare match. 
+	 * Note that interrupts have to be enabled globally
+	 * before the interrupts will fire.
+	 */
+	TIMSK0 |= (1 << OCIE0A);
+	
+	/* Make sure the interrupt flag is cleared by writing a 
+	 * 1 to it.
+	 */
+	TIFR0 = (1 << OCF0A);
+}
+
+/* Set timer 0 counting in units of 64 CPU cycles, with no interrupt. It
+ * times the interrupt handlers in the tickless mode, which leaves timer 0
+ * free (see isrprofile.h). */
+static inline void hal_timer0_start_cycles(void)
+{
+	TCCR0A = 0;
+	TCCR0B = (1 << CS01) | (1 << CS00);
+	TCNT0 = 0;
+}
+
+static inline uint8_t hal_timer0_count(void)
+{
+	return TCNT0;
+}
+
+/* Set timer 1 counting CPU cycles: normal mode, no prescaler */
+static inline void hal_timer1_start_cycles(void)
+{
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);
+	TCNT1 = 0;
+}
+
+/* Timer 1 count. The high byte is latched when the low byte is read, but
+ * an interrupt handler that reads TCNT1 in between would overwrite the
+ * latch, so outside handlers call this with interrupts off. */
+static inline uint16_t hal_timer1_count(void)
+{
+	return TCNT1;
+}
+
+/* Set timer 1 counting in units of 1024 CPU cycles (128us at 8MHz) with
+ * an interrupt when it overflows, every 8.4s. Used by the tickless mode
+ * (see timer1.c). */
+static inline void hal_timer1_start_ticks(void)
+{
+	TCCR1A = 0;
+	TCCR1B = (1 << CS12) | (1 << CS10);
+	TCNT1 = 0;
+	TIFR1 = (1 << TOV1) | (1 << OCF1A);
+	TIMSK1 = (1 << TOIE1);
+}
+
+/* Non-zero if timer 1 has overflowed and the overflow interrupt has not
+ * run yet (only meaningful with interrupts off) */
+static inline uint8_t hal_timer1_overflowed(void)
+{
+	return TIFR1 & (1 << TOV1);
+}
+
+/* Interrupt (output compare A) the next time timer 1 counts to count */
+static inline void hal_timer1_set_compare(uint16_t count)
+{
+	OCR1A = count;
+	TIFR1 = (1 << OCF1A);
+	TIMSK1 |= (1 << OCIE1A);
+}
+
+static inline void hal_timer1_compare_irq_disable(void)
+{
+	TIMSK1 &= ~(1 << OCIE1A);
+}
+
+/* Set up timer 2 to generate an output compare A interrupt every 4ms.
+ * We divide the clock by 256 and count up to 124 in CTC mode, i.e. an
+ * interrupt every 256 x 125 clock cycles. */
+static inline void hal_timer2_start_4ms(void)
+{
+	TCNT2 = 0;
+	OCR2A = 124;
+	TCCR2A = (1 << WGM21);
+	TCCR2B = (1 << CS22) | (1 << CS21);
+	TIMSK2 |= (1 << OCIE2A);
+	TIFR2 = (1 << OCF2A);
+}
+
+/* Stop timer 2 and its interrupt */
+static inline void hal_timer2_stop(void)
+{
+	TIMSK2 &= ~(1 << OCIE2A);
+	TCCR2B = 0;
+}
+
+/*
+ * Push buttons on pins B0 to B3
+ */
+
+/* Enable the pin change interrupt for pins B0 to B3. These pins
+ * correspond to pin change interrupts PCINT8 to PCINT11 which are
+ * covered by Pin change interrupt 1. */
+static inline void hal_buttons_irq_init(void)
+{
+	// Enable the interrupt (see datasheet page 77)
+	PCICR |= (1 << PCIE1);
+	
+	// Make sure the interrupt flag is cleared (by writing a 
+	// 1 to it) (see datasheet page 78)
+	PCIFR |= (1 << PCIF1);
+	
+	// Choose which pins we're interested in by setting
+	// the relevant bits in the mask register (see datasheet page 78)
+	PCMSK1 |= (1 << PCINT8) | (1 << PCINT9) | (1 << PCINT10) | (1 << PCINT11);
+}
+
+/* Turn the pin change interrupt off and on again after
+ * hal_buttons_irq_init(). Turning it on doesn't clear the interrupt flag,
+ * so a change while it was off still raises the interrupt. */
+static inline void hal_buttons_irq_disable(void)
+{
+	PCICR &= ~(1 << PCIE1);
+}
+
+static inline void hal_buttons_irq_enable(void)
+{
+	PCICR |= (1 << PCIE1);
+}
+
+/* Current state of the buttons, bit n set if button n is down */
+static inline uint8_t hal_buttons_read(void)
+{
+	return PINB & 0x0F;
+}
+
+#endif /* HAL_AVR_H_ */
@@ -0,0 +1,821 @@
+/*
+ * hal_host.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Linux host backend for the hardware abstraction layer. See hal_host.h
+ * for how interrupts and the UART are emulated.
+ */
+
+#define _GNU_SOURCE
+
+#include "hal.h"
+#include "matrix_model.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Interrupt service routines the firmware may or may not define */
+#pragma weak USART0_RX_vect
+#pragma weak USART0_UDRE_vect
+#pragma weak USART1_RX_vect
+#pragma weak USART1_UDRE_vect
+#pragma weak TIMER0_COMPA_vect
+#pragma weak TIMER2_COMPA_vect
+#pragma weak TIMER1_COMPA_vect
+#pragma weak TIMER1_OVF_vect
+#pragma weak PCINT1_vect
+
+/* The global interrupt enable flag (SREG I bit), and whether there is
+ * work the signal handler could not do because interrupts were off */
+static volatile sig_atomic_t irq_enabled;
+static volatile sig_atomic_t irq_pending;
+static volatile sig_atomic_t in_service;
+
+/* Number of times interrupts have been serviced, so hal_cpu_sleep() can
+ * tell whether it has anything to wait for */
+static volatile uint32_t services;
+
+/* An emulated USART: the files it reads and writes, the receive pacing
+ * and the bytes written by its data register empty ISR, which are flushed
+ * after each service */
+typedef struct {
+	volatile sig_atomic_t enabled;
+	volatile sig_atomic_t tx_irq;
+	int in_fd;
+	int out_fd;
+	uint8_t rx_data;
+	uint32_t chars_per_second;
+	struct timespec epoch;
+	uint64_t rx_delivered;
+	uint8_t out_buffer[512];
+	size_t out_length;
+} HostUart;
+
+/* Peripheral state */
+static volatile sig_atomic_t started;
+static HostUart uart0 = { .in_fd = STDIN_FILENO, .out_fd = STDOUT_FILENO };
+static HostUart uart1 = { .in_fd = -1, .out_fd = -1 };
+static volatile sig_atomic_t timer0_enabled;
+static volatile sig_atomic_t timer2_enabled;
+static volatile sig_atomic_t buttons_irq;
+static volatile uint8_t buttons_state;
+static volatile uint8_t buttons_last_seen;
+static uint8_t spi_divider = 128;
+static uint32_t spi_clock;
+static HalSpiSlave spi_slave;
+static void* spi_slave_context;
+
+/* The pty slaves kept open by open_pty() and the saved terminal settings */
+static int uart0_pty_slave_fd = -1;
+static int uart1_pty_slave_fd = -1;
+static int terminal_saved;
+static struct termios saved_termios;
+
+/* Time of the first timer 0 tick and the number of ticks delivered, or
+ * when timer 0 was started counting cycles */
+static struct timespec timer0_epoch;
+static uint64_t timer0_delivered;
+
+/* Timer 1 counts CPU cycles divided by timer1_divider from timer1_epoch.
+ * In the tickless mode it has an overflow interrupt, and a compare
+ * interrupt at the next count equal to timer1_compare after
+ * timer1_compare_from. */
+static struct timespec timer1_epoch;
+static uint32_t timer1_divider = 1;
+static volatile sig_atomic_t timer1_ticks;
+static uint64_t timer1_overflows_delivered;
+static volatile sig_atomic_t timer1_compare_irq;
+static uint16_t timer1_compare;
+static uint64_t timer1_compare_from;
+
+/* Same for timer 2, which ticks every 4ms */
+static struct timespec timer2_epoch;
+static uint64_t timer2_delivered;
+
+/* LED matrix shown by battleship_host when BATTLESHIP_MATRIX is set, on
+ * stderr or as PPM files. Only touched from service(). */
+#define MATRIX_FRAME_MS 100
+static MatrixModel matrix;
+static FILE* matrix_terminal;
+static const char* matrix_ppm_dir;
+static struct timespec matrix_epoch;
+static uint64_t matrix_last_frame;
+
+static void flush_uart_output(HostUart* uart)
+{
+	size_t done = 0;
+	while (done < uart->out_length)
+	{
+		ssize_t n = write(uart->out_fd, uart->out_buffer + done,
+				uart->out_length - done);
+		if (n < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN)
+			{
+				continue;
+			}
+			break;
+		}
+		done += n;
+	}
+	uart->out_length = 0;
+}
+
+static uint64_t ms_since(const struct timespec* start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)(now.tv_sec - start->tv_sec) * 1000
+			+ (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* Timer 1 count since it was started, without wrapping around */
+static uint64_t timer1_elapsed(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t ns = (int64_t)(now.tv_sec - timer1_epoch.tv_sec) * 1000000000
+			+ (now.tv_nsec - timer1_epoch.tv_nsec);
+	return (uint64_t)ns * (HAL_SYSCLK / 1000000) / 1000 / timer1_divider;
+}
+
+/* Show the matrix if it changed, at most every MATRIX_FRAME_MS */
+static void show_matrix(void)
+{
+	uint64_t now = ms_since(&matrix_epoch);
+	if (now - matrix_last_frame < MATRIX_FRAME_MS || matrix.frame.bytes == 0)
+	{
+		return;
+	}
+	matrix_last_frame = now;
+	if (matrix_terminal)
+	{
+		fprintf(matrix_terminal, "frame %u: %u bytes, %u commands, "
+				"batched %u bytes\n", matrix.frames, matrix.frame.bytes,
+				matrix.frame.commands, matrix_model_batched_bytes(&matrix));
+		matrix_model_render(&matrix, matrix_terminal);
+		fflush(matrix_terminal);
+	} else
+	{
+		char path[512];
+		snprintf(path, sizeof(path), "%s/matrix%06u.ppm", matrix_ppm_dir,
+				matrix.frames);
+		matrix_model_write_ppm(&matrix, path, 16);
+	}
+	matrix_model_end_frame(&matrix);
+}
+
+/* Run the receive complete ISR for each byte waiting on the UART's input.
+ * Input is delivered no faster than the baud rate allows, so a burst of
+ * it behaves as it would on the device instead of overrunning the
+ * driver's buffer at once. */
+static void receive(HostUart* uart, void (*vector)(void))
+{
+	uint64_t allowed = ms_since(&uart->epoch)
+			* uart->chars_per_second / 1000;
+	uint64_t burst = uart->chars_per_second / 1000 + 1;
+	if (allowed - uart->rx_delivered > burst)
+	{
+		/* The line was idle - no credit for that time */
+		uart->rx_delivered = allowed - burst;
+	}
+	struct pollfd pfd = { .fd = uart->in_fd, .events = POLLIN };
+	while (uart->rx_delivered < allowed
+			&& poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN))
+	{
+		if (read(uart->in_fd, &uart->rx_data, 1) != 1)
+		{
+			break;
+		}
+		uart->rx_delivered++;
+		vector();
+	}
+}
+
+/* Run every interrupt that is due, with interrupts disabled as they would
+ * be inside an AVR ISR. */
+static void service(void)
+{
+	if (in_service)
+	{
+		irq_pending = 1;
+		return;
+	}
+	in_service = 1;
+	do
+	{
+		irq_pending = 0;
+		irq_enabled = 0;
+		
+		if (timer0_enabled && TIMER0_COMPA_vect)
+		{
+			uint64_t due = ms_since(&timer0_epoch);
+			/* Don't try to catch up on more than a second of ticks
+			 * (e.g. after the process was stopped) */
+			if (due - timer0_delivered > 1000)
+			{
+				timer0_delivered = due - 1000;
+			}
+			while (timer0_delivered < due)
+			{
+				TIMER0_COMPA_vect();
+				timer0_delivered++;
+			}
+		}
+		
+		if (timer1_ticks)
+		{
+			uint64_t count = timer1_elapsed();
+			if (timer1_compare_irq && TIMER1_COMPA_vect)
+			{
+				/* The first count after timer1_compare_from that
+				 * matches the compare register */
+				uint64_t match = (timer1_compare_from & ~0xFFFFULL)
+						| timer1_compare;
+				if (match <= timer1_compare_from)
+				{
+					match += 0x10000;
+				}
+				if (match <= count)
+				{
+					timer1_compare_from = count;
+					TIMER1_COMPA_vect();
+				}
+			}
+			while (timer1_overflows_delivered < count >> 16)
+			{
+				timer1_overflows_delivered++;
+				if (TIMER1_OVF_vect)
+				{
+					TIMER1_OVF_vect();
+				}
+			}
+		}
+		
+		if (timer2_enabled && TIMER2_COMPA_vect)
+		{
+			uint64_t due = ms_since(&timer2_epoch) / 4;
+			if (due - timer2_delivered > 250)
+			{
+				timer2_delivered = due - 250;
+			}
+			while (timer2_delivered < due)
+			{
+				TIMER2_COMPA_vect();
+				timer2_delivered++;
+			}
+		}
+		
+		if (buttons_irq && buttons_state != buttons_last_seen
+				&& PCINT1_vect)
+		{
+			buttons_last_seen = buttons_state;
+			PCINT1_vect();
+		}
+		
+		if (uart0.enabled && USART0_RX_vect)
+		{
+			receive(&uart0, USART0_RX_vect);
+		}
+		while (uart0.tx_irq && USART0_UDRE_vect)
+		{
+			USART0_UDRE_vect();
+		}
+		flush_uart_output(&uart0);
+		
+		if (uart1.enabled && USART1_RX_vect)
+		{
+			receive(&uart1, USART1_RX_vect);
+		}
+		while (uart1.tx_irq && USART1_UDRE_vect)
+		{
+			USART1_UDRE_vect();
+		}
+		flush_uart_output(&uart1);
+		
+		if (spi_slave == matrix_model_spi && spi_slave_context == &matrix)
+		{
+			show_matrix();
+		}
+		
+		irq_enabled = 1;
+		services++;
+	} while (irq_pending);
+	in_service = 0;
+}
+
+static void tick_handler(int signal_number)
+{
+	(void)signal_number;
+	int saved_errno = errno;
+	if (irq_enabled)
+	{
+		service();
+	} else
+	{
+		irq_pending = 1;
+	}
+	errno = saved_errno;
+}
+
+static void restore_terminal(void)
+{
+	if (terminal_saved)
+	{
+		tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+		terminal_saved = 0;
+	}
+}
+
+static void interrupt_handler(int signal_number)
+{
+	restore_terminal();
+	signal(signal_number, SIG_DFL);
+	raise(signal_number);
+}
+
+/* Start the 1kHz interrupt source the first time a peripheral is used */
+static void start(void)
+{
+	if (started)
+	{
+		return;
+	}
+	started = 1;
+	
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = tick_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGALRM, &action, NULL);
+	
+	struct itimerval interval;
+	interval.it_interval.tv_sec = 0;
+	interval.it_interval.tv_usec = 1000;
+	interval.it_value = interval.it_interval;
+	setitimer(ITIMER_REAL, &interval, NULL);
+}
+
+/* Make a terminal device pass bytes through untouched */
+static void make_raw(int fd)
+{
+	struct termios raw;
+	if (tcgetattr(fd, &raw) == 0)
+	{
+		cfmakeraw(&raw);
+		tcsetattr(fd, TCSANOW, &raw);
+	}
+}
+
+/* Connect the UART to a new pseudo terminal, returns 0 on success. port
+ * names it in the message giving the slave device. */
+static int open_pty(HostUart* uart, int* slave_fd, const char* port)
+{
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+	{
+		return -1;
+	}
+	const char* name = ptsname(master);
+	/* Keep the slave open so the master doesn't see a hang up while
+	 * nothing is attached, and make it raw */
+	*slave_fd = open(name, O_RDWR | O_NOCTTY);
+	if (*slave_fd >= 0)
+	{
+		make_raw(*slave_fd);
+	}
+	fprintf(stderr, "battleship: %s port on %s\n", port, name);
+	uart->in_fd = master;
+	uart->out_fd = master;
+	return 0;
+}
+
+/* Put the controlling terminal into a mode where each key is delivered
+ * straight away without being echoed */
+static void make_terminal_raw(void)
+{
+	if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_termios) < 0)
+	{
+		return;
+	}
+	terminal_saved = 1;
+	atexit(restore_terminal);
+	signal(SIGINT, interrupt_handler);
+	signal(SIGTERM, interrupt_handler);
+	
+	struct termios raw = saved_termios;
+	raw.c_lflag &= ~(ICANON | ECHO);
+	raw.c_iflag &= ~(ICRNL | IXON);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+}
+
+/*
+ * Interrupt mask
+ */
+
+uint8_t hal_irq_save(void)
+{
+	uint8_t state = irq_enabled;
+	irq_enabled = 0;
+	return state;
+}
+
+void hal_irq_restore(uint8_t state)
+{
+	if (state)
+	{
+		hal_irq_enable();
+	}
+}
+
+uint8_t hal_irq_enabled(void)
+{
+	return irq_enabled;
+}
+
+void hal_irq_enable(void)
+{
+	irq_enabled = 1;
+	if (irq_pending)
+	{
+		service();
+	}
+}
+
+void hal_irq_disable(void)
+{
+	irq_enabled = 0;
+}
+
+void hal_cpu_relax(void)
+{
+	/* Give the host CPU a rest; the next tick will arrive within 1ms */
+	if (irq_enabled)
+	{
+		struct timespec pause = { 0, 100000 };
+		nanosleep(&pause, NULL);
+	}
+}
+
+void hal_cpu_sleep(void)
+{
+	/* Block the tick while interrupts are enabled, so one that arrives in
+	 * between is kept for sigsuspend() - like sei before sleep */
+	sigset_t tick, unblocked;
+	sigemptyset(&tick);
+	sigaddset(&tick, SIGALRM);
+	sigprocmask(SIG_BLOCK, &tick, &unblocked);
+	uint32_t serviced = services;
+	hal_irq_enable();
+	if (services == serviced)
+	{
+		sigsuspend(&unblocked);
+	}
+	sigprocmask(SIG_SETMASK, &unblocked, NULL);
+}
+
+/*
+ * SPI master
+ */
+
+void hal_spi_init(uint8_t clockdivider)
+{
+	spi_divider = clockdivider;
+	
+	/* Unless a tool has installed its own model, show the LED matrix if
+	 * asked to: "term" draws it on stderr, anything else is a directory
+	 * for PPM snapshots */
+	const char* show = getenv("BATTLESHIP_MATRIX");
+	if (spi_slave || show == NULL)
+	{
+		return;
+	}
+	if (strcmp(show, "term") == 0)
+	{
+		matrix_terminal = fdopen(dup(STDERR_FILENO), "w");
+	} else
+	{
+		matrix_ppm_dir = show;
+	}
+	matrix_model_init(&matrix);
+	clock_gettime(CLOCK_MONOTONIC, &matrix_epoch);
+	hal_host_set_spi_slave(matrix_model_spi, &matrix);
+}
+
+uint8_t hal_spi_transfer(uint8_t byte)
+{
+	/* 8 bits of the divided clock */
+	spi_clock += 8 * (uint32_t)spi_divider;
+	if (spi_slave)
+	{
+		return spi_slave(byte, spi_slave_context);
+	}
+	return 0;
+}
+
+void hal_spi_pause(uint16_t cycles)
+{
+	spi_clock += cycles;
+}
+
+void hal_host_set_spi_slave(HalSpiSlave slave, void* context)
+{
+	spi_slave = slave;
+	spi_slave_context = context;
+}
+
+uint8_t hal_host_spi_divider(void)
+{
+	return spi_divider;
+}
+
+uint32_t hal_host_spi_clock(void)
+{
+	return spi_clock;
+}
+
+/*
+ * USART0 and USART1
+ */
+
+static void set_baud_rate(HostUart* uart, uint16_t ubrr)
+{
+	/* 10 bits per character: start, 8 data, stop */
+	uart->chars_per_second = HAL_SYSCLK / (16L * (ubrr + 1)) / 10;
+	clock_gettime(CLOCK_MONOTONIC, &uart->epoch);
+	uart->rx_delivered = 0;
+}
+
+static void write_byte(HostUart* uart, uint8_t c)
+{
+	if (uart->out_length == sizeof(uart->out_buffer))
+	{
+		flush_uart_output(uart);
+	}
+	uart->out_buffer[uart->out_length++] = c;
+}
+
+void hal_uart0_init(uint16_t ubrr)
+{
+	set_baud_rate(&uart0, ubrr);
+	if (getenv("BATTLESHIP_PTY") == NULL
+			|| open_pty(&uart0, &uart0_pty_slave_fd, "serial") < 0)
+	{
+		make_terminal_raw();
+	}
+	uart0.enabled = 1;
+	start();
+}
+
+void hal_uart0_write(uint8_t c)
+{
+	write_byte(&uart0, c);
+}
+
+uint8_t hal_uart0_read(void)
+{
+	return uart0.rx_data;
+}
+
+/* Characters are only delivered once the last has been read */
+uint8_t hal_uart0_overrun(void)
+{
+	return 0;
+}
+
+void hal_uart0_tx_irq_enable(void)
+{
+	/* The next tick drains the buffer, which keeps to one write() per
+	 * millisecond however the firmware produces its output */
+	uart0.tx_irq = 1;
+}
+
+void hal_uart0_tx_irq_disable(void)
+{
+	uart0.tx_irq = 0;
+}
+
+void hal_uart1_init(uint16_t ubrr)
+{
+	set_baud_rate(&uart1, ubrr);
+	/* The device named by BATTLESHIP_LINK (another instance's link pty, or
+	 * a real serial port), or a new pty for the other end to open */
+	const char* device = getenv("BATTLESHIP_LINK");
+	if (device)
+	{
+		int fd = open(device, O_RDWR | O_NOCTTY);
+		if (fd < 0)
+		{
+			fprintf(stderr, "battleship: can't open link port %s: %s\n",
+					device, strerror(errno));
+			return;
+		}
+		make_raw(fd);
+		uart1.in_fd = fd;
+		uart1.out_fd = fd;
+	} else if (open_pty(&uart1, &uart1_pty_slave_fd, "link") < 0)
+	{
+		return;
+	}
+	uart1.enabled = 1;
+	start();
+}
+
+void hal_uart1_set_baud(uint16_t ubrr)
+{
+	set_baud_rate(&uart1, ubrr);
+}
+
+void hal_uart1_write(uint8_t c)
+{
+	/* Nothing is connected if the port couldn't be opened */
+	if (uart1.enabled)
+	{
+		write_byte(&uart1, c);
+	}
+}
+
+/* Bytes are handed to the pty as soon as they are written */
+uint8_t hal_uart1_tx_done(void)
+{
+	return 1;
+}
+
+uint8_t hal_uart1_read(void)
+{
+	return uart1.rx_data;
+}
+
+void hal_uart1_tx_irq_enable(void)
+{
+	uart1.tx_irq = 1;
+}
+
+void hal_uart1_tx_irq_disable(void)
+{
+	uart1.tx_irq = 0;
+}
+
+static ssize_t stream_write(void* cookie, const char* buffer, size_t size)
+{
+	int (*put)(char, FILE*) = ((int (**)(char, FILE*))cookie)[0];
+	for (size_t i = 0; i < size; i++)
+	{
+		put(buffer[i], NULL);
+	}
+	return size;
+}
+
+static ssize_t stream_read(void* cookie, char* buffer, size_t size)
+{
+	int (*get)(FILE*) = ((int (**)(FILE*))cookie)[1];
+	if (size == 0)
+	{
+		return 0;
+	}
+	/* One character at a time, like the AVR stdio stream */
+	buffer[0] = get(NULL);
+	return 1;
+}
+
+void hal_stdio_attach(int (*put)(char, FILE*), int (*get)(FILE*))
+{
+	static void* functions[2];
+	functions[0] = (void*)put;
+	functions[1] = (void*)get;
+	cookie_io_functions_t io = {
+		.read = stream_read,
+		.write = stream_write,
+	};
+	FILE* stream = fopencookie(functions, "r+", io);
+	setvbuf(stream, NULL, _IONBF, 0);
+	stdout = stream;
+	stdin = stream;
+}
+
+/*
+ * Timers
+ */
+
+void hal_timer0_start_1ms(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &timer0_epoch);
+	timer0_delivered = 0;
+	timer0_enabled = 1;
+	start();
+}
+
+void hal_timer0_start_cycles(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &timer0_epoch);
+	timer0_enabled = 0;
+}
+
+uint8_t hal_timer0_count(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t ns = (int64_t)(now.tv_sec - timer0_epoch.tv_sec) * 1000000000
+			+ (now.tv_nsec - timer0_epoch.tv_nsec);
+	return (uint8_t)((uint64_t)ns * (HAL_SYSCLK / 1000000) / 1000 / 64);
+}
+
+void hal_timer1_start_cycles(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &timer1_epoch);
+	timer1_divider = 1;
+	timer1_ticks = 0;
+}
+
+void hal_timer1_start_ticks(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &timer1_epoch);
+	timer1_divider = 1024;
+	timer1_overflows_delivered = 0;
+	timer1_compare_irq = 0;
+	timer1_ticks = 1;
+	start();
+}
+
+uint16_t hal_timer1_count(void)
+{
+	return (uint16_t)timer1_elapsed();
+}
+
+uint8_t hal_timer1_overflowed(void)
+{
+	return timer1_overflows_delivered < timer1_elapsed() >> 16;
+}
+
+void hal_timer1_set_compare(uint16_t count)
+{
+	timer1_compare = count;
+	timer1_compare_from = timer1_elapsed();
+	timer1_compare_irq = 1;
+}
+
+void hal_timer1_compare_irq_disable(void)
+{
+	timer1_compare_irq = 0;
+}
+
+void hal_timer2_start_4ms(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &timer2_epoch);
+	timer2_delivered = 0;
+	timer2_enabled = 1;
+	start();
+}
+
+void hal_timer2_stop(void)
+{
+	timer2_enabled = 0;
+}
+
+/*
+ * Push buttons
+ */
+
+void hal_buttons_irq_init(void)
+{
+	buttons_irq = 1;
+	start();
+}
+
+void hal_buttons_irq_disable(void)
+{
+	buttons_irq = 0;
+}
+
+void hal_buttons_irq_enable(void)
+{
+	buttons_irq = 1;
+	irq_pending = 1;
+}
+
+uint8_t hal_buttons_read(void)
+{
+	return buttons_state;
+}
+
+void hal_host_set_buttons(uint8_t state)
+{
+	buttons_state = state & 0x0F;
+	irq_pending = 1;
+	if (irq_enabled)
+	{
+		service();
+	}
+}
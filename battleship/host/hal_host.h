@@ -0,0 +1,121 @@
+/*
+ * hal_host.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Linux host backend for the hardware abstraction layer (see hal.h).
+ *
+ * Interrupts are emulated with a 1kHz SIGALRM. When the signal arrives
+ * with interrupts enabled, the handler runs the interrupt service routines
+ * that are due: the timer ticks, a pin change if the emulated buttons have
+ * changed, a receive complete per byte waiting on the UART input and data
+ * register empty until the driver turns it off. With interrupts disabled
+ * the work is left pending and done when they are re-enabled, just as the
+ * AVR would latch the interrupt flags.
+ *
+ * USART0 maps to stdin/stdout (in raw mode if stdin is a terminal), or to
+ * a pseudo terminal if the BATTLESHIP_PTY environment variable is set - the
+ * slave device name is printed on stderr so a terminal emulator or another
+ * program can be attached to it.
+ *
+ * USART1, the link to another board (see link.h), opens the device named
+ * by the BATTLESHIP_LINK environment variable - the link pty of another
+ * instance, or a real serial port - or else a new pseudo terminal whose
+ * slave is printed on stderr for the other end to open. Its input is paced
+ * at its own baud rate.
+ *
+ * The LED matrix is modelled by matrix_model.h. Set BATTLESHIP_MATRIX to
+ * "term" to see it drawn on stderr (redirect that to another terminal), or
+ * to a directory to get a PPM snapshot of each frame there.
+ */
+
+#ifndef HAL_HOST_H_
+#define HAL_HOST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* The firmware's system clock, used for baud rate and timer arithmetic */
+#define HAL_SYSCLK 8000000L
+
+/* Interrupt vectors are ordinary functions on the host. Vectors that the
+ * firmware does not define are weak and skipped by the dispatcher. */
+#define ISR(vector) void vector(void); void vector(void)
+
+void USART0_RX_vect(void);
+void USART0_UDRE_vect(void);
+void USART1_RX_vect(void);
+void USART1_UDRE_vect(void);
+void TIMER0_COMPA_vect(void);
+void TIMER1_COMPA_vect(void);
+void TIMER1_OVF_vect(void);
+void TIMER2_COMPA_vect(void);
+void PCINT1_vect(void);
+
+uint8_t hal_irq_save(void);
+void hal_irq_restore(uint8_t state);
+uint8_t hal_irq_enabled(void);
+void hal_irq_enable(void);
+void hal_irq_disable(void);
+void hal_cpu_relax(void);
+void hal_cpu_sleep(void);
+
+void hal_spi_init(uint8_t clockdivider);
+uint8_t hal_spi_transfer(uint8_t byte);
+void hal_spi_pause(uint16_t cycles);
+
+void hal_uart0_init(uint16_t ubrr);
+void hal_uart0_write(uint8_t c);
+uint8_t hal_uart0_read(void);
+uint8_t hal_uart0_overrun(void);
+void hal_uart0_tx_irq_enable(void);
+void hal_uart0_tx_irq_disable(void);
+void hal_uart1_init(uint16_t ubrr);
+void hal_uart1_set_baud(uint16_t ubrr);
+void hal_uart1_write(uint8_t c);
+uint8_t hal_uart1_tx_done(void);
+uint8_t hal_uart1_read(void);
+void hal_uart1_tx_irq_enable(void);
+void hal_uart1_tx_irq_disable(void);
+void hal_stdio_attach(int (*put)(char, FILE*), int (*get)(FILE*));
+
+void hal_timer0_start_1ms(void);
+void hal_timer0_start_cycles(void);
+uint8_t hal_timer0_count(void);
+void hal_timer1_start_cycles(void);
+uint16_t hal_timer1_count(void);
+void hal_timer1_start_ticks(void);
+uint8_t hal_timer1_overflowed(void);
+void hal_timer1_set_compare(uint16_t count);
+void hal_timer1_compare_irq_disable(void);
+void hal_timer2_start_4ms(void);
+void hal_timer2_stop(void);
+
+void hal_buttons_irq_init(void);
+void hal_buttons_irq_disable(void);
+void hal_buttons_irq_enable(void);
+uint8_t hal_buttons_read(void);
+
+/*
+ * Host only hooks, for tools that drive the firmware
+ */
+
+/* Set the state of the emulated buttons (bit n set if button n is down).
+ * A pin change interrupt is raised if the state changed. */
+void hal_host_set_buttons(uint8_t state);
+
+/* Install a model of the device on the other end of the SPI bus. It is
+ * given each byte the master sends and returns the byte shifted back. */
+typedef uint8_t (*HalSpiSlave)(uint8_t byte, void* context);
+void hal_host_set_spi_slave(HalSpiSlave slave, void* context);
+
+/* Return the SPI clock divider last set with hal_spi_init() */
+uint8_t hal_host_spi_divider(void);
+
+/* CPU cycles the SPI bus has been busy, transferring bytes at the divider
+ * set or paused with hal_spi_pause(), since the start. Nothing actually
+ * waits on the host, so this is when each byte would reach the slave if
+ * the master did nothing else between them. */
+uint32_t hal_host_spi_clock(void);
+
+#endif /* HAL_HOST_H_ */
@@ -0,0 +1,18 @@
+/*
+ * avr/interrupt.h (host)
+ *
+ * Author: Andrew Wilson
+ *
+ * Stand-in for the avr-libc header when building on the host. ISR() comes
+ * from the HAL; sei() and cli() set the emulated interrupt enable flag.
+ */
+
+#ifndef HOST_AVR_INTERRUPT_H_
+#define HOST_AVR_INTERRUPT_H_
+
+#include "hal.h"
+
+#define sei() hal_irq_enable()
+#define cli() hal_irq_disable()
+
+#endif /* HOST_AVR_INTERRUPT_H_ */
@@ -0,0 +1,17 @@
+/*
+ * avr/io.h (host)
+ *
+ * Author: Andrew Wilson
+ *
+ * Stand-in for the avr-libc header when building on the host. Nothing
+ * outside the HAL touches registers, so all this needs to provide is the
+ * HAL itself.
+ */
+
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+#include <stdint.h>
+#include "hal.h"
+
+#endif /* HOST_AVR_IO_H_ */
@@ -0,0 +1,44 @@
+/*
+ * avr/pgmspace.h (host)
+ *
+ * Author: Andrew Wilson
+ *
+ * Stand-in for the avr-libc header when building on the host, where there
+ * is only one address space. The _P functions are the ordinary ones,
+ * except that the printf family understands avr-libc's %S (a string in
+ * program memory) - see pgmspace_host.c.
+ */
+
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define pgm_read_dword(address) (*(const uint32_t*)(address))
+#define pgm_read_ptr(address) (*(void* const*)(address))
+
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define fputs_P fputs
+#define puts_P puts
+
+int printf_P(const char* format, ...);
+int fprintf_P(FILE* stream, const char* format, ...);
+int sprintf_P(char* buffer, const char* format, ...);
+int snprintf_P(char* buffer, size_t size, const char* format, ...);
+int vfprintf_P(FILE* stream, const char* format, va_list args);
+int vsnprintf_P(char* buffer, size_t size, const char* format, va_list args);
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
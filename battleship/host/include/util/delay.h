@@ -0,0 +1,26 @@
+/*
+ * util/delay.h (host)
+ *
+ * Author: Andrew Wilson
+ *
+ * Stand-in for the avr-libc busy-wait delays when building on the host.
+ */
+
+#ifndef HOST_UTIL_DELAY_H_
+#define HOST_UTIL_DELAY_H_
+
+#include <time.h>
+
+static inline void _delay_us(double us)
+{
+	long long ns = (long long)(us * 1000);
+	struct timespec delay = { ns / 1000000000, ns % 1000000000 };
+	nanosleep(&delay, NULL);
+}
+
+static inline void _delay_ms(double ms)
+{
+	_delay_us(ms * 1000);
+}
+
+#endif /* HOST_UTIL_DELAY_H_ */
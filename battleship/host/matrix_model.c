@@ -0,0 +1,331 @@
+/*
+ * matrix_model.c
+ *
+ * Author: Andrew Wilson
+ *
+ * LED matrix SPI slave model - see matrix_model.h.
+ */
+
+#include "matrix_model.h"
+
+#include <string.h>
+
+#include "hal.h"
+
+#define NO_COMMAND 0xFF
+
+/* CPU cycles (of the game's 8MHz clock) the board takes to handle any
+ * byte, and the last byte of each command more to carry the command out.
+ * ledmatrix.c paces fast clocks by the same estimates. */
+#define BOARD_BYTE_CYCLES 96
+static const uint16_t command_cycles[MATRIX_NUM_COMMANDS] = {
+	[MATRIX_CMD_UPDATE_ALL] = 1024,
+	[MATRIX_CMD_UPDATE_PIXEL] = 32,
+	[MATRIX_CMD_UPDATE_ROW] = 160,
+	[MATRIX_CMD_UPDATE_COL] = 96,
+	[MATRIX_CMD_SHIFT_DISPLAY] = 1536,
+	[MATRIX_CMD_CLEAR_SCREEN] = 512,
+};
+
+/* Shift directions for CMD_SHIFT_DISPLAY (bits may be combined) */
+#define SHIFT_RIGHT 0x01
+#define SHIFT_LEFT 0x02
+#define SHIFT_DOWN 0x04
+#define SHIFT_UP 0x08
+
+void matrix_model_init(MatrixModel* model)
+{
+	memset(model, 0, sizeof(*model));
+	model->command = NO_COMMAND;
+	model->busy_until = model->taken_at = hal_host_spi_clock();
+}
+
+/* Number of bytes following each command byte */
+static uint8_t argument_bytes(uint8_t command)
+{
+	switch (command)
+	{
+		case MATRIX_CMD_UPDATE_ALL:
+			return MATRIX_NUM_COLUMNS * MATRIX_NUM_ROWS;
+		case MATRIX_CMD_UPDATE_PIXEL:
+			return 2;
+		case MATRIX_CMD_UPDATE_ROW:
+			return 1 + MATRIX_NUM_COLUMNS;
+		case MATRIX_CMD_UPDATE_COL:
+			return 1 + MATRIX_NUM_ROWS;
+		case MATRIX_CMD_SHIFT_DISPLAY:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static void shift(MatrixModel* model, uint8_t direction)
+{
+	MatrixData shifted;
+	memset(shifted, COLOUR_BLACK, sizeof(shifted));
+	int dx = ((direction & SHIFT_RIGHT) != 0) - ((direction & SHIFT_LEFT) != 0);
+	int dy = ((direction & SHIFT_UP) != 0) - ((direction & SHIFT_DOWN) != 0);
+	for (int x = 0; x < MATRIX_NUM_COLUMNS; x++)
+	{
+		for (int y = 0; y < MATRIX_NUM_ROWS; y++)
+		{
+			int to_x = x + dx, to_y = y + dy;
+			if (to_x >= 0 && to_x < MATRIX_NUM_COLUMNS && to_y >= 0
+					&& to_y < MATRIX_NUM_ROWS)
+			{
+				shifted[to_x][to_y] = model->pixels[x][y];
+			}
+		}
+	}
+	memcpy(model->pixels, shifted, sizeof(shifted));
+}
+
+/* Handle byte number index (from 0) following the command byte */
+static void argument(MatrixModel* model, uint8_t index, uint8_t byte)
+{
+	switch (model->command)
+	{
+		case MATRIX_CMD_UPDATE_ALL:
+			/* Row by row from y = 0, left to right within a row */
+			model->pixels[index % MATRIX_NUM_COLUMNS]
+					[index / MATRIX_NUM_COLUMNS] = byte;
+			break;
+		case MATRIX_CMD_UPDATE_PIXEL:
+			if (index == 0)
+			{
+				model->argument = byte;
+			} else
+			{
+				model->pixels[model->argument & 0x0F]
+						[(model->argument >> 4) & 0x07] = byte;
+			}
+			break;
+		case MATRIX_CMD_UPDATE_ROW:
+			if (index == 0)
+			{
+				model->argument = byte & 0x07;
+			} else
+			{
+				model->pixels[index - 1][model->argument] = byte;
+			}
+			break;
+		case MATRIX_CMD_UPDATE_COL:
+			if (index == 0)
+			{
+				model->argument = byte & 0x0F;
+			} else
+			{
+				model->pixels[model->argument][index - 1] = byte;
+			}
+			break;
+		case MATRIX_CMD_SHIFT_DISPLAY:
+			shift(model, byte);
+			break;
+	}
+}
+
+/* Decode one byte. Returns the cycles the board takes over it. */
+static uint16_t decode(MatrixModel* model, uint8_t byte)
+{
+	if (model->command == NO_COMMAND)
+	{
+		model->frame.commands++;
+		if (byte >= MATRIX_NUM_COMMANDS || (byte > MATRIX_CMD_SHIFT_DISPLAY
+				&& byte != MATRIX_CMD_CLEAR_SCREEN))
+		{
+			model->frame.bad_commands++;
+			return BOARD_BYTE_CYCLES;
+		}
+		model->frame.by_command[byte]++;
+		if (byte == MATRIX_CMD_CLEAR_SCREEN)
+		{
+			memset(model->pixels, COLOUR_BLACK, sizeof(model->pixels));
+			return BOARD_BYTE_CYCLES + command_cycles[byte];
+		}
+		model->command = byte;
+		model->received = 0;
+		return BOARD_BYTE_CYCLES;
+	}
+	
+	argument(model, model->received++, byte);
+	if (model->received == argument_bytes(model->command))
+	{
+		uint8_t command = model->command;
+		model->command = NO_COMMAND;
+		return BOARD_BYTE_CYCLES + command_cycles[command];
+	}
+	return BOARD_BYTE_CYCLES;
+}
+
+uint8_t matrix_model_spi(uint8_t byte, void* context)
+{
+	MatrixModel* model = context;
+	model->frame.bytes++;
+	
+	/* The board takes the byte from its data register once it has
+	 * finished with the one before. If the one before is still waiting
+	 * there, one of them is lost (which is as bad either way). */
+	uint32_t now = hal_host_spi_clock();
+	if ((int32_t)(now - model->taken_at) < 0)
+	{
+		model->frame.overruns++;
+		return 0;
+	}
+	uint32_t start = (int32_t)(now - model->busy_until) < 0
+			? model->busy_until : now;
+	model->taken_at = start;
+	model->busy_until = start + decode(model, byte);
+	return 0;
+}
+
+uint32_t matrix_model_changed_pixels(const MatrixModel* model)
+{
+	uint32_t changed = 0;
+	for (int x = 0; x < MATRIX_NUM_COLUMNS; x++)
+	{
+		for (int y = 0; y < MATRIX_NUM_ROWS; y++)
+		{
+			changed += model->pixels[x][y] != model->frame_start[x][y];
+		}
+	}
+	return changed;
+}
+
+/* Bytes of row, column and pixel updates needed to turn from into to:
+ * the best mix of row and pixel updates or of column and pixel updates,
+ * or a CMD_UPDATE_ALL if that is cheaper */
+static uint32_t update_cost(MatrixData from, MatrixData to)
+{
+	uint32_t changed_in_row[MATRIX_NUM_ROWS] = { 0 };
+	uint32_t changed_in_column[MATRIX_NUM_COLUMNS] = { 0 };
+	for (int x = 0; x < MATRIX_NUM_COLUMNS; x++)
+	{
+		for (int y = 0; y < MATRIX_NUM_ROWS; y++)
+		{
+			if (from[x][y] != to[x][y])
+			{
+				changed_in_row[y]++;
+				changed_in_column[x]++;
+			}
+		}
+	}
+	
+	/* A pixel update is 3 bytes, a row 2 + 16 and a column 2 + 8 */
+	uint32_t by_rows = 0, by_columns = 0;
+	for (int y = 0; y < MATRIX_NUM_ROWS; y++)
+	{
+		uint32_t pixels = 3 * changed_in_row[y];
+		by_rows += pixels < 2 + MATRIX_NUM_COLUMNS ? pixels
+				: 2 + MATRIX_NUM_COLUMNS;
+	}
+	for (int x = 0; x < MATRIX_NUM_COLUMNS; x++)
+	{
+		uint32_t pixels = 3 * changed_in_column[x];
+		by_columns += pixels < 2 + MATRIX_NUM_ROWS ? pixels
+				: 2 + MATRIX_NUM_ROWS;
+	}
+	
+	uint32_t best = 1 + MATRIX_NUM_COLUMNS * MATRIX_NUM_ROWS;
+	if (by_rows < best)
+	{
+		best = by_rows;
+	}
+	if (by_columns < best)
+	{
+		best = by_columns;
+	}
+	return best;
+}
+
+uint32_t matrix_model_batched_bytes(const MatrixModel* model)
+{
+	MatrixData from, to;
+	memcpy(from, model->frame_start, sizeof(from));
+	memcpy(to, model->pixels, sizeof(to));
+	uint32_t best = update_cost(from, to);
+	
+	/* Starting with a clear screen or a shift may be cheaper */
+	MatrixModel start;
+	matrix_model_init(&start);
+	uint32_t cost = 1 + update_cost(start.pixels, to);
+	if (cost < best)
+	{
+		best = cost;
+	}
+	static const uint8_t directions[] = {
+		SHIFT_RIGHT, SHIFT_LEFT, SHIFT_DOWN, SHIFT_UP
+	};
+	for (uint8_t i = 0; i < sizeof(directions); i++)
+	{
+		memcpy(start.pixels, from, sizeof(from));
+		shift(&start, directions[i]);
+		cost = 2 + update_cost(start.pixels, to);
+		if (cost < best)
+		{
+			best = cost;
+		}
+	}
+	return best;
+}
+
+void matrix_model_end_frame(MatrixModel* model)
+{
+	MatrixTraffic* total = &model->total;
+	total->bytes += model->frame.bytes;
+	total->commands += model->frame.commands;
+	total->bad_commands += model->frame.bad_commands;
+	total->overruns += model->frame.overruns;
+	for (int i = 0; i < MATRIX_NUM_COMMANDS; i++)
+	{
+		total->by_command[i] += model->frame.by_command[i];
+	}
+	memset(&model->frame, 0, sizeof(model->frame));
+	memcpy(model->frame_start, model->pixels, sizeof(model->pixels));
+	model->frames++;
+}
+
+/* Each pixel has 4 bits of green in the high nibble, red in the low */
+static void pixel_rgb(PixelColour pixel, uint8_t rgb[3])
+{
+	rgb[0] = (pixel & 0x0F) * 17;
+	rgb[1] = (pixel >> 4) * 17;
+	rgb[2] = 0;
+}
+
+void matrix_model_render(const MatrixModel* model, FILE* out)
+{
+	/* Row 7 is at the top of the board */
+	for (int y = MATRIX_NUM_ROWS - 1; y >= 0; y--)
+	{
+		for (int x = 0; x < MATRIX_NUM_COLUMNS; x++)
+		{
+			uint8_t rgb[3];
+			pixel_rgb(model->pixels[x][y], rgb);
+			fprintf(out, "\x1b[48;2;%d;%d;%dm  ", rgb[0], rgb[1], rgb[2]);
+		}
+		fprintf(out, "\x1b[0m\n");
+	}
+}
+
+int matrix_model_write_ppm(const MatrixModel* model, const char* path,
+		int scale)
+{
+	FILE* out = fopen(path, "wb");
+	if (!out)
+	{
+		return -1;
+	}
+	fprintf(out, "P6\n%d %d\n255\n", MATRIX_NUM_COLUMNS * scale,
+			MATRIX_NUM_ROWS * scale);
+	for (int y = MATRIX_NUM_ROWS * scale - 1; y >= 0; y--)
+	{
+		for (int x = 0; x < MATRIX_NUM_COLUMNS * scale; x++)
+		{
+			uint8_t rgb[3];
+			pixel_rgb(model->pixels[x / scale][y / scale], rgb);
+			fwrite(rgb, 1, 3, out);
+		}
+	}
+	return fclose(out) == 0 ? 0 : -1;
+}
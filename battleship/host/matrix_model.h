@@ -0,0 +1,95 @@
+/*
+ * matrix_model.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Model of the LED matrix board's SPI slave for the host build. It decodes
+ * the command stream exactly as ledmatrix.c emits it (see the LED matrix
+ * Reference), keeps the resulting 16x8 framebuffer and counts the traffic.
+ *
+ * It also models how long the board takes over each byte, against when
+ * the byte arrives on the host's SPI clock (hal_host_spi_clock()). The
+ * board handles bytes one at a time and can hold one more waiting in its
+ * SPI data register; a byte arriving while one is already waiting is lost
+ * and counted as an overrun.
+ *
+ * Install it on the host SPI bus with
+ *     hal_host_set_spi_slave(matrix_model_spi, &model);
+ * or, for battleship_host, set BATTLESHIP_MATRIX to "term" to draw the
+ * matrix on stderr or to a directory name to write a PPM snapshot per
+ * frame there.
+ */
+
+#ifndef MATRIX_MODEL_H_
+#define MATRIX_MODEL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ledmatrix.h"
+
+/* Commands, as sent by ledmatrix.c */
+#define MATRIX_CMD_UPDATE_ALL 0x00
+#define MATRIX_CMD_UPDATE_PIXEL 0x01
+#define MATRIX_CMD_UPDATE_ROW 0x02
+#define MATRIX_CMD_UPDATE_COL 0x03
+#define MATRIX_CMD_SHIFT_DISPLAY 0x04
+#define MATRIX_CMD_CLEAR_SCREEN 0x0F
+#define MATRIX_NUM_COMMANDS 16
+
+/* Traffic since the start of the current frame */
+typedef struct {
+	uint32_t bytes;
+	uint32_t commands;
+	uint32_t by_command[MATRIX_NUM_COMMANDS];
+	uint32_t bad_commands;
+	uint32_t overruns;
+} MatrixTraffic;
+
+typedef struct {
+	/* What the LEDs show, indexed [x][y] like MatrixData */
+	MatrixData pixels;
+	/* The framebuffer at the start of the current frame */
+	MatrixData frame_start;
+	/* Command being decoded and the bytes of it received so far */
+	uint8_t command;
+	uint8_t received;
+	uint8_t argument;
+	/* When the board will have finished with the bytes it has, and when
+	 * it took (or will take) the last one from its data register */
+	uint32_t busy_until;
+	uint32_t taken_at;
+	MatrixTraffic frame;
+	MatrixTraffic total;
+	uint32_t frames;
+} MatrixModel;
+
+/* Blank display, no traffic */
+void matrix_model_init(MatrixModel* model);
+
+/* Feed one byte from the SPI master. Matches HalSpiSlave so it can be
+ * installed with hal_host_set_spi_slave(); context is the model. */
+uint8_t matrix_model_spi(uint8_t byte, void* context);
+
+/* Bytes a batched update would need to take the display from the start
+ * of the frame to what it shows now. Considers one CMD_UPDATE_ALL, the
+ * best mix of row and pixel updates or of column and pixel updates, and
+ * either of those after a clear screen or a shift. */
+uint32_t matrix_model_batched_bytes(const MatrixModel* model);
+
+/* Number of pixels that differ from the start of the frame */
+uint32_t matrix_model_changed_pixels(const MatrixModel* model);
+
+/* Finish the current frame - add its traffic to the totals and start a
+ * new one from the current display */
+void matrix_model_end_frame(MatrixModel* model);
+
+/* Draw the display as coloured blocks with ANSI escape sequences */
+void matrix_model_render(const MatrixModel* model, FILE* out);
+
+/* Write the display as a binary PPM, each LED scale x scale pixels.
+ * Returns 0 on success. */
+int matrix_model_write_ppm(const MatrixModel* model, const char* path,
+		int scale);
+
+#endif /* MATRIX_MODEL_H_ */
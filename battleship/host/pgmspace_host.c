@@ -0,0 +1,97 @@
+/*
+ * pgmspace_host.c
+ *
+ * Author: Andrew Wilson
+ *
+ * printf family for program memory format strings on the host. The only
+ * difference from the standard functions is that avr-libc's %S (a string
+ * in program memory) is rewritten to %s before formatting.
+ */
+
+#include <avr/pgmspace.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Copy format into buffer with every %S conversion changed to %s */
+static const char* translate(const char* format, char* buffer, size_t size)
+{
+	if (strstr(format, "S") == NULL || strlen(format) >= size)
+	{
+		return format;
+	}
+	size_t i = 0;
+	for (const char* p = format; *p; p++)
+	{
+		buffer[i++] = *p;
+		if (*p != '%')
+		{
+			continue;
+		}
+		/* Copy flags, width and precision up to the conversion */
+		while (p[1] && strchr("-+ #0123456789.*", p[1]))
+		{
+			buffer[i++] = *++p;
+		}
+		if (p[1] == 'S')
+		{
+			buffer[i++] = 's';
+			p++;
+		} else if (p[1])
+		{
+			buffer[i++] = *++p;
+		}
+	}
+	buffer[i] = '\0';
+	return buffer;
+}
+
+int vfprintf_P(FILE* stream, const char* format, va_list args)
+{
+	char buffer[256];
+	return vfprintf(stream, translate(format, buffer, sizeof(buffer)), args);
+}
+
+int vsnprintf_P(char* buffer, size_t size, const char* format, va_list args)
+{
+	char translated[256];
+	return vsnprintf(buffer, size,
+			translate(format, translated, sizeof(translated)), args);
+}
+
+int printf_P(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int n = vfprintf_P(stdout, format, args);
+	va_end(args);
+	return n;
+}
+
+int fprintf_P(FILE* stream, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int n = vfprintf_P(stream, format, args);
+	va_end(args);
+	return n;
+}
+
+int sprintf_P(char* buffer, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf_P(buffer, (size_t)-1 >> 1, format, args);
+	va_end(args);
+	return n;
+}
+
+int snprintf_P(char* buffer, size_t size, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf_P(buffer, size, format, args);
+	va_end(args);
+	return n;
+}
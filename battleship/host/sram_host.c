@@ -0,0 +1,27 @@
+/*
+ * sram_host.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Host replacement for sram.c. Stack painting only means something on the
+ * device, so the measurements are all zero here.
+ */
+
+#include "sram.h"
+
+#include <avr/pgmspace.h>
+#include <stdio.h>
+
+uint16_t sram_data_size(void) { return 0; }
+
+uint16_t sram_bss_size(void) { return 0; }
+
+uint16_t sram_free_now(void) { return 0; }
+
+uint16_t sram_stack_peak(void) { return 0; }
+
+uint16_t sram_never_used(void) { return 0; }
+
+void sram_report(void) {
+  printf_P(PSTR("SRAM: not measured in the host build"));
+}
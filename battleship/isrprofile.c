@@ -0,0 +1,61 @@
+/*
+ * isrprofile.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Interrupt handler cycle counts - see isrprofile.h.
+ */
+
+#include "isrprofile.h"
+
+#ifdef ISR_PROFILE
+
+#include <avr/pgmspace.h>
+#include <stdio.h>
+
+static volatile uint16_t worst_cycles[NUM_PROFILED_ISRS];
+static volatile uint16_t calls[NUM_PROFILED_ISRS];
+
+static const char isr_name_timer0[] PROGMEM = "TIMER0_COMPA";
+static const char isr_name_timer2[] PROGMEM = "TIMER2_COMPA";
+static const char isr_name_rx[] PROGMEM = "USART0_RX";
+static const char isr_name_udre[] PROGMEM = "USART0_UDRE";
+static const char isr_name_link_rx[] PROGMEM = "USART1_RX";
+static const char isr_name_link_udre[] PROGMEM = "USART1_UDRE";
+static const char isr_name_timer1_ovf[] PROGMEM = "TIMER1_OVF";
+static const char isr_name_timer1_compa[] PROGMEM = "TIMER1_COMPA";
+static const char isr_name_pcint1[] PROGMEM = "PCINT1";
+static const char* const isr_names[NUM_PROFILED_ISRS] PROGMEM = {
+	isr_name_timer0, isr_name_timer2, isr_name_rx, isr_name_udre,
+	isr_name_link_rx, isr_name_link_udre, isr_name_timer1_ovf,
+	isr_name_timer1_compa, isr_name_pcint1
+};
+
+void isr_profile_record(uint8_t isr, uint16_t cycles)
+{
+	if (cycles > worst_cycles[isr])
+	{
+		worst_cycles[isr] = cycles;
+	}
+	if (calls[isr] < UINT16_MAX)
+	{
+		calls[isr]++;
+	}
+}
+
+void isr_profile_report(void)
+{
+	for (uint8_t isr = 0; isr < NUM_PROFILED_ISRS; isr++)
+	{
+		/* Copy with interrupts off, the handlers update these */
+		uint8_t interrupts_were_enabled = hal_irq_save();
+		uint16_t worst = worst_cycles[isr];
+		uint16_t count = calls[isr];
+		hal_irq_restore(interrupts_were_enabled);
+		
+		printf_P(PSTR("%S: worst %u cycles, %u calls\n"),
+				(const char*)pgm_read_ptr(&isr_names[isr]), worst, count);
+	}
+}
+
+#endif /* ISR_PROFILE */
@@ -0,0 +1,89 @@
+/*
+ * isrprofile.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Measures how many cycles each interrupt handler takes, using timer 1
+ * (which counts CPU cycles, see timer1.c). In the tickless mode timer 1
+ * keeps the time, so timer 0 counts instead, in units of 64 cycles, and
+ * the counts are to within 64 cycles. Build with ISR_PROFILE defined to
+ * turn it on; otherwise the macros are empty and cost nothing. The 'm'
+ * key prints the worst case and the number of calls for each handler.
+ *
+ * The count runs from the first statement of the handler to the last, so
+ * it leaves out the register saves and restores the compiler adds around
+ * it (up to about 40 cycles for a handler that calls other functions) and
+ * the 4 cycles to respond to the interrupt.
+ *
+ * Worst case budgets, in cycles at 8MHz, for the handler bodies (see
+ * the comment on each handler). They are estimates from reading the
+ * code, not measurements: check them against the 'm' report of a profiled
+ * build on the board.
+ *   TIMER0_COMPA   80   clock tick and an empty timer wheel bucket,
+ *                        plus 40 for each timer in the bucket
+ *   TIMER2_COMPA  150   button sample, debounce and repeat
+ *   USART0_RX     200   capture a character (echo is a bottom half)
+ *   USART0_UDRE    70   send a character
+ *   USART1_RX      80   capture a link byte (decoding is a bottom half)
+ *   USART1_UDRE    70   send a link or telemetry byte
+ * and only in the tickless mode, where timer 0 has no interrupt:
+ *   TIMER1_OVF     20   extend the time to 32 bits
+ *   TIMER1_COMPA 2500   work out the time, turn the timer wheel to it
+ *                        and set the next deadline
+ *   PCINT1         40   start sampling the buttons
+ * With the tick, all of them together are 650 cycles (950 with every
+ * software timer in one bucket), well under the 8000 cycles between
+ * timer 0 ticks, so a burst of serial input can't make the tick late.
+ * Tickless, TIMER1_COMPA alone is longer, but it runs at most once a
+ * millisecond and is still shorter than the 4160 cycles between two
+ * characters at 19200 baud, which the USART buffers.
+ */
+
+#ifndef ISRPROFILE_H_
+#define ISRPROFILE_H_
+
+#include <stdint.h>
+
+#define ISR_TIMER0_COMPA 0
+#define ISR_TIMER2_COMPA 1
+#define ISR_USART0_RX 2
+#define ISR_USART0_UDRE 3
+#define ISR_USART1_RX 4
+#define ISR_USART1_UDRE 5
+#define ISR_TIMER1_OVF 6
+#define ISR_TIMER1_COMPA 7
+#define ISR_PCINT1 8
+#define NUM_PROFILED_ISRS 9
+
+#ifdef ISR_PROFILE
+
+#include "hal.h"
+
+/* Put ISR_PROFILE_BEGIN() first in the handler body and
+ * ISR_PROFILE_END(isr) last (before any return) */
+#ifdef TICKLESS
+#define ISR_PROFILE_BEGIN() uint8_t isr_profile_start = hal_timer0_count()
+#define ISR_PROFILE_END(isr) \
+	isr_profile_record((isr), \
+			(uint8_t)(hal_timer0_count() - isr_profile_start) * 64U)
+#else
+#define ISR_PROFILE_BEGIN() uint16_t isr_profile_start = hal_timer1_count()
+#define ISR_PROFILE_END(isr) \
+	isr_profile_record((isr), hal_timer1_count() - isr_profile_start)
+#endif
+
+/* Add a measurement. Called from the interrupt handler. */
+void isr_profile_record(uint8_t isr, uint16_t cycles);
+
+/* Print the worst case and the number of calls for each handler */
+void isr_profile_report(void);
+
+#else
+
+#define ISR_PROFILE_BEGIN()
+#define ISR_PROFILE_END(isr)
+#define isr_profile_report()
+
+#endif /* ISR_PROFILE */
+
+#endif /* ISRPROFILE_H_ */
@@ -0,0 +1,98 @@
+/*
+ * keymap.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Keymap tables - see keymap.h.
+ */
+
+#include "keymap.h"
+
+#include <avr/pgmspace.h>
+
+#include "buttons.h"
+
+// Any button or 's' starts a game, the number keys choose the fleet and
+// 'g' the game mode
+const KeyBinding start_keymap[] PROGMEM = {
+	{ EVENT_BUTTON, BUTTON0_PUSHED, ACTION_START },
+	{ EVENT_BUTTON, BUTTON1_PUSHED, ACTION_START },
+	{ EVENT_BUTTON, BUTTON2_PUSHED, ACTION_START },
+	{ EVENT_BUTTON, BUTTON3_PUSHED, ACTION_START },
+	{ EVENT_SERIAL, 's', ACTION_START },
+	{ EVENT_SERIAL, 'S', ACTION_START },
+	{ EVENT_SERIAL, '1', ACTION_SELECT_FLEET },
+	{ EVENT_SERIAL, '2', ACTION_SELECT_FLEET },
+	{ EVENT_SERIAL, '3', ACTION_SELECT_FLEET },
+	{ EVENT_SERIAL, '4', ACTION_SELECT_FLEET },
+	{ EVENT_SERIAL, 'g', ACTION_SELECT_MODE },
+	{ EVENT_SERIAL, 'G', ACTION_SELECT_MODE },
+	{ 0, 0, ACTION_NONE }
+};
+
+// Ships are moved as the cursor is in a game, turned with r and put down
+// with f. x places the rest of the fleet at random and l keeps the layout.
+const KeyBinding placement_keymap[] PROGMEM = {
+	{ EVENT_BUTTON, BUTTON0_PUSHED, ACTION_MOVE_RIGHT },
+	{ EVENT_BUTTON, BUTTON1_PUSHED, ACTION_MOVE_DOWN },
+	{ EVENT_BUTTON, BUTTON2_PUSHED, ACTION_MOVE_UP },
+	{ EVENT_BUTTON, BUTTON3_PUSHED, ACTION_MOVE_LEFT },
+	{ EVENT_SERIAL, 'd', ACTION_MOVE_RIGHT },
+	{ EVENT_SERIAL, 'D', ACTION_MOVE_RIGHT },
+	{ EVENT_SERIAL, 's', ACTION_MOVE_DOWN },
+	{ EVENT_SERIAL, 'S', ACTION_MOVE_DOWN },
+	{ EVENT_SERIAL, 'w', ACTION_MOVE_UP },
+	{ EVENT_SERIAL, 'W', ACTION_MOVE_UP },
+	{ EVENT_SERIAL, 'a', ACTION_MOVE_LEFT },
+	{ EVENT_SERIAL, 'A', ACTION_MOVE_LEFT },
+	{ EVENT_SERIAL, 'r', ACTION_ROTATE },
+	{ EVENT_SERIAL, 'R', ACTION_ROTATE },
+	{ EVENT_SERIAL, 'f', ACTION_FIRE },
+	{ EVENT_SERIAL, 'F', ACTION_FIRE },
+	{ EVENT_SERIAL, 'x', ACTION_RANDOM_FLEET },
+	{ EVENT_SERIAL, 'X', ACTION_RANDOM_FLEET },
+	{ EVENT_SERIAL, 'l', ACTION_KEEP_LAYOUT },
+	{ EVENT_SERIAL, 'L', ACTION_KEEP_LAYOUT },
+	{ 0, 0, ACTION_NONE }
+};
+
+// Buttons B0 to B3 move right, down, up and left, as do d, s, w and a. m
+// and h print the reports.
+const KeyBinding game_keymap[] PROGMEM = {
+	{ EVENT_BUTTON, BUTTON0_PUSHED, ACTION_MOVE_RIGHT },
+	{ EVENT_BUTTON, BUTTON1_PUSHED, ACTION_MOVE_DOWN },
+	{ EVENT_BUTTON, BUTTON2_PUSHED, ACTION_MOVE_UP },
+	{ EVENT_BUTTON, BUTTON3_PUSHED, ACTION_MOVE_LEFT },
+	{ EVENT_SERIAL, 'd', ACTION_MOVE_RIGHT },
+	{ EVENT_SERIAL, 'D', ACTION_MOVE_RIGHT },
+	{ EVENT_SERIAL, 's', ACTION_MOVE_DOWN },
+	{ EVENT_SERIAL, 'S', ACTION_MOVE_DOWN },
+	{ EVENT_SERIAL, 'w', ACTION_MOVE_UP },
+	{ EVENT_SERIAL, 'W', ACTION_MOVE_UP },
+	{ EVENT_SERIAL, 'a', ACTION_MOVE_LEFT },
+	{ EVENT_SERIAL, 'A', ACTION_MOVE_LEFT },
+	{ EVENT_SERIAL, 'f', ACTION_FIRE },
+	{ EVENT_SERIAL, 'F', ACTION_FIRE },
+	{ EVENT_SERIAL, 'm', ACTION_SRAM_REPORT },
+	{ EVENT_SERIAL, 'M', ACTION_SRAM_REPORT },
+	{ EVENT_SERIAL, 'h', ACTION_HEALTH_REPORT },
+	{ EVENT_SERIAL, 'H', ACTION_HEALTH_REPORT },
+	{ 0, 0, ACTION_NONE }
+};
+
+uint8_t event_action(const Event* event, const KeyBinding* keymap)
+{
+	for (const KeyBinding* binding = keymap; ; binding++)
+	{
+		uint8_t action = pgm_read_byte(&binding->action);
+		if (action == ACTION_NONE)
+		{
+			return ACTION_NONE;
+		}
+		if (pgm_read_byte(&binding->source) == event->source
+				&& pgm_read_byte(&binding->key) == event->key)
+		{
+			return action;
+		}
+	}
+}
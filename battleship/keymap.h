@@ -0,0 +1,49 @@
+/*
+ * keymap.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Keymaps turn input events (see events.h) into game actions. Each keymap
+ * is a table in program memory; start_keymap is used on the start and game
+ * over screens, placement_keymap while the human places their fleet and
+ * game_keymap while a game is being played.
+ */
+
+#ifndef KEYMAP_H_
+#define KEYMAP_H_
+
+#include <stdint.h>
+
+#include "events.h"
+
+/* Game actions */
+#define ACTION_NONE 0
+#define ACTION_MOVE_RIGHT 1
+#define ACTION_MOVE_LEFT 2
+#define ACTION_MOVE_UP 3
+#define ACTION_MOVE_DOWN 4
+#define ACTION_FIRE 5
+#define ACTION_START 6
+#define ACTION_SELECT_FLEET 7	/* the event key is '1' + layout */
+#define ACTION_SRAM_REPORT 8
+#define ACTION_SELECT_MODE 9
+#define ACTION_ROTATE 10
+#define ACTION_RANDOM_FLEET 11
+#define ACTION_KEEP_LAYOUT 12
+#define ACTION_HEALTH_REPORT 13
+
+typedef struct {
+	uint8_t source;
+	uint8_t key;
+	uint8_t action;
+} KeyBinding;
+
+/* Tables end with a binding whose action is ACTION_NONE */
+extern const KeyBinding start_keymap[];
+extern const KeyBinding placement_keymap[];
+extern const KeyBinding game_keymap[];
+
+/* Look the event up in keymap, returning ACTION_NONE if it isn't bound */
+uint8_t event_action(const Event* event, const KeyBinding* keymap);
+
+#endif /* KEYMAP_H_ */
@@ -9,6 +9,7 @@
 #include "ledmatrix.h"
 #include <stdint.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include "spi.h"
 
 #define CMD_UPDATE_ALL		(0x00)
@@ -18,22 +19,87 @@
 #define CMD_SHIFT_DISPLAY	(0x04)
 #define CMD_CLEAR_SCREEN	(0x0F)
 
+// What the matrix board takes to handle what we send, in our CPU cycles:
+// every byte takes BOARD_BYTE_CYCLES, and the last byte of a command
+// as many more as command_cycles[] gives to carry the command out. These
+// are estimates (the board's firmware isn't ours and they haven't been
+// measured on it) kept the same as the board model in
+// host/matrix_model.c, which matrix_timing checks the pacing against.
+// That check can only show the pacing matches the estimates, so the
+// pacing allows half as long again as they give (BOARD_MARGIN) in case
+// they are short.
+#define BOARD_BYTE_CYCLES	96
+#define BOARD_MARGIN(cycles)	((cycles) + (cycles) / 2)
+static const uint16_t command_cycles[CMD_CLEAR_SCREEN + 1] PROGMEM = {
+	[CMD_UPDATE_ALL] = 1024,	// copy the frame to the display
+	[CMD_UPDATE_PIXEL] = 32,
+	[CMD_UPDATE_ROW] = 160,
+	[CMD_UPDATE_COL] = 96,
+	[CMD_SHIFT_DISPLAY] = 1536,	// move every pixel
+	[CMD_CLEAR_SCREEN] = 512,
+};
+
+// CPU cycles a byte takes on the bus at the divider set up
+static uint16_t cycles_per_byte;
+
 void ledmatrix_setup(void)
 {
-	// Setup SPI - we divide the clock by 128.
-	// (This speed guarantees the SPI buffer will never overflow on
-	// the LED matrix.)
-	spi_setup_master(128);
+	ledmatrix_setup_divider(LEDMATRIX_SPI_DIVIDER);
+}
+
+void ledmatrix_setup_divider(uint8_t clockdivider)
+{
+	// The HAL takes anything it doesn't know as 128, the pacing must too
+	if (clockdivider < 2 || (clockdivider & (clockdivider - 1)) != 0)
+	{
+		clockdivider = 128;
+	}
+	spi_setup_master(clockdivider);
+	cycles_per_byte = 8 * (uint16_t)clockdivider;
+}
+
+// Send a byte then, if the board takes longer than the bus to handle it
+// (with the margin), wait until it will have. That way the board has
+// always finished with a byte before the next arrives. (It can hold one
+// more byte, which is why 128 was safe unpaced. The pacing doesn't count
+// on that, so it still waits after full updates and shifts at 128.)
+static void send_paced(uint8_t byte, uint16_t cycles)
+{
+	(void)spi_send_byte(byte);
+	cycles = BOARD_MARGIN(cycles);
+	if (cycles > cycles_per_byte)
+	{
+		spi_pause(cycles - cycles_per_byte);
+	}
+}
+
+// Any byte of a command but the last
+static void send_byte(uint8_t byte)
+{
+	send_paced(byte, BOARD_BYTE_CYCLES);
+}
+
+// The last byte of the given command
+static void send_last_byte(uint8_t command, uint8_t byte)
+{
+	send_paced(byte, BOARD_BYTE_CYCLES
+			+ pgm_read_word(&command_cycles[command]));
 }
 
 void ledmatrix_update_all(MatrixData data)
 {
-	(void)spi_send_byte(CMD_UPDATE_ALL);
+	send_byte(CMD_UPDATE_ALL);
 	for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++)
 	{
 		for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++)
 		{
-			(void)spi_send_byte(data[x][y]);
+			if (y == MATRIX_NUM_ROWS - 1 && x == MATRIX_NUM_COLUMNS - 1)
+			{
+				send_last_byte(CMD_UPDATE_ALL, data[x][y]);
+			} else
+			{
+				send_byte(data[x][y]);
+			}
 		}
 	}
 }
@@ -45,9 +111,9 @@ void ledmatrix_update_pixel(uint8_t x, uint8_t y, PixelColour pixel)
 		// Position isn't valid - we ignore the request.
 		return;
 	}
-	(void)spi_send_byte(CMD_UPDATE_PIXEL);
-	(void)spi_send_byte(((y & 0x07) << 4) | (x & 0x0F));
-	(void)spi_send_byte(pixel);
+	send_byte(CMD_UPDATE_PIXEL);
+	send_byte(((y & 0x07) << 4) | (x & 0x0F));
+	send_last_byte(CMD_UPDATE_PIXEL, pixel);
 }
 
 void ledmatrix_draw_pixel_in_human_grid(uint8_t x, uint8_t y, PixelColour pixel)
@@ -77,12 +143,13 @@ void ledmatrix_update_row(uint8_t y, MatrixRow row)
 		// y value is too large - we ignore the request
 		return;
 	}
-	(void)spi_send_byte(CMD_UPDATE_ROW);
-	(void)spi_send_byte(y & 0x07);	// row number
-	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++)
+	send_byte(CMD_UPDATE_ROW);
+	send_byte(y & 0x07);	// row number
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS - 1; x++)
 	{
-		(void)spi_send_byte(row[x]);
+		send_byte(row[x]);
 	}
+	send_last_byte(CMD_UPDATE_ROW, row[MATRIX_NUM_COLUMNS - 1]);
 }
 
 void ledmatrix_update_column(uint8_t x, MatrixColumn col)
@@ -92,41 +159,42 @@ void ledmatrix_update_column(uint8_t x, MatrixColumn col)
 		// x value is too large - we ignore the request
 		return;
 	}
-	(void)spi_send_byte(CMD_UPDATE_COL);
-	(void)spi_send_byte(x & 0x0F); // column number
-	for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++)
+	send_byte(CMD_UPDATE_COL);
+	send_byte(x & 0x0F); // column number
+	for (uint8_t y = 0; y < MATRIX_NUM_ROWS - 1; y++)
 	{
-		(void)spi_send_byte(col[y]);
+		send_byte(col[y]);
 	}
+	send_last_byte(CMD_UPDATE_COL, col[MATRIX_NUM_ROWS - 1]);
 }
 
 void ledmatrix_shift_display_left(void)
 {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x02);
+	send_byte(CMD_SHIFT_DISPLAY);
+	send_last_byte(CMD_SHIFT_DISPLAY, 0x02);
 }
 
 void ledmatrix_shift_display_right(void)
 {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x01);
+	send_byte(CMD_SHIFT_DISPLAY);
+	send_last_byte(CMD_SHIFT_DISPLAY, 0x01);
 }
 
 void ledmatrix_shift_display_up(void)
 {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x08);
+	send_byte(CMD_SHIFT_DISPLAY);
+	send_last_byte(CMD_SHIFT_DISPLAY, 0x08);
 }
 
 void ledmatrix_shift_display_down(void)
 {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x04);
+	send_byte(CMD_SHIFT_DISPLAY);
+	send_last_byte(CMD_SHIFT_DISPLAY, 0x04);
 }
 
 void ledmatrix_clear(void)
 {
-	(void)spi_send_byte(CMD_CLEAR_SCREEN);
+	send_last_byte(CMD_CLEAR_SCREEN, CMD_CLEAR_SCREEN);
 }
 
 void copy_matrix_column(MatrixColumn from, MatrixColumn to)
@@ -24,11 +24,26 @@ typedef PixelColour MatrixData[MATRIX_NUM_COLUMNS][MATRIX_NUM_ROWS];
 typedef PixelColour MatrixRow[MATRIX_NUM_COLUMNS];
 typedef PixelColour MatrixColumn[MATRIX_NUM_ROWS];
 
+// SPI clock divider ledmatrix_setup() uses. At 128 the matrix board keeps
+// up with anything we send; at a faster clock the bytes are paced to what
+// the board takes to handle each command (see ledmatrix.c), which makes a
+// full update about 6.5 times faster at 16 (and no faster below that).
+// Dividers below 128 are unverified on the hardware: the pacing comes
+// from estimates of the board, with a margin, and has only been checked
+// against a model built on the same estimates (see matrix_timing).
+#ifndef LEDMATRIX_SPI_DIVIDER
+#define LEDMATRIX_SPI_DIVIDER 128
+#endif
+
 // Setup SPI communication with the LED matrix.
 // This function must be called before the LED matrix functions
 // below are used.
 void ledmatrix_setup(void);
 
+// The same with the given SPI clock divider, one of 2,4,8,16,32,64,128
+// (anything else is taken as 128)
+void ledmatrix_setup_divider(uint8_t clockdivider);
+
 // Functions to update the display
 // For those functions which take an x or a y value, the value must be valid
 // or the request will be ignored. (i.e. x must be < MATRIX_NUM_COLUMNS
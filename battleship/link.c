@@ -0,0 +1,506 @@
+/*
+ * link.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Head to head play over USART1 - see link.h.
+ */
+
+#include "link.h"
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bottomhalf.h"
+#include "events.h"
+#include "hal.h"
+#include "swtimer.h"
+#include "telemetry.h"
+#include "timer0.h"
+#include "timer1.h"
+#include "uart1.h"
+
+#define FRAME_START 0x7E
+
+/* Frame types. A type byte of 0x7E would be type 7, which doesn't exist,
+ * so a frame start can't be mistaken for the type byte after another. */
+#define TYPE_HELLO 1
+#define TYPE_ACK 2
+#define TYPE_SHOT 3
+#define TYPE_RESULT 4
+#define NUM_TYPES 5
+#define NO_TYPE 0xFF
+
+/* Payload length of each type of frame */
+static const uint8_t payload_lengths[NUM_TYPES] PROGMEM = {
+	NO_TYPE, 2, 0, 3, 3
+};
+
+/* Frame start, type and sequence number, payload and CRC */
+#define MAX_PAYLOAD 3
+#define MAX_FRAME (MAX_PAYLOAD + 4)
+
+/* How long to wait for an answer before sending a request again, and how
+ * many times to send a shot before giving up. The other side may be busy
+ * printing for a while before it gets to the shot, so the 25 tries give
+ * it a second. HELLO is sent until it is answered. */
+#define SHOT_RETRY_MS 40
+#define SHOT_TRIES 25
+#define HELLO_RETRY_MS 250
+
+/* Hashed with each shot fired by the side that fires first */
+#define FIRST_SHOOTER 0x80
+
+typedef struct {
+	uint8_t length;
+	uint8_t bytes[MAX_FRAME];
+} Frame;
+
+/* Whether a game has been started, and whether both sides have been
+ * announced (our HELLO answered and theirs received) */
+static uint8_t started;
+static uint8_t hello_answered;
+static uint8_t peer_announced;
+static uint8_t connected;
+static uint8_t first;
+static uint16_t nonce;
+static uint16_t peer_nonce;
+
+/* The rolling hash of the shots fired and their results */
+static uint16_t hash;
+
+/* Our request waiting to be answered (its type, or 0 if there is none),
+ * the sequence number it was sent with and the number of times it has
+ * been sent */
+static uint8_t request_type;
+static uint8_t request_seq;
+static Frame request;
+static uint8_t tries;
+static uint8_t retry_timer = SWTIMER_NONE;
+static uint32_t request_time;
+static uint8_t shot_cell;
+static uint8_t shot_result;
+
+/* The last request received (from the type byte on) and our answer to it,
+ * whose length is 0 until it has been answered */
+static Frame peer_request;
+static Frame answer;
+static uint8_t incoming_cell;
+static uint8_t incoming_hash_matched;
+
+/* The frame being received, and its length once the type is known */
+static uint8_t rx_frame[MAX_FRAME];
+static uint8_t rx_length;
+static uint8_t rx_frame_length;
+
+/* Round trip times in milliseconds (of requests answered the first time
+ * they were sent) and error counts for link_report() */
+static uint16_t last_round_trip;
+static uint16_t worst_round_trip;
+static uint16_t resent;
+static uint16_t bad_frames;
+static uint16_t desyncs;
+
+static void receive_frames(void);
+
+void init_link(void)
+{
+	init_uart1(LINK_BAUD, TELEMETRY_BAUD);
+	bh_register(BH_LINK, receive_frames);
+}
+
+/* CRC-16-CCITT, polynomial x^16 + x^12 + x^5 + 1 */
+static uint16_t crc16_update(uint16_t crc, uint8_t byte)
+{
+	crc ^= (uint16_t)byte << 8;
+	for (uint8_t bit = 0; bit < 8; bit++)
+	{
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+/* The CRC of a frame's type byte and payload. With a byte lost, the frame
+ * is taken to end with the first byte of whatever follows it, which an
+ * 8 bit CRC would pass one time in 256. */
+static uint16_t frame_crc(const uint8_t* bytes, uint8_t length)
+{
+	uint16_t crc = 0xFFFF;
+	for (uint8_t i = 0; i < length; i++)
+	{
+		crc = crc16_update(crc, bytes[i]);
+	}
+	return crc;
+}
+
+/* Add a shot at cell, fired by the side that fires first if by_first,
+ * and its result to the hash */
+static void hash_shot(uint8_t by_first, uint8_t cell, uint8_t result)
+{
+	hash = crc16_update(hash, (by_first ? FIRST_SHOOTER : 0) | cell);
+	hash = crc16_update(hash, result);
+}
+
+/* Post an EVENT_LINK event. event_post() must be called with interrupts
+ * off. */
+static void post(uint8_t what)
+{
+	uint8_t interrupts_were_enabled = hal_irq_save();
+	event_post(EVENT_LINK, what);
+	hal_irq_restore(interrupts_were_enabled);
+}
+
+static void make_frame(Frame* frame, uint8_t type, uint8_t seq,
+		const uint8_t* payload)
+{
+	uint8_t length = pgm_read_byte(&payload_lengths[type]);
+	frame->bytes[0] = FRAME_START;
+	frame->bytes[1] = (type << 4) | (seq & 0x0F);
+	/* No type's payload is longer than MAX_PAYLOAD, but the compiler can't
+	 * see that in a table in flash, so the copy is bounded by both */
+	for (uint8_t i = 0; i < length && i < MAX_PAYLOAD; i++)
+	{
+		frame->bytes[2 + i] = payload[i];
+	}
+	uint16_t crc = frame_crc(&frame->bytes[1], length + 1);
+	frame->bytes[2 + length] = crc >> 8;
+	frame->bytes[3 + length] = crc & 0xFF;
+	frame->length = length + 4;
+}
+
+static void send_frame(const Frame* frame)
+{
+	for (uint8_t i = 0; i < frame->length; i++)
+	{
+		uart1_put(frame->bytes[i]);
+	}
+}
+
+static void cancel_retry(void)
+{
+	if (retry_timer != SWTIMER_NONE)
+	{
+		swtimer_cancel(retry_timer);
+		retry_timer = SWTIMER_NONE;
+	}
+}
+
+/* Software timer callback: send the request again if it still hasn't been
+ * answered (see swtimer.h) */
+static void retry(void)
+{
+	retry_timer = SWTIMER_NONE;
+	if (!request_type)
+	{
+		return;
+	}
+	if (request_type == TYPE_SHOT && tries >= SHOT_TRIES)
+	{
+		telemetry_printf_P(PSTR("link: shot at %u not answered\n"),
+				shot_cell);
+		request_type = 0;
+		post(LINK_LOST);
+		return;
+	}
+	if (tries < UINT8_MAX)
+	{
+		tries++;
+	}
+	resent++;
+	send_frame(&request);
+	retry_timer = swtimer_start(
+			request_type == TYPE_HELLO ? HELLO_RETRY_MS : SHOT_RETRY_MS, 0,
+			retry);
+}
+
+static void send_request(uint8_t type, const uint8_t* payload,
+		uint16_t retry_ms)
+{
+	request_seq = (request_seq + 1) & 0x0F;
+	make_frame(&request, type, request_seq, payload);
+	request_type = type;
+	tries = 1;
+	request_time = get_current_time();
+	send_frame(&request);
+	cancel_retry();
+	retry_timer = swtimer_start(retry_ms, 0, retry);
+}
+
+static void send_hello(void)
+{
+	uint8_t payload[2] = { nonce >> 8, nonce };
+	hello_answered = 0;
+	send_request(TYPE_HELLO, payload, HELLO_RETRY_MS);
+}
+
+/* A number the other side is unlikely to pick too. Two boards started
+ * together get the same rand() sequence, so the cycle count is mixed in. */
+static uint16_t pick_nonce(void)
+{
+	return rand() ^ get_cycle_count() ^ (uint16_t)get_current_time();
+}
+
+/* Connect once both sides have been announced */
+static void try_connect(void)
+{
+	if (connected || !hello_answered || !peer_announced)
+	{
+		return;
+	}
+	if (nonce == peer_nonce)
+	{
+		/* A tie - both sides see it, and both pick again */
+		nonce = pick_nonce();
+		peer_announced = 0;
+		send_hello();
+		return;
+	}
+	connected = 1;
+	first = nonce > peer_nonce;
+	telemetry_printf_P(PSTR("link: connected, nonce %04x theirs %04x\n"),
+			nonce, peer_nonce);
+	post(LINK_CONNECTED);
+}
+
+static void hello(const uint8_t* payload)
+{
+	uint16_t their_nonce = ((uint16_t)payload[0] << 8) | payload[1];
+	if (connected && their_nonce != peer_nonce)
+	{
+		/* They have started another game while we are in this one */
+		link_stop();
+		post(LINK_LOST);
+		return;
+	}
+	make_frame(&answer, TYPE_ACK, peer_request.bytes[0], 0);
+	send_frame(&answer);
+
+	/* If they have picked a new nonce after a tie, or are announcing
+	 * themselves after we were answered, they may not have seen ours */
+	if (!connected && hello_answered
+			&& (!peer_announced || their_nonce != peer_nonce))
+	{
+		send_hello();
+	}
+	peer_nonce = their_nonce;
+	peer_announced = 1;
+	try_connect();
+}
+
+/* An answer to our request */
+static void answered(uint8_t type, uint8_t seq, const uint8_t* payload)
+{
+	if (!request_type || seq != request_seq
+			|| type != (request_type == TYPE_HELLO ? TYPE_ACK : TYPE_RESULT))
+	{
+		/* Not to the request we are waiting on - an answer to one sent
+		 * again that was already answered */
+		return;
+	}
+	cancel_retry();
+	request_type = 0;
+	if (tries == 1)
+	{
+		last_round_trip = get_current_time() - request_time;
+		if (last_round_trip > worst_round_trip)
+		{
+			worst_round_trip = last_round_trip;
+		}
+	}
+
+	if (type == TYPE_ACK)
+	{
+		hello_answered = 1;
+		try_connect();
+		return;
+	}
+	shot_result = payload[0];
+	hash_shot(first, shot_cell, shot_result);
+	post(LINK_RESULT);
+	uint16_t their_hash = ((uint16_t)payload[1] << 8) | payload[2];
+	if (hash != their_hash)
+	{
+		telemetry_printf_P(PSTR("link: out of step after shot at %u, "
+				"hash %04x theirs %04x\n"), shot_cell, hash, their_hash);
+		desyncs++;
+		post(LINK_DESYNC);
+	}
+}
+
+/* A whole frame has been received with a good CRC */
+static void handle_frame(void)
+{
+	uint8_t type = rx_frame[1] >> 4;
+	uint8_t seq = rx_frame[1] & 0x0F;
+	const uint8_t* payload = &rx_frame[2];
+	uint8_t length = rx_frame_length - 3;
+	if (type == TYPE_ACK || type == TYPE_RESULT)
+	{
+		answered(type, seq, payload);
+		return;
+	}
+
+	/* A request received again is answered again (once the game has
+	 * answered it), not done twice */
+	uint8_t same = peer_request.length == length;
+	for (uint8_t i = 0; same && i < length; i++)
+	{
+		same = peer_request.bytes[i] == rx_frame[1 + i];
+	}
+	if (same)
+	{
+		if (answer.length)
+		{
+			send_frame(&answer);
+		}
+		return;
+	}
+
+	/* HELLO is only answered once we have started a game, and SHOT once
+	 * we are connected: until then they will be sent again. They only
+	 * fire once they have answered our shot, so a shot from them before
+	 * we have their answer means the answer was lost - it has to be
+	 * hashed first, so their shot waits to be sent again too. */
+	if (!started || (type == TYPE_SHOT
+			&& (!connected || request_type == TYPE_SHOT)))
+	{
+		return;
+	}
+	peer_request.length = length;
+	for (uint8_t i = 0; i < length; i++)
+	{
+		peer_request.bytes[i] = rx_frame[1 + i];
+	}
+	answer.length = 0;
+
+	if (type == TYPE_HELLO)
+	{
+		hello(payload);
+		return;
+	}
+	incoming_cell = payload[0] & 0x3F;
+	uint16_t their_hash = ((uint16_t)payload[1] << 8) | payload[2];
+	incoming_hash_matched = hash == their_hash;
+	if (!incoming_hash_matched)
+	{
+		telemetry_printf_P(PSTR("link: out of step before shot at %u, "
+				"hash %04x theirs %04x\n"), incoming_cell, hash, their_hash);
+	}
+	post(LINK_SHOT);
+}
+
+/* Bottom half: decode the bytes received on USART1. A frame with a bad
+ * CRC is dropped, and the next one looked for from the byte after its
+ * start; the request it may have been is sent again. */
+static void receive_frames(void)
+{
+	uint8_t byte;
+	while (uart1_get(&byte))
+	{
+		if (rx_length == 0)
+		{
+			if (byte == FRAME_START)
+			{
+				rx_frame[rx_length++] = byte;
+			}
+			continue;
+		}
+		rx_frame[rx_length++] = byte;
+		if (rx_length == 2)
+		{
+			uint8_t type = byte >> 4;
+			uint8_t length = type < NUM_TYPES ?
+					pgm_read_byte(&payload_lengths[type]) : NO_TYPE;
+			if (length == NO_TYPE)
+			{
+				bad_frames++;
+				rx_length = 0;
+				continue;
+			}
+			rx_frame_length = length + 4;
+			continue;
+		}
+		if (rx_length == rx_frame_length)
+		{
+			rx_length = 0;
+			uint16_t crc = frame_crc(&rx_frame[1], rx_frame_length - 3);
+			if ((crc >> 8) != rx_frame[rx_frame_length - 2]
+					|| (crc & 0xFF) != rx_frame[rx_frame_length - 1])
+			{
+				bad_frames++;
+				continue;
+			}
+			handle_frame();
+		}
+	}
+}
+
+void link_start(void)
+{
+	uart1_link_start();
+	started = 1;
+	connected = 0;
+	peer_announced = 0;
+	hash = 0xFFFF;
+	nonce = pick_nonce();
+	send_hello();
+}
+
+void link_stop(void)
+{
+	started = 0;
+	connected = 0;
+	request_type = 0;
+	cancel_retry();
+	uart1_link_stop();
+}
+
+uint8_t link_first(void)
+{
+	return first;
+}
+
+uint8_t link_fire(uint8_t cell)
+{
+	if (!connected || request_type)
+	{
+		return 0;
+	}
+	shot_cell = cell;
+	uint8_t payload[3] = { cell, hash >> 8, hash };
+	send_request(TYPE_SHOT, payload, SHOT_RETRY_MS);
+	return 1;
+}
+
+uint8_t link_result(void)
+{
+	return shot_result;
+}
+
+uint8_t link_incoming(void)
+{
+	return incoming_cell;
+}
+
+void link_answer(uint8_t result)
+{
+	hash_shot(!first, incoming_cell, result);
+	uint8_t payload[3] = { result, hash >> 8, hash };
+	make_frame(&answer, TYPE_RESULT, peer_request.bytes[0], payload);
+	send_frame(&answer);
+	if (!incoming_hash_matched)
+	{
+		desyncs++;
+		post(LINK_DESYNC);
+	}
+}
+
+void link_report(void)
+{
+	printf_P(PSTR("Link: round trip %ums (worst %ums), %u sent again, "
+			"%u bad frames, %u bytes overrun, %u out of step\n"),
+			last_round_trip, worst_round_trip, resent, bad_frames,
+			uart1_overruns(), desyncs);
+}
@@ -0,0 +1,92 @@
+/*
+ * link.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Head to head play between two boards (or a board and battleship_host on
+ * a pty) over USART1. Each side keeps its own fleet to itself: a shot is
+ * sent as the cell fired at, and the other side answers with whether it
+ * hit or sank a ship.
+ *
+ * Every message is a frame of at most 7 bytes:
+ *
+ *   0x7E  type << 4 | seq  payload  CRC-16 of the type byte and payload
+ *
+ *   HELLO   nonce (2 bytes)          announce ourselves; answered by ACK
+ *   ACK     (none)
+ *   SHOT    cell, hash (2 bytes)     answered by RESULT
+ *   RESULT  result, hash (2 bytes)
+ *
+ * HELLO and SHOT are requests, numbered with a 4 bit sequence number that
+ * the answer carries back. A request that isn't answered in time is sent
+ * again, and a request received twice is answered again from the copy of
+ * the answer kept, without doing it twice. Once both sides have
+ * had their HELLO answered, the one whose nonce is higher fires first.
+ *
+ * Both sides keep a rolling hash (CRC-16-CCITT) of every shot fired and
+ * its result. A SHOT carries the shooter's hash from before it and a
+ * RESULT the answerer's from after it, so each side checks the other's
+ * every turn, for two bytes a message.
+ *
+ * A shot and its result are 14 bytes, about 4ms at LINK_BAUD, so the round
+ * trip is mostly the time the other side takes to answer.
+ */
+
+#ifndef LINK_H_
+#define LINK_H_
+
+#include <stdint.h>
+
+/* Baud rate of the link */
+#define LINK_BAUD 38400
+
+/* What happened, the key of an EVENT_LINK event (see events.h) */
+#define LINK_CONNECTED 0	/* link_first() says who fires first */
+#define LINK_SHOT 1		/* at link_incoming(), answer with link_answer() */
+#define LINK_RESULT 2		/* of our shot, see link_result() */
+#define LINK_DESYNC 3		/* the two sides' hashes differ */
+#define LINK_LOST 4		/* a shot wasn't answered, or the other side
+				 * started again */
+
+/* Results, as in the cell encoding in game.h */
+#define LINK_MISS 0x00
+#define LINK_HIT 0x80
+#define LINK_SUNK 0x40		/* and the ship type in the low 3 bits */
+#define LINK_FLEET_SUNK 0x20	/* the last ship */
+
+/* Start USART1 and decode the frames it receives from now on. It is
+ * assumed that global interrupts are off when this function is called.
+ */
+void init_link(void);
+
+/* Start a game: announce ourselves until the other side answers, then
+ * post LINK_CONNECTED. The hash starts again.
+ */
+void link_start(void);
+
+/* Stop announcing ourselves or sending a shot again. Requests the other
+ * side sends again are still answered.
+ */
+void link_stop(void);
+
+/* Returns 1 if we fire first, once connected */
+uint8_t link_first(void);
+
+/* Fire at cell (row * 8 + column). Returns 0 if not connected or the last
+ * shot hasn't been answered yet, 1 if it was sent.
+ */
+uint8_t link_fire(uint8_t cell);
+
+/* The result of our last shot */
+uint8_t link_result(void);
+
+/* The cell the other side has fired at */
+uint8_t link_incoming(void);
+
+/* Answer the other side's shot */
+void link_answer(uint8_t result);
+
+/* Print the round trip times and error counts */
+void link_report(void);
+
+#endif /* LINK_H_ */
@@ -0,0 +1,109 @@
+/*
+ * log.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Levelled terminal messages - see log.h.
+ */
+
+#include "log.h"
+
+#include <avr/pgmspace.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "serialio.h"
+#include "telemetry.h"
+
+/* Output buffer space each level has to leave free. 64 bytes is room for
+ * a couple of LOG_CRITICAL messages; LOG_DEBUG leaves half the buffer. */
+static const uint8_t keep_free[NUM_LOG_LEVELS] PROGMEM = { 0, 64, 128 };
+
+/* ESC 8, which ends a message printed at a position */
+#define RESTORE_CURSOR_LENGTH 2
+
+static uint16_t dropped[NUM_LOG_LEVELS];
+
+/* Drops not yet summarised on the telemetry channel */
+static uint8_t unreported[NUM_LOG_LEVELS];
+static uint8_t any_unreported;
+
+static void count_drop(uint8_t level)
+{
+	if (dropped[level] < UINT16_MAX)
+	{
+		dropped[level]++;
+	}
+	if (unreported[level] < UINT8_MAX)
+	{
+		unreported[level]++;
+	}
+	any_unreported = 1;
+}
+
+void log_at_P(uint8_t level, int8_t x, int8_t y, const char* format, ...)
+{
+	/* A message at a position saves the cursor first (ESC 7) and puts it
+	 * back after (ESC 8), so room is kept for the ESC 8 */
+	char message[LOG_MESSAGE_SIZE];
+	uint8_t room = sizeof(message);
+	int length = 0;
+	if (x != LOG_HERE)
+	{
+		room -= RESTORE_CURSOR_LENGTH;
+		length = snprintf_P(message, room, PSTR("\x1b" "7\x1b[%d;%dH"), y, x);
+	}
+	va_list args;
+	va_start(args, format);
+	int text_length = vsnprintf_P(&message[length], room - length, format,
+			args);
+	va_end(args);
+	if (text_length < 0)
+	{
+		return;
+	}
+	length += text_length;
+	if (length >= room)
+	{
+		length = room - 1;
+	}
+	if (x != LOG_HERE)
+	{
+		message[length++] = '\x1b';
+		message[length++] = '8';
+	}
+
+	/* LOG_CRITICAL waits for room, as printf() does, unless it never
+	 * will be made */
+	if (level == LOG_CRITICAL ? serial_write(message, length)
+			: serial_try_write(message, length,
+					pgm_read_byte(&keep_free[level])))
+	{
+		count_drop(level);
+		return;
+	}
+
+	if (any_unreported)
+	{
+		any_unreported = 0;
+		telemetry_printf_P(PSTR("log: dropped %u critical, %u info, "
+				"%u debug\n"), unreported[LOG_CRITICAL], unreported[LOG_INFO],
+				unreported[LOG_DEBUG]);
+		for (uint8_t i = 0; i < NUM_LOG_LEVELS; i++)
+		{
+			unreported[i] = 0;
+		}
+	}
+}
+
+uint16_t log_dropped(uint8_t level)
+{
+	return dropped[level];
+}
+
+void log_report(void)
+{
+	printf_P(PSTR("Log: dropped %u critical, %u info, %u debug messages, "
+			"%u telemetry\n"), dropped[LOG_CRITICAL], dropped[LOG_INFO],
+			dropped[LOG_DEBUG], telemetry_dropped());
+}
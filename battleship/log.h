@@ -0,0 +1,70 @@
+/*
+ * log.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Messages to the game terminal (USART0) that can't hold up the game.
+ * printf() waits for room in the output buffer whenever it is full, so a
+ * burst of messages (several ships sunk by one salvo, say) stops the main
+ * loop until they have been sent. Messages logged here have a level:
+ *
+ *   LOG_CRITICAL  game state the player has to see. Always printed, and
+ *                 the others leave room for them, so they rarely wait.
+ *   LOG_INFO      everything else shown during a game. Dropped if it
+ *                 would eat into the room kept for LOG_CRITICAL.
+ *   LOG_DEBUG     diagnostics. Dropped once the buffer is half full.
+ *
+ * A message goes out whole or not at all (cursor position included), so a
+ * dropped one never leaves half a line or escape sequence on the screen.
+ * One printed at a position puts the cursor back where it was afterwards,
+ * so the battle log (see game.h) can be added to where the cursor is.
+ * Drops are counted per level and summarised on the telemetry channel
+ * (see telemetry.h) once messages get through again.
+ *
+ * What still uses printf() and the terminalio.h functions, and so may
+ * wait for room in the output buffer:
+ *
+ *   - the start and game over screens, and the battle log's scroll region
+ *     set up as a game starts, when there is nothing else to do;
+ *   - the 'm' and 'h' reports. They are several hundred bytes, more than
+ *     the output buffer holds, and a report with lines missing is no use,
+ *     so they wait rather than drop: asking for one stalls the game for
+ *     as long as the terminal takes to show it (about 0.3s at 19200 baud).
+ *
+ * Everything else printed while a game is being set up or played goes
+ * through log_at_P().
+ */
+
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <stdint.h>
+
+#define LOG_CRITICAL 0
+#define LOG_INFO 1
+#define LOG_DEBUG 2
+#define NUM_LOG_LEVELS 3
+
+/* Longest message, after formatting and with the cursor movement; the
+ * rest is cut off */
+#define LOG_MESSAGE_SIZE 64
+
+/* Pass as x to log_at_P() to print where the cursor is */
+#define LOG_HERE -1
+
+/* printf a message at level to the terminal at column x, row y (as
+ * move_terminal_cursor() takes them), leaving the cursor where it was, or
+ * where the cursor is if x is LOG_HERE. The format is in program memory
+ * (use PSTR()).
+ */
+void log_at_P(uint8_t level, int8_t x, int8_t y, const char* format, ...);
+
+/* Number of messages dropped at level (saturates). LOG_CRITICAL messages
+ * are only dropped if logged with interrupts off and no room for them.
+ */
+uint16_t log_dropped(uint8_t level);
+
+/* Print the drop counts on the terminal (for the 'm' report) */
+void log_report(void);
+
+#endif /* LOG_H_ */
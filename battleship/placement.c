@@ -0,0 +1,290 @@
+/*
+ * placement.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Placing the human's fleet - see placement.h.
+ */
+
+#include "placement.h"
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "fleets.h"
+#include "game.h"
+#include "ledmatrix.h"
+
+// The grid the fleet is being placed in, given to placement_start()
+static uint8_t (*human_grid)[GRID_NUM_COLUMNS];
+
+// ship lengths indexed by ship type, as in fleets.c
+static const uint8_t ship_lengths[SHIP_MASK + 1] PROGMEM = {0, 6, 4, 3,
+                                                            3, 2, 2, 0};
+
+// Tries at placing a ship at random before starting the fleet again
+#define RANDOM_TRIES 100
+
+// Where each ship starts, from the layout: its top left end as row * 8 +
+// column, with START_VERTICAL set if it is vertical
+#define START_VERTICAL 0x40
+static uint8_t starts[SHIP_MASK + 1];
+
+// Cells that ships already placed cover or touch, one bit per column for
+// each row and the same again one bit per row for each column, so that a
+// ship in either direction is checked with a single test
+static uint8_t blocked_rows[GRID_NUM_ROWS];
+static uint8_t blocked_columns[GRID_NUM_COLUMNS];
+
+// The ship being placed (above SUBMARINE once they all are), its top left
+// end and direction, whether it can go down there and whether the blink
+// is showing it
+static uint8_t ship;
+static int8_t ship_row, ship_col;
+static uint8_t ship_vertical;
+static uint8_t ship_fits;
+static uint8_t ship_shown;
+
+static uint8_t ship_length(void) {
+  return pgm_read_byte(&ship_lengths[ship & SHIP_MASK]);
+}
+
+// Returns 1 if the ship being placed overlaps or touches no other ship
+static uint8_t fits(void) {
+  uint8_t line = (1 << ship_length()) - 1;
+  if (ship_vertical) {
+    return !(blocked_columns[ship_col] & (line << ship_row));
+  }
+  return !(blocked_rows[ship_row] & (line << ship_col));
+}
+
+// Keep the ship being placed on the grid
+static void keep_on_grid(void) {
+  int8_t last = GRID_NUM_ROWS - ship_length();
+  int8_t max_row = ship_vertical ? last : GRID_NUM_ROWS - 1;
+  int8_t max_col = ship_vertical ? GRID_NUM_COLUMNS - 1 : last;
+  if (ship_row < 0) {
+    ship_row = 0;
+  } else if (ship_row > max_row) {
+    ship_row = max_row;
+  }
+  if (ship_col < 0) {
+    ship_col = 0;
+  } else if (ship_col > max_col) {
+    ship_col = max_col;
+  }
+}
+
+// The cells of the ship being placed, one bit per column for each row
+static void ship_cells(uint8_t cells[GRID_NUM_ROWS]) {
+  uint8_t length = ship_length();
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    cells[row] = 0;
+  }
+  if (ship_vertical) {
+    for (uint8_t i = 0; i < length; i++) {
+      cells[ship_row + i] = 1 << ship_col;
+    }
+  } else {
+    cells[ship_row] = ((1 << length) - 1) << ship_col;
+  }
+}
+
+// Draw the cells set in cells as the ship being placed (yellow if it fits,
+// red if not) if shown, or as the grid under it if not
+static void draw_cells(const uint8_t cells[GRID_NUM_ROWS], uint8_t shown) {
+  PixelColour colour = ship_fits ? COLOUR_YELLOW : COLOUR_RED;
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    for (uint8_t col = 0; cells[row] >> col; col++) {
+      if (!(cells[row] & (1 << col))) {
+        continue;
+      }
+      if (shown) {
+        ledmatrix_draw_pixel_in_human_grid(col, row, colour);
+      } else {
+        ledmatrix_draw_pixel_in_human_grid(
+            col, row,
+            (human_grid[row][col] & SHIP_MASK) ? COLOUR_ORANGE : COLOUR_BLACK);
+      }
+    }
+  }
+}
+
+// Move the ship being placed to (row, col), in direction vertical, and
+// show it there. Only the cells it leaves are redrawn, and the ones it
+// moves onto (or all of its cells if it was blinked off or changes
+// colour).
+static void move_ship(int8_t row, int8_t col, uint8_t vertical) {
+  uint8_t before[GRID_NUM_ROWS];
+  uint8_t after[GRID_NUM_ROWS];
+  uint8_t fitted = ship_fits;
+  ship_cells(before);
+  ship_row = row;
+  ship_col = col;
+  ship_vertical = vertical;
+  keep_on_grid();
+  ship_fits = fits();
+  ship_cells(after);
+
+  uint8_t redraw_all = !ship_shown || ship_fits != fitted;
+  for (uint8_t r = 0; r < GRID_NUM_ROWS; r++) {
+    uint8_t left = before[r] & ~after[r];
+    if (!redraw_all) {
+      after[r] &= ~before[r];
+    }
+    before[r] = left;
+  }
+  draw_cells(before, 0);
+  draw_cells(after, 1);
+  ship_shown = 1;
+}
+
+// Start placing the next ship from where the layout has it
+static void next_ship(void) {
+  ship++;
+  if (ship > SUBMARINE) {
+    return;
+  }
+  ship_row = (starts[ship] & ~START_VERTICAL) / GRID_NUM_COLUMNS;
+  ship_col = (starts[ship] & ~START_VERTICAL) % GRID_NUM_COLUMNS;
+  ship_vertical = (starts[ship] & START_VERTICAL) != 0;
+  keep_on_grid();
+  ship_fits = fits();
+  uint8_t cells[GRID_NUM_ROWS];
+  ship_cells(cells);
+  draw_cells(cells, 1);
+  ship_shown = 1;
+}
+
+// Put the ship being placed into human_grid, in the encoding in game.h,
+// and block its cells and the ones next to them
+static void put_ship(void) {
+  uint8_t length = ship_length();
+  for (uint8_t i = 0; i < length; i++) {
+    uint8_t row = ship_vertical ? ship_row + i : ship_row;
+    uint8_t col = ship_vertical ? ship_col : ship_col + i;
+    human_grid[row][col] = ship | (ship_vertical ? 0 : HORIZONTAL) |
+                           ((i == 0 || i == length - 1) ? SHIP_END : 0);
+
+    uint8_t col_bit = 1 << col;
+    uint8_t row_bit = 1 << row;
+    blocked_rows[row] |= col_bit | (col_bit << 1) | (col_bit >> 1);
+    blocked_columns[col] |= row_bit | (row_bit << 1) | (row_bit >> 1);
+    if (row > 0) {
+      blocked_rows[row - 1] |= col_bit;
+    }
+    if (row < GRID_NUM_ROWS - 1) {
+      blocked_rows[row + 1] |= col_bit;
+    }
+    if (col > 0) {
+      blocked_columns[col - 1] |= row_bit;
+    }
+    if (col < GRID_NUM_COLUMNS - 1) {
+      blocked_columns[col + 1] |= row_bit;
+    }
+  }
+}
+
+// Empty the grid with no ships placed
+static void clear_fleet(void) {
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++) {
+      human_grid[row][col] = SEA;
+    }
+    blocked_rows[row] = 0;
+    blocked_columns[row] = 0;
+  }
+}
+
+void placement_start(uint8_t grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS],
+                     uint8_t layout) {
+  human_grid = grid;
+  // the top left end of each ship is the first of its cells found
+  fleet_load(layout, human_grid);
+  for (uint8_t type = 0; type <= SHIP_MASK; type++) {
+    starts[type] = 0xFF;
+  }
+  for (uint8_t row = 0; row < GRID_NUM_ROWS; row++) {
+    for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++) {
+      uint8_t cell = human_grid[row][col];
+      uint8_t type = cell & SHIP_MASK;
+      if (type && starts[type] == 0xFF) {
+        starts[type] = (row * GRID_NUM_COLUMNS + col) |
+                       ((cell & HORIZONTAL) ? 0 : START_VERTICAL);
+      }
+    }
+  }
+
+  clear_fleet();
+  ledmatrix_clear();
+  ship = SEA;
+  next_ship();
+}
+
+void placement_move(int8_t dx, int8_t dy) {
+  if (ship > SUBMARINE) {
+    return;
+  }
+  // the human's grid is drawn the right way up, y is the row
+  move_ship(ship_row + dy, ship_col + dx, ship_vertical);
+}
+
+void placement_rotate(void) {
+  if (ship > SUBMARINE) {
+    return;
+  }
+  move_ship(ship_row, ship_col, !ship_vertical);
+}
+
+uint8_t placement_place(void) {
+  if (ship > SUBMARINE || !ship_fits) {
+    return 0;
+  }
+  put_ship();
+  uint8_t cells[GRID_NUM_ROWS];
+  ship_cells(cells);
+  draw_cells(cells, 0);
+  next_ship();
+  return 1;
+}
+
+void placement_random(void) {
+  // the game redraws the whole grid when it starts, so nothing is drawn
+  // here
+  uint8_t tries = 0;
+  while (ship <= SUBMARINE) {
+    uint8_t length = ship_length();
+    ship_vertical = rand() & 1;
+    ship_row = rand() % (ship_vertical ? GRID_NUM_ROWS + 1 - length
+                                       : GRID_NUM_ROWS);
+    ship_col = rand() % (ship_vertical ? GRID_NUM_COLUMNS
+                                       : GRID_NUM_COLUMNS + 1 - length);
+    if (fits()) {
+      put_ship();
+      ship++;
+      tries = 0;
+    } else if (++tries == RANDOM_TRIES) {
+      clear_fleet();
+      ship = CARRIER;
+      tries = 0;
+    }
+  }
+}
+
+void placement_layout(uint8_t layout) {
+  fleet_load(layout, human_grid);
+  ship = SUBMARINE + 1;
+}
+
+uint8_t placement_done(void) { return ship > SUBMARINE; }
+
+void placement_flash(void) {
+  if (ship > SUBMARINE) {
+    return;
+  }
+  ship_shown = !ship_shown;
+  uint8_t cells[GRID_NUM_ROWS];
+  ship_cells(cells);
+  draw_cells(cells, ship_shown);
+}
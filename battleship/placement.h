@@ -0,0 +1,55 @@
+/*
+ * placement.h
+ *
+ * Author: Andrew Wilson
+ *
+ * The human places their own fleet before each game. The ships are placed
+ * one at a time, longest first, starting where the chosen fleet layout
+ * (see fleets.h) has them: the ship being placed blinks, yellow where it
+ * could go and red where it would overlap or touch a ship already placed,
+ * and can be moved, turned, and put down once it is yellow. The whole
+ * fleet can also be placed at random, or left as in the layout.
+ *
+ * The fleet is built in the human_grid of a game (see GameState in
+ * game.h), in the encoding in game.h. Only the pixels of the ship being
+ * placed are redrawn as it moves or blinks.
+ */
+
+#ifndef PLACEMENT_H_
+#define PLACEMENT_H_
+
+#include <stdint.h>
+
+#include "ledmatrix.h"
+
+// Clear grid (the human's) and start placing the ships of fleet layout
+// layout in it, the carrier first. The other functions place them in the
+// same grid.
+void placement_start(uint8_t grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS],
+                     uint8_t layout);
+
+// Move the ship being placed by (dx, dy), keeping it on the grid
+void placement_move(int8_t dx, int8_t dy);
+
+// Turn the ship being placed between horizontal and vertical, about its
+// top left end (moved back onto the grid if it would go off it)
+void placement_rotate(void);
+
+// Put the ship being placed down where it is, and move on to the next.
+// Returns 0 (and does nothing) if it would overlap or touch another ship.
+uint8_t placement_place(void);
+
+// Place the ships not placed yet at random, starting again from an empty
+// grid if they don't fit around the ones already placed
+void placement_random(void);
+
+// Place the whole fleet as in layout, forgetting any ships already placed
+void placement_layout(uint8_t layout);
+
+// Returns 1 once every ship has been placed
+uint8_t placement_done(void);
+
+// Blink the ship being placed. Call every CURSOR_FLASH_MS from a timer.
+void placement_flash(void);
+
+#endif /* PLACEMENT_H_ */
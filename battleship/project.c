@@ -12,15 +12,28 @@
 #include <avr/pgmspace.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #define F_CPU 8000000UL
 #include <util/delay.h>
 
+#include "ai.h"
+#include "attract.h"
 #include "buttons.h"
 #include "display.h"
+#include "events.h"
+#include "fleets.h"
 #include "game.h"
+#include "isrprofile.h"
+#include "keymap.h"
 #include "ledmatrix.h"
+#include "link.h"
+#include "log.h"
+#include "placement.h"
 #include "serialio.h"
+#include "spi.h"
+#include "sram.h"
+#include "swtimer.h"
 #include "terminalio.h"
 #include "timer0.h"
 #include "timer1.h"
@@ -30,15 +43,40 @@
 // given here
 void initialise_hardware(void);
 void start_screen(void);
+void animate_start_screen(void);
+void start_attract_mode(void);
+void show_fleet_choice(void);
+void show_mode_choice(void);
 void new_game(void);
+void place_fleet(void);
 void play_game(void);
 void handle_game_over(void);
+void flash_game_cursor(void);
+uint8_t think_about_move(void);
+
+// How often the start screen animation moves on and the cursor flashes,
+// in milliseconds
+#define ANIMATION_FRAME_MS 200
+#define CURSOR_FLASH_MS 200
+
+// The game being played, and the computer playing it (see ai.h)
+static GameState game;
+static AiState computer_ai;
+
+// The frame the start screen animation is up to
+static int8_t frame_number;
+
+// The timers for the start screen animation and for starting attract mode
+// (see attract.h) if nothing is pressed for a while
+static uint8_t animation_timer;
+static uint8_t attract_timer;
 
 /////////////////////////////// main //////////////////////////////////
 int main(void) {
   // Setup hardware and call backs. This will turn on
   // interrupts.
   initialise_hardware();
+  init_game_state(&game, &computer_ai);
 
   // Show the splash screen message. Returns when display
   // is complete.
@@ -54,10 +92,15 @@ int main(void) {
 
 void initialise_hardware(void) {
   ledmatrix_setup();
+  init_swtimers();
+  init_events();
   init_button_interrupts();
   // Setup serial port for 19200 baud communication with no echo
-  // of incoming characters
+  // of incoming characters, which are posted to the event queue
   init_serial_stdio(19200, 0);
+  serial_input_to_events(1);
+  // and USART1 for link play against another board
+  init_link();
 
   init_timer0();
   init_timer1();
@@ -112,122 +155,227 @@ void start_screen(void) {
   // change this to your name and student number; remove the chevrons <>
   printf_P(PSTR("CSSE2010/7201 Project by Andrew Wilson - 48280411"));
 
+  // Show the fleet layout the player will get, this can be changed
+  // with the number keys below
+  show_fleet_choice();
+  show_mode_choice();
+
   // Output the static start screen and wait for a push button
   // to be pushed or a serial input of 's'
   show_start_screen();
 
-  uint32_t last_screen_update, current_time;
-  last_screen_update = get_current_time();
-
-  int8_t frame_number = -2 * ANIMATION_DELAY;
-
-  // Wait until a button is pressed, or 's' is pressed on the terminal
+  // Wait until a button is pressed or 's' is pressed on the terminal,
+  // with a timer updating the animation meanwhile, and the computer
+  // playing itself if it's a long wait
+  frame_number = -2 * ANIMATION_DELAY;
+  animation_timer = swtimer_start(ANIMATION_FRAME_MS, ANIMATION_FRAME_MS,
+                                  animate_start_screen);
+  attract_timer = swtimer_start(ATTRACT_DELAY_MS, 0, start_attract_mode);
+  Event event;
   while (1) {
-    // First check for if a 's' is pressed
-    // There are two steps to this
-    // 1) collect any serial input (if available)
-    // 2) check if the input is equal to the character 's'
-    char serial_input = -1;
-    if (serial_input_available()) {
-      serial_input = fgetc(stdin);
-    }
-    // If the serial input is 's', then exit the start screen
-    if (serial_input == 's' || serial_input == 'S') {
+    event_wait(&event);
+    uint8_t action = event_action(&event, start_keymap);
+    if (action == ACTION_START) {
       break;
     }
-    // Next check for any button presses
-    int8_t btn = button_pushed();
-    if (btn != NO_BUTTON_PUSHED) {
-      break;
+    // A number chooses the fleet layout
+    if (action == ACTION_SELECT_FLEET) {
+      select_fleet(&game, event.key - '1');
+      show_fleet_choice();
     }
-
-    // every 200 ms, update the animation
-    current_time = get_current_time();
-    if (current_time - last_screen_update > 200) {
-      update_start_screen(frame_number);
-      frame_number++;
-      if (frame_number > ANIMATION_LENGTH) {
-        frame_number -= ANIMATION_LENGTH + ANIMATION_DELAY;
-      }
-      last_screen_update = current_time;
+    // and 'g' moves on to the next game mode
+    if (action == ACTION_SELECT_MODE) {
+      select_mode(&game, selected_mode(&game) + 1);
+      show_mode_choice();
     }
   }
+  swtimer_cancel(animation_timer);
+  swtimer_cancel(attract_timer);
+  attract_stop();
+}
+
+// Software timer callback for the start screen (see swtimer.h)
+void animate_start_screen(void) {
+  update_start_screen(frame_number);
+  frame_number++;
+  if (frame_number > ANIMATION_LENGTH) {
+    frame_number -= ANIMATION_LENGTH + ANIMATION_DELAY;
+  }
+}
+
+// Software timer callback for the start screen: stop the animation and
+// let the computer play itself instead
+void start_attract_mode(void) {
+  attract_timer = SWTIMER_NONE;
+  swtimer_cancel(animation_timer);
+  animation_timer = SWTIMER_NONE;
+  attract_start(&game);
+}
+
+// The choices can change while the computer plays itself, which adds to
+// its log where the cursor is, so these put the cursor back afterwards
+// (see log.h)
+void show_fleet_choice(void) {
+  log_at_P(LOG_CRITICAL, 10, 16,
+           PSTR("Fleet: %S (press 1-%d to choose)\x1b[K"),
+           fleet_name(selected_fleet(&game)), NUM_FLEET_LAYOUTS);
+}
+
+void show_mode_choice(void) {
+  log_at_P(LOG_CRITICAL, 10, 17, PSTR("Mode: %S (press g to change)\x1b[K"),
+           mode_name(selected_mode(&game)));
 }
 
 void new_game(void) {
   // Clear the serial terminal
   clear_terminal();
 
+  // Let the human place their fleet
+  place_fleet();
+  clear_terminal();
+
   // Initialise the game and display
-  initialise_game();
+  initialise_game(&game);
 
-  // Clear a button push or serial input if any are waiting
-  // (The cast to void means the return value is ignored.)
-  (void)button_pushed();
-  clear_serial_input_buffer();
+  // Clear any button pushes or serial input that are waiting
+  events_clear();
 }
 
-void play_game(void) {
-  uint32_t last_flash_time, current_time;
-  int8_t btn;  // The button pushed
-
-  last_flash_time = get_current_time();
-
-  // We play the game until it's over
-  while (!is_game_over()) {
-    // We need to check if any button has been pushed, this will be
-    // NO_BUTTON_PUSHED if no button has been pushed
-    // Checkout the function comment in `buttons.h` and the implementation
-    // in `buttons.c`.
-    btn = button_pushed();
-
-    char key = -1;
-    if (serial_input_available()) {
-      key = fgetc(stdin);
-    }
-    // move right
-    if (btn == BUTTON0_PUSHED || key == 'D' || key == 'd') {
-      move_cursor(1, 0);
-    }
-    // move down
-    if (btn == BUTTON1_PUSHED || key == 'S' || key == 's') {
-      move_cursor(0, -1);
-    }
-    // move up
-    if (btn == BUTTON2_PUSHED || key == 'W' || key == 'w') {
-      move_cursor(0, 1);
-    }
-    // move left
-    if (btn == BUTTON3_PUSHED || key == 'A' || key == 'a') {
-      move_cursor(-1, 0);
+void place_fleet(void) {
+  move_terminal_cursor(10, 4);
+  printf_P(PSTR("Place your fleet: move each ship with the buttons or "
+                "WASD, 'r' to turn it, 'f' to put it down"));
+  move_terminal_cursor(10, 5);
+  printf_P(PSTR("'x' places the rest at random, 'l' keeps the %S layout"),
+           fleet_name(selected_fleet(&game)));
+
+  // the ship being placed blinks like the cursor does in the game, and
+  // starts where the chosen layout has it
+  placement_start(game.human_grid, selected_fleet(&game));
+  uint8_t flash_timer =
+      swtimer_start(CURSOR_FLASH_MS, CURSOR_FLASH_MS, placement_flash);
+  Event event;
+  while (!placement_done()) {
+    event_wait(&event);
+    switch (event_action(&event, placement_keymap)) {
+      case ACTION_MOVE_RIGHT:
+        placement_move(1, 0);
+        break;
+      case ACTION_MOVE_DOWN:
+        placement_move(0, -1);
+        break;
+      case ACTION_MOVE_UP:
+        placement_move(0, 1);
+        break;
+      case ACTION_MOVE_LEFT:
+        placement_move(-1, 0);
+        break;
+      case ACTION_ROTATE:
+        placement_rotate();
+        break;
+      case ACTION_FIRE:
+        // "\x1b[K" clears the rest of the line, as clear_to_end_of_line() does
+        log_at_P(LOG_INFO, 10, 7,
+                 placement_place() ? PSTR("\x1b[K")
+                                   : PSTR("Ships can't overlap or touch\x1b[K"));
+        break;
+      case ACTION_RANDOM_FLEET:
+        // how long the human took is as good a seed as any
+        srand(get_current_time());
+        placement_random();
+        break;
+      case ACTION_KEEP_LAYOUT:
+        placement_layout(selected_fleet(&game));
+        break;
     }
-    if (key == 'F' || key == 'f') {
-      player_turn();
+  }
+  swtimer_cancel(flash_timer);
+  use_placed_fleet(&game);
+}
+
+void play_game(void) {
+  // flash the cursor from a timer, which runs while we wait for events
+  uint8_t flash_timer =
+      swtimer_start(CURSOR_FLASH_MS, CURSOR_FLASH_MS, flash_game_cursor);
+
+  // and let the computer think about its move while we wait (unless the
+  // other player is another board)
+  if (selected_mode(&game) != MODE_LINK) {
+    events_set_idle(think_about_move);
+  }
+
+  // We play the game until it's over, handling one event at a time
+  // (buttons and serial input both come through the event queue, see
+  // events.h, and game_keymap in keymap.c says what each one does). In
+  // link play the other board's shots and results come through it too.
+  Event event;
+  while (!is_game_over(&game)) {
+    event_wait(&event);
+    if (event.source == EVENT_LINK) {
+      handle_link_event(&game, event.key);
+      continue;
     }
-    current_time = get_current_time();
-    if (current_time >= last_flash_time + 200) {
-      // 200ms (0.2 second) has passed since the last time we advance the
-      // notes here, so update the advance the notes
-      flash_cursor();
-
-      // Update the most recent time the notes were advance
-      last_flash_time = current_time;
+    switch (event_action(&event, game_keymap)) {
+      case ACTION_MOVE_RIGHT:
+        move_cursor(&game, 1, 0);
+        break;
+      case ACTION_MOVE_DOWN:
+        move_cursor(&game, 0, -1);
+        break;
+      case ACTION_MOVE_UP:
+        move_cursor(&game, 0, 1);
+        break;
+      case ACTION_MOVE_LEFT:
+        move_cursor(&game, -1, 0);
+        break;
+      case ACTION_FIRE:
+        player_turn(&game);
+        break;
+      // report SRAM usage and the stack high-water mark, how much the AI
+      // searched, the link round trip times and errors, the messages
+      // dropped, and the interrupt handler cycle counts in an ISR_PROFILE
+      // build, in the battle log. This report and 'h' wait for room in the
+      // output buffer rather than drop lines, so they hold the game up while
+      // they are sent (see log.h)
+      case ACTION_SRAM_REPORT:
+        move_terminal_cursor(0, BATTLE_LOG_BOTTOM);
+        sram_report();
+        computer_report(&game);
+        link_report();
+        log_report();
+        isr_profile_report();
+        break;
+      // report the serial port and SPI counters, to tell whether the
+      // terminal or the CPU is holding the game up
+      case ACTION_HEALTH_REPORT:
+        move_terminal_cursor(0, BATTLE_LOG_BOTTOM);
+        serial_report();
+        spi_report();
+        break;
     }
   }
+  swtimer_cancel(flash_timer);
+  events_set_idle(0);
   // We get here if the game is over.
-  move_terminal_cursor(0, 3);
-  printf("Game over!");
+  log_at_P(LOG_CRITICAL, 0, 3, PSTR("Game over!"));
 }
 
 void handle_game_over() {
+  enable_scrolling_for_whole_display();
   move_terminal_cursor(10, 14);
   printf_P(PSTR("GAME OVER"));
   move_terminal_cursor(10, 15);
   printf_P(PSTR("Press a button or 's'/'S' to start a new game"));
 
-  // Do nothing until a button is pushed. Hint: 's'/'S' should also start a
-  // new game
-  while (button_pushed() == NO_BUTTON_PUSHED) {
-    ;  // wait
-  }
+  // Do nothing until a button or 's'/'S' is pushed
+  Event event;
+  do {
+    event_wait(&event);
+  } while (event_action(&event, start_keymap) != ACTION_START);
 }
+
+// Software timer callback for the game: flash the cursor
+void flash_game_cursor(void) { flash_cursor(&game); }
+
+// Idle callback for the game (see events_set_idle() in events.h)
+uint8_t think_about_move(void) { return computer_think(&game); }
@@ -21,13 +21,18 @@
  */
 
 #include "serialio.h"
+#include <avr/pgmspace.h>
 #include <stdio.h>
 #include <stdint.h>
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "bottomhalf.h"
+#include "events.h"
+#include "hal.h"
+#include "isrprofile.h"
+#include "timer1.h"
+#include "uart1.h"
 
 /* System clock rate in Hz. (L at the end indicates this is a long constant) */
-#define SYSCLK 8000000L
+#define SYSCLK HAL_SYSCLK
 
 /* Global variables */
 /* Circular buffer to hold outgoing characters. The insert_pos variable
@@ -53,24 +58,47 @@ volatile uint8_t bytes_in_out_buffer;
 volatile char input_buffer[INPUT_BUFFER_SIZE];
 volatile uint8_t input_insert_pos;
 volatile uint8_t bytes_in_input_buffer;
-volatile uint8_t input_overrun;
+volatile uint16_t input_overruns;
+
+/* Characters the USART lost because the receive interrupt was late */
+static volatile uint16_t usart_overruns;
 
 /* Variable to keep track of whether incoming characters are to be echoed
  * back or not.
  */
 static int8_t do_echo;
 
+/* Characters waiting to be echoed. The receive interrupt handler only
+ * captures them here; the BH_SERIAL_ECHO bottom half writes them to the
+ * output buffer. (Writing to the output buffer from the handler would
+ * mean waiting for space and turning interrupts on and off inside it.)
+ * Works on the same principle as the input buffer.
+ */
+#define ECHO_BUFFER_SIZE 8
+static volatile char echo_buffer[ECHO_BUFFER_SIZE];
+static volatile uint8_t echo_insert_pos;
+static volatile uint8_t bytes_in_echo_buffer;
+
+/* Variable to keep track of whether incoming characters are posted as
+ * events (see events.h) rather than kept for stdin.
+ */
+static volatile int8_t input_to_events;
+
+/* Counters for serial_report(), kept all the time. The cycles spent
+ * waiting for output buffer space are counted by the functions that wait,
+ * and the most characters ever waiting in it when they are added.
+ */
+static volatile uint32_t bytes_sent;
+static volatile uint32_t bytes_received;
+static uint32_t tx_stall_cycles;
+static uint8_t tx_peak;
+
 /* Function prototypes 
  */
 void init_serial_stdio(long baudrate, int8_t echo);
 static int uart_put_char(char, FILE*);
 static int uart_get_char(FILE*);
-
-/* Setup a stream that uses the uart get and put functions. We will
- * make standard input and output use this stream below.
- */
-static FILE myStream = FDEV_SETUP_STREAM(uart_put_char, uart_get_char,
-		_FDEV_SETUP_RW);
+static void echo_input(void);
 
 void init_serial_stdio(long baudrate, int8_t echo)
 {
@@ -82,12 +110,17 @@ void init_serial_stdio(long baudrate, int8_t echo)
 	bytes_in_out_buffer = 0;
 	input_insert_pos = 0;
 	bytes_in_input_buffer = 0;
-	input_overrun = 0;
+	input_overruns = 0;
+	usart_overruns = 0;
+	input_to_events = 0;
+	echo_insert_pos = 0;
+	bytes_in_echo_buffer = 0;
 	
 	/*
 	 * Record whether we're going to echo characters or not
 	*/
 	do_echo = echo;
+	bh_register(BH_SERIAL_ECHO, echo_input);
 	
 	/* Configure the serial port baud rate */
 	/* (This differs from the datasheet formula so that we get 
@@ -95,28 +128,21 @@ void init_serial_stdio(long baudrate, int8_t echo)
 	 * (which truncates)).
 	*/
 	ubrr = (((SYSCLK / (8 * baudrate)) + 1) / 2) - 1;
-	UBRR0 = ubrr;
 	
 	/*
-	 * Enable transmission and receiving via UART. We don't enable
-	 * the UDR empty interrupt here (we wait until we've got a
-	 * character to transmit).
+	 * Enable transmission and receiving via UART and the receive
+	 * complete interrupt. We don't enable the UDR empty interrupt
+	 * here (we wait until we've got a character to transmit).
 	 * NOTE: Interrupts must be enabled globally for this
 	 * library to work, but we do not do this here.
 	*/
-	UCSR0B = (1 << RXEN0) | (1 << TXEN0);
-	
-	/*
-	 * Enable receive complete interrupt 
-	*/
-	UCSR0B  |= (1 << RXCIE0);
+	hal_uart0_init(ubrr);
 
-	/* Set up our stream so the put and get functions below are used 
+	/* Set up a stream so the put and get functions below are used 
 	 * to write/read characters via the serial port when we use
 	 * stdio functions
 	*/
-	stdout = &myStream;
-	stdin = &myStream;
+	hal_stdio_attach(uart_put_char, uart_get_char);
 }
 
 int8_t serial_input_available(void)
@@ -124,6 +150,11 @@ int8_t serial_input_available(void)
 	return bytes_in_input_buffer != 0;
 }
 
+void serial_input_to_events(int8_t on)
+{
+	input_to_events = on;
+}
+
 void clear_serial_input_buffer(void)
 {
 	/* Just adjust our buffer data so it looks empty */
@@ -131,6 +162,25 @@ void clear_serial_input_buffer(void)
 	bytes_in_input_buffer = 0;
 }
 
+/* Add the cycles since *then to the time spent waiting to send, and
+ * start again from now. Called every time round a wait loop, so no single
+ * measurement is long enough for the cycle count to wrap around.
+ */
+static void count_stall(uint16_t* then)
+{
+	uint16_t now = get_cycle_count();
+	tx_stall_cycles += (uint32_t)(uint16_t)(now - *then) * CYCLES_PER_COUNT;
+	*then = now;
+}
+
+static void note_peak(void)
+{
+	if (bytes_in_out_buffer > tx_peak)
+	{
+		tx_peak = bytes_in_out_buffer;
+	}
+}
+
 static int uart_put_char(char c, FILE* stream)
 {
 	uint8_t interrupts_enabled;
@@ -152,14 +202,19 @@ static int uart_put_char(char c, FILE* stream)
 	 * enough space. The bytes_in_buffer variable will get modified by the
 	 * ISR which extracts bytes from the buffer.
 	*/
-	interrupts_enabled = bit_is_set(SREG, SREG_I);
-	while (bytes_in_out_buffer >= OUTPUT_BUFFER_SIZE)
+	interrupts_enabled = hal_irq_enabled();
+	if (bytes_in_out_buffer >= OUTPUT_BUFFER_SIZE)
 	{
 		if (!interrupts_enabled)
 		{
 			return 1;
-		}		
-		/* else do nothing */
+		}
+		uint16_t then = get_cycle_count();
+		while (bytes_in_out_buffer >= OUTPUT_BUFFER_SIZE)
+		{
+			hal_cpu_relax();
+			count_stall(&then);
+		}
 	}
 	
 	/* Add the character to the buffer for transmission if there
@@ -171,7 +226,7 @@ static int uart_put_char(char c, FILE* stream)
 	 * We reenable them if they were enabled when we entered the
 	 * function.
 	*/	
-	cli();
+	hal_irq_disable();
 	out_buffer[out_insert_pos++] = c;
 	bytes_in_out_buffer++;
 	if (out_insert_pos == OUTPUT_BUFFER_SIZE)
@@ -179,23 +234,101 @@ static int uart_put_char(char c, FILE* stream)
 		/* Wrap around buffer pointer if necessary */
 		out_insert_pos = 0;
 	}
+	note_peak();
 	/* Reenable interrupts (UDR Empty interrupt may have been
 	 * disabled) - we ensure it is now enabled so that it will
 	 * fire and deal with the next character in the buffer. */
-	UCSR0B |= (1 << UDRIE0);
-	if (interrupts_enabled)
+	hal_uart0_tx_irq_enable();
+	hal_irq_restore(interrupts_enabled);
+	return 0;
+}
+
+int8_t serial_try_write(const char* chars, uint8_t length, uint8_t keep_free)
+{
+	/* Work out the space needed first (one more for each \n), so that
+	 * nothing is queued unless all of it can be */
+	uint16_t needed = length + keep_free;
+	for (uint8_t i = 0; i < length; i++)
+	{
+		if (chars[i] == '\n')
+		{
+			needed++;
+		}
+	}
+	
+	uint8_t interrupts_enabled = hal_irq_save();
+	if (needed > OUTPUT_BUFFER_SIZE - bytes_in_out_buffer)
 	{
-		sei();
+		hal_irq_restore(interrupts_enabled);
+		return 1;
 	}
+	for (uint8_t i = 0; i < length; i++)
+	{
+		if (chars[i] == '\n')
+		{
+			out_buffer[out_insert_pos++] = '\r';
+			if (out_insert_pos == OUTPUT_BUFFER_SIZE)
+			{
+				out_insert_pos = 0;
+			}
+		}
+		out_buffer[out_insert_pos++] = chars[i];
+		if (out_insert_pos == OUTPUT_BUFFER_SIZE)
+		{
+			out_insert_pos = 0;
+		}
+	}
+	bytes_in_out_buffer += needed - keep_free;
+	note_peak();
+	hal_uart0_tx_irq_enable();
+	hal_irq_restore(interrupts_enabled);
 	return 0;
 }
 
+int8_t serial_write(const char* chars, uint8_t length)
+{
+	if (serial_try_write(chars, length, 0) == 0)
+	{
+		return 0;
+	}
+	if (!hal_irq_enabled())
+	{
+		return 1;
+	}
+	uint16_t then = get_cycle_count();
+	while (serial_try_write(chars, length, 0))
+	{
+		hal_cpu_relax();
+		count_stall(&then);
+	}
+	return 0;
+}
+
+void serial_report(void)
+{
+	/* Copy with interrupts off, the handlers update these */
+	uint8_t interrupts_were_enabled = hal_irq_save();
+	uint32_t sent = bytes_sent;
+	uint32_t received = bytes_received;
+	uint16_t overruns = input_overruns;
+	uint16_t lost_by_usart = usart_overruns;
+	hal_irq_restore(interrupts_were_enabled);
+	
+	printf_P(PSTR("Serial: %lu bytes sent, %lu received, %lu cycles stalled, "
+			"peak %u/%u\n"),
+			(unsigned long)sent, (unsigned long)received,
+			(unsigned long)tx_stall_cycles, tx_peak, OUTPUT_BUFFER_SIZE);
+	printf_P(PSTR("Overruns: %u input buffer, %u event queue, %u USART0, "
+			"%u link\n"), overruns, events_dropped(), lost_by_usart,
+			uart1_overruns());
+}
+
 int uart_get_char(FILE* stream)
 {
 	/* Wait until we've received a character */
 	while (bytes_in_input_buffer == 0)
 	{
-		/* do nothing */
+		hal_cpu_relax();
 	}
 	
 	/*
@@ -205,8 +338,7 @@ int uart_get_char(FILE* stream)
 	 * characters before the insert position (taking into account
 	 * that we may need to wrap around).
 	 */
-	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
-	cli();
+	uint8_t interrupts_enabled = hal_irq_save();
 	char c;
 	if (input_insert_pos - bytes_in_input_buffer < 0)
 	{
@@ -220,19 +352,43 @@ int uart_get_char(FILE* stream)
 	
 	/* Decrement our count of bytes in the input buffer */
 	bytes_in_input_buffer--;
-	if (interrupts_enabled)
-	{
-		sei();
-	}	
+	hal_irq_restore(interrupts_enabled);
 	return c;
 }
 
+/*
+ * Bottom half: echo the characters captured by the receive interrupt
+ * handler. Runs in the main loop, so it can wait for output buffer space.
+ */
+static void echo_input(void)
+{
+	while (bytes_in_echo_buffer > 0)
+	{
+		/* The oldest character is bytes_in_echo_buffer characters before
+		 * the insert position, wrapping around if necessary */
+		uint8_t interrupts_enabled = hal_irq_save();
+		int8_t pos = echo_insert_pos - bytes_in_echo_buffer;
+		if (pos < 0)
+		{
+			pos += ECHO_BUFFER_SIZE;
+		}
+		char c = echo_buffer[pos];
+		bytes_in_echo_buffer--;
+		hal_irq_restore(interrupts_enabled);
+		
+		uart_put_char(c, 0);
+	}
+}
+
 /*
  * Define the interrupt handler for UART Data Register Empty (i.e. 
  * another character can be taken from our buffer and written out)
  */
+/* Bounded: no loops. Budget 70 cycles (see isrprofile.h). */
 ISR(USART0_UDRE_vect) 
 {
+	ISR_PROFILE_BEGIN();
+	
 	/* Check if we have data in our buffer */
 	if (bytes_in_out_buffer > 0)
 	{
@@ -256,9 +412,10 @@ ISR(USART0_UDRE_vect)
 		 * buffer 
 		 */
 		bytes_in_out_buffer--;
+		bytes_sent++;
 		
 		/* Output the character via the UART */
-		UDR0 = c;
+		hal_uart0_write(c);
 	} else
 	{
 		/* No data in the buffer. We disable the UART Data
@@ -267,51 +424,76 @@ ISR(USART0_UDRE_vect)
 		 * The interrupt is reenabled when a character is
 		 * placed in the buffer.
 		 */
-		UCSR0B &= ~(1 << UDRIE0);
+		hal_uart0_tx_irq_disable();
 	}
+	
+	ISR_PROFILE_END(ISR_USART0_UDRE);
 }
 
 /*
  * Define the interrupt handler for UART Receive Complete (i.e. 
  * we can read a character. The character is read and placed in
- * the input buffer.
+ * the input buffer, or posted as an event.
+ * Bounded: no loops, and echoing is left to a bottom half. Budget 200
+ * cycles (see isrprofile.h).
  */
 
 ISR(USART0_RX_vect) 
 {
-	/* Read the character - we ignore the possibility of overrun. */
+	ISR_PROFILE_BEGIN();
+	
+	/* Count a character lost before this one, then read it */
+	if (hal_uart0_overrun() && usart_overruns < UINT16_MAX)
+	{
+		usart_overruns++;
+	}
 	char c;
-	c = UDR0;
+	c = hal_uart0_read();
+	bytes_received++;
 		
-	if (do_echo && bytes_in_out_buffer < OUTPUT_BUFFER_SIZE)
+	if (do_echo && bytes_in_echo_buffer < ECHO_BUFFER_SIZE)
 	{
-		/* If echoing is enabled and there is output buffer
-		 * space, echo the received character back to the UART.
-		 * (If there is no output buffer space, characters
-		 * will be lost.)
+		/* If echoing is enabled and there is echo buffer
+		 * space, keep the character for the echo bottom half.
+		 * (If there is no space, characters will not be echoed.)
 		 */
-		uart_put_char(c, 0);
+		echo_buffer[echo_insert_pos++] = c;
+		bytes_in_echo_buffer++;
+		if (echo_insert_pos == ECHO_BUFFER_SIZE)
+		{
+			echo_insert_pos = 0;
+		}
+		bh_schedule(BH_SERIAL_ECHO);
+	}
+	
+	/* If the character is a carriage return, turn it into a
+	 * linefeed 
+	*/
+	if (c == '\r')
+	{
+		c = '\n';
+	}
+	
+	/* Hand the character to the event queue if asked to */
+	if (input_to_events)
+	{
+		event_post(EVENT_SERIAL, c);
+		ISR_PROFILE_END(ISR_USART0_RX);
+		return;
 	}
 	
 	/* 
-	 * Check if we have space in our buffer. If not, set the overrun
-	 * flag and throw away the character. (We never clear the 
-	 * overrun flag - it's up to the programmer to check/clear
-	 * this flag if desired.)
+	 * Check if we have space in our buffer. If not, count the
+	 * overrun (see serial_report()) and throw away the character.
 	 */
 	if (bytes_in_input_buffer >= INPUT_BUFFER_SIZE)
 	{
-		input_overrun = 1;
-	} else
-	{
-		/* If the character is a carriage return, turn it into a
-		 * linefeed 
-		*/
-		if (c == '\r')
+		if (input_overruns < UINT16_MAX)
 		{
-			c = '\n';
+			input_overruns++;
 		}
-		
+	} else
+	{
 		/* 
 		 * There is room in the input buffer 
 		 */
@@ -323,4 +505,6 @@ ISR(USART0_RX_vect)
 			input_insert_pos = 0;
 		}
 	}
+	
+	ISR_PROFILE_END(ISR_USART0_RX);
 }
@@ -31,6 +31,37 @@ void init_serial_stdio(long baudrate, int8_t echo);
  */
 int8_t serial_input_available(void);
 
+/* Post characters received from now on as EVENT_SERIAL events (see
+ * events.h) instead of keeping them to be read from stdin (on non-zero),
+ * or go back to stdin (on zero). Off after init_serial_stdio().
+ */
+void serial_input_to_events(int8_t on);
+
+/* Queue length characters for output all at once, without waiting: if
+ * they (with a \r added before each \n, as stdio output has) would leave
+ * fewer than keep_free bytes of the output buffer free, none of them are
+ * queued. Return 0 if they were queued, non-zero if not. Can be called
+ * with interrupts on or off.
+ */
+int8_t serial_try_write(const char* chars, uint8_t length, uint8_t keep_free);
+
+/* Queue length characters for output all at once, as serial_try_write()
+ * with nothing kept free, waiting for room if there isn't any (unless
+ * interrupts are off, when nothing is queued). Return 0 if they were
+ * queued, non-zero if not.
+ */
+int8_t serial_write(const char* chars, uint8_t length);
+
+/* Print the bytes sent and received, the CPU cycles spent waiting for room
+ * in the output buffer and the most characters that have been waiting in
+ * it, all since init_serial_stdio(). Then the input lost: characters
+ * dropped because the input buffer was full, events (of any source)
+ * dropped because the event queue was full (see events.h), characters the
+ * USART lost because the receive interrupt came too late, and link bytes
+ * dropped by USART1 (see uart1.h).
+ */
+void serial_report(void);
+
 /* Discard any input waiting to be read from the serial port. (Characters may
  * have been typed when we didn't want them - clear them.
  */
@@ -5,69 +5,46 @@
  */ 
 
 #include "spi.h"
-#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stdio.h>
+#include "hal.h"
+
+// Bytes sent, and the cycles spent busy waiting for them. Each transfer
+// takes 8 cycles of the divided clock from the write to the end of the
+// wait, so the wait is counted from the divider rather than timed (timing
+// it would take about as long as a transfer at the fastest clock).
+static uint16_t cycles_per_byte;
+static uint32_t bytes_sent;
+static uint32_t busy_cycles;
+static uint32_t pause_cycles;
 
 void spi_setup_master(uint8_t clockdivider)
 {
-	// Set up SPI communication as a master
-	// Make the SS, MOSI and SCK pins outputs. These are pins
-	// 4, 5 and 7 of port B on the ATmega324A
-	DDRB |= (1 << DDB7) | (1 << DDB5) | (1 << DDB4);
-	
-	// Set the slave select (SS) line high
-	PORTB |= (1 << PORTB4);
-	
-	// Set up the SPI control registers SPCR and SPSR:
-	// - SPE bit = 1 (SPI is enabled)
-	// - MSTR bit = 1 (Master Mode)
-	SPCR0 = (1 << SPE0) | (1 << MSTR0);
-	
-	// Set SPR0 and SPR1 bits in SPCR and SPI2X bit in SPSR
-	// based on the given clock divider
-	// Invalid values default to the slowest speed
-	// We consider each bit in turn
-	switch (clockdivider)
-	{
-		case 2: /* FALLTHROUGH */
-		case 8: /* FALLTHROUGH */
-		case 32:
-			SPSR0 = (1 << SPI2X0);
-			break;
-		default:
-			SPSR0 = 0;
-			break;
-	}
-	switch (clockdivider)
-	{
-		case 128:
-			SPCR0 |= (1 << SPR00);
-			/* FALLTHROUGH */
-		case 32: /* FALLTHROUGH */
-		case 64:
-			SPCR0 |= (1 << SPR10);
-			break;
-		case 8: /* FALLTHROUGH */
-		case 16:
-			SPCR0 |= (1 << SPR00);
-			break;
-	}
-	
-	// Take SS (slave select) line low
-	PORTB &= ~(1 << PORTB4);
+	// Set up SPI communication as a master. The pin and control
+	// register setup is in the HAL (hal_spi_init()).
+	hal_spi_init(clockdivider);
+	cycles_per_byte = 8 * (uint16_t)clockdivider;
 }
 
 uint8_t spi_send_byte(uint8_t byte)
 {
-	// Write out the byte to the SPDR0 register. This will initiate
-	// the transfer. We then wait until the most significant byte of
-	// SPSR0 (SPIF0 bit) is set - this indicates that the transfer is
-	// complete. (The final read of SPSR0 followed by a read of SPDR0
-	// will cause the SPIF bit to be reset to 0. See page 173 of the 
-	// ATmega324A datasheet.)
-	SPDR0 = byte;
-	while ((SPSR0 & (1 << SPIF0)) == 0)
-	{
-		; // wait
-	}
-	return SPDR0;
+	bytes_sent++;
+	busy_cycles += cycles_per_byte;
+	
+	// Write out the byte and wait until the transfer is complete
+	return hal_spi_transfer(byte);
+}
+
+void spi_pause(uint16_t cycles)
+{
+	busy_cycles += cycles;
+	pause_cycles += cycles;
+	hal_spi_pause(cycles);
+}
+
+void spi_report(void)
+{
+	printf_P(PSTR("SPI: %lu bytes sent, %lu cycles busy waiting "
+			"(%lu paused)\n"), (unsigned long)bytes_sent,
+			(unsigned long)busy_cycles, (unsigned long)pause_cycles);
 }
@@ -17,4 +17,12 @@ void spi_setup_master(uint8_t clockdivider);
 // cyles of the divided clock (i.e. will busy wait).
 uint8_t spi_send_byte(uint8_t byte);
 
+// Busy wait for about the given number of CPU cycles before the next
+// byte, for a slave that can't keep up with the clock.
+void spi_pause(uint16_t cycles);
+
+// Print the bytes sent and the CPU cycles spent busy waiting for them,
+// pauses included, since the start
+void spi_report(void);
+
 #endif /* SPI_H_ */
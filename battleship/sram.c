@@ -0,0 +1,83 @@
+/*
+ * sram.c
+ *
+ * Author: Andrew Wilson
+ *
+ * See sram.h for a description of the stack painting scheme.
+ */
+
+#include "sram.h"
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Symbols provided by the linker script. _end is the first byte after
+// .noinit, i.e. where the heap would start. __brkval is maintained by
+// malloc and is 0 until malloc is first called.
+extern uint8_t __data_start;
+extern uint8_t __data_end;
+extern uint8_t __bss_start;
+extern uint8_t __bss_end;
+extern uint8_t _end;
+extern char* __brkval;
+
+// Paint the free region. This is placed in .init1 so it runs straight
+// after reset, before the stack pointer is set up and before .data and
+// .bss are initialised. It must therefore be naked, make no calls and not
+// rely on r1 being zero, so it is written in assembly.
+void sram_paint(void) __attribute__((naked, used, section(".init1")));
+
+void sram_paint(void) {
+  __asm__ volatile(
+      "    ldi r30, lo8(_end)          \n"
+      "    ldi r31, hi8(_end)          \n"
+      "    ldi r24, %[canary]          \n"
+      "    ldi r25, hi8(%[ramend] + 1) \n"
+      "    rjmp 2f                     \n"
+      "1:  st Z+, r24                  \n"
+      "2:  cpi r30, lo8(%[ramend] + 1) \n"
+      "    cpc r31, r25                \n"
+      "    brlo 1b                     \n"
+      :
+      : [canary] "M"(SRAM_CANARY), [ramend] "i"(RAMEND));
+}
+
+// Lowest address the stack is allowed to reach
+static uint8_t* free_region_start(void) {
+  return __brkval ? (uint8_t*)__brkval : &_end;
+}
+
+uint16_t sram_data_size(void) { return &__data_end - &__data_start; }
+
+uint16_t sram_bss_size(void) { return &__bss_end - &__bss_start; }
+
+uint16_t sram_free_now(void) {
+  return (uint8_t*)SP - free_region_start();
+}
+
+uint16_t sram_never_used(void) {
+  // Walk up from the bottom of the free region until we find a byte the
+  // stack has overwritten. (If the deepest stack byte happens to equal the
+  // canary we under-report the peak by a byte or so - that's fine for a
+  // high-water mark.)
+  uint8_t* p = free_region_start();
+  uint16_t untouched = 0;
+  while (p <= (uint8_t*)RAMEND && *p == SRAM_CANARY) {
+    p++;
+    untouched++;
+  }
+  return untouched;
+}
+
+uint16_t sram_stack_peak(void) {
+  uint16_t region = (uint8_t*)RAMEND + 1 - free_region_start();
+  return region - sram_never_used();
+}
+
+void sram_report(void) {
+  printf_P(PSTR("SRAM: data %u bss %u free %u peak stack %u unused %u"),
+           sram_data_size(), sram_bss_size(), sram_free_now(),
+           sram_stack_peak(), sram_never_used());
+}
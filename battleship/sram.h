@@ -0,0 +1,45 @@
+/*
+ * sram.h
+ *
+ * Author: Andrew Wilson
+ *
+ * SRAM usage measurement. Before .data and .bss are initialised, the
+ * free region between the end of static data (_end) and the top of SRAM
+ * is painted with SRAM_CANARY. The stack grows down into this region, so
+ * the lowest address that no longer holds the canary is the deepest the
+ * stack has ever reached (its high-water mark).
+ *
+ * The static footprint of each module is not known at runtime; see
+ * tools/sram_report.py which breaks it down per object file from
+ * battleship.map and checks it against the budget in tools/sram_budget.cfg.
+ */
+
+#ifndef SRAM_H_
+#define SRAM_H_
+
+#include <stdint.h>
+
+// Byte written over the free region at reset. Chosen to be an unlikely
+// value for a return address or a small loop counter.
+#define SRAM_CANARY 0xC5
+
+// Size in bytes of the initialised (.data) and zeroed (.bss) static data
+uint16_t sram_data_size(void);
+uint16_t sram_bss_size(void);
+
+// Bytes currently free between the end of static data (or the heap, if
+// malloc has been used) and the stack pointer
+uint16_t sram_free_now(void);
+
+// Deepest stack usage in bytes since reset
+uint16_t sram_stack_peak(void);
+
+// Bytes of the free region that have never been touched since reset, i.e.
+// the margin left before the stack would collide with static data
+uint16_t sram_never_used(void);
+
+// Print a one line summary of the figures above at the current terminal
+// cursor position
+void sram_report(void);
+
+#endif /* SRAM_H_ */
@@ -0,0 +1,302 @@
+/*
+ * swtimer.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Software timer wheel - see swtimer.h.
+ */
+
+#include "swtimer.h"
+#include "bottomhalf.h"
+#include "hal.h"
+#include "timer0.h"
+#include "timer1.h"
+
+/* Number of buckets in the wheel; must be a power of 2 */
+#define WHEEL_SIZE 16
+
+/* Timer states */
+#define TIMER_FREE 0
+#define TIMER_RUNNING 1	/* in a bucket of the wheel */
+#define TIMER_FIRED 2	/* a one-shot timer waiting for its callback */
+
+typedef struct {
+	/* Low 16 bits of the time it expires */
+	uint16_t expires;
+	uint16_t period;
+	SwTimerCallback callback;
+	uint8_t state;
+	/* Bucket (or free list) links; SWTIMER_NONE ends a list */
+	uint8_t next;
+	uint8_t prev;
+} SwTimer;
+
+static SwTimer timers[SWTIMER_COUNT];
+static uint8_t wheel[WHEEL_SIZE];
+static uint8_t free_timers;
+
+/* Bit n is set while the callback of timer n is waiting to be run. Bits
+ * are only cleared with interrupts off. */
+static volatile uint8_t expired;
+
+/* Low 16 bits of the last time the wheel was turned to */
+static uint16_t wheel_time;
+
+#ifdef TICKLESS
+/* The expiry timer 1 has been set for, and whether it has been */
+static uint16_t deadline;
+static uint8_t deadline_set;
+#endif
+
+static void run_expired(void);
+
+void init_swtimers(void)
+{
+	for (uint8_t i = 0; i < SWTIMER_COUNT; i++)
+	{
+		timers[i].state = TIMER_FREE;
+		timers[i].next = i + 1 < SWTIMER_COUNT ? i + 1 : SWTIMER_NONE;
+	}
+	free_timers = 0;
+	for (uint8_t i = 0; i < WHEEL_SIZE; i++)
+	{
+		wheel[i] = SWTIMER_NONE;
+	}
+	expired = 0;
+	wheel_time = (uint16_t)get_current_time();
+#ifdef TICKLESS
+	deadline_set = 0;
+#endif
+	bh_register(BH_TIMERS, run_expired);
+}
+
+/* Put a timer in the bucket for when it expires. Interrupts must be off
+ * for this and for unlink(). */
+static void link(uint8_t timer)
+{
+	uint8_t* bucket = &wheel[timers[timer].expires & (WHEEL_SIZE - 1)];
+	timers[timer].prev = SWTIMER_NONE;
+	timers[timer].next = *bucket;
+	if (*bucket != SWTIMER_NONE)
+	{
+		timers[*bucket].prev = timer;
+	}
+	*bucket = timer;
+}
+
+static void unlink(uint8_t timer)
+{
+	uint8_t next = timers[timer].next;
+	uint8_t prev = timers[timer].prev;
+	if (prev == SWTIMER_NONE)
+	{
+		wheel[timers[timer].expires & (WHEEL_SIZE - 1)] = next;
+	} else
+	{
+		timers[prev].next = next;
+	}
+	if (next != SWTIMER_NONE)
+	{
+		timers[next].prev = prev;
+	}
+}
+
+static void free_timer(uint8_t timer)
+{
+	timers[timer].state = TIMER_FREE;
+	timers[timer].next = free_timers;
+	free_timers = timer;
+}
+
+/* Expire the timers in the bucket for time now that are due. A bucket
+ * holds at most SWTIMER_COUNT timers, so this is bounded. */
+static void expire_bucket(uint16_t now)
+{
+	uint8_t timer = wheel[now & (WHEEL_SIZE - 1)];
+	while (timer != SWTIMER_NONE)
+	{
+		SwTimer* t = &timers[timer];
+		uint8_t next = t->next;
+		if ((int16_t)(t->expires - now) <= 0)
+		{
+			unlink(timer);
+			expired |= 1 << timer;
+			if (t->period)
+			{
+				/* Keep to the period, unless we've fallen more than a
+				 * period behind */
+				t->expires += t->period;
+				if ((int16_t)(t->expires - now) <= 0)
+				{
+					t->expires = now + t->period;
+				}
+				link(timer);
+			} else
+			{
+				t->state = TIMER_FIRED;
+			}
+		}
+		timer = next;
+	}
+}
+
+#ifdef TICKLESS
+
+/* Set timer 1 for the earliest expiry, or forget the deadline if no timer
+ * is running. Interrupts must be off. */
+static void set_deadline(uint32_t now)
+{
+	uint8_t found = 0;
+	uint16_t soonest = 0;
+	for (uint8_t i = 0; i < SWTIMER_COUNT; i++)
+	{
+		if (timers[i].state == TIMER_RUNNING)
+		{
+			uint16_t delay = timers[i].expires - (uint16_t)now;
+			if (!found || delay < soonest)
+			{
+				soonest = delay;
+				found = 1;
+			}
+		}
+	}
+	deadline_set = found;
+	if (found)
+	{
+		deadline = (uint16_t)now + soonest;
+		timer1_set_deadline(now + soonest);
+	} else
+	{
+		timer1_cancel_deadline();
+	}
+}
+
+void swtimer_deadline(void)
+{
+	uint32_t now = get_current_time();
+
+	/* Turn the wheel to now. After a whole turn every bucket has been
+	 * looked at, so that is as far as it needs to go. */
+	uint16_t behind = (uint16_t)now - wheel_time;
+	if (behind > WHEEL_SIZE)
+	{
+		behind = WHEEL_SIZE;
+	}
+	wheel_time = (uint16_t)now - behind;
+	while (behind--)
+	{
+		wheel_time++;
+		expire_bucket(wheel_time);
+	}
+
+	if (expired)
+	{
+		bh_schedule(BH_TIMERS);
+	}
+	set_deadline(now);
+}
+
+#else
+
+/* Bounded: one bucket of at most SWTIMER_COUNT timers (see timer0.c) */
+void swtimer_tick(void)
+{
+	wheel_time++;
+	if (wheel[wheel_time & (WHEEL_SIZE - 1)] == SWTIMER_NONE)
+	{
+		return;
+	}
+	expire_bucket(wheel_time);
+	if (expired)
+	{
+		bh_schedule(BH_TIMERS);
+	}
+}
+
+#endif /* TICKLESS */
+
+uint8_t swtimer_start(uint16_t delay_ms, uint16_t period_ms,
+		SwTimerCallback callback)
+{
+	if (delay_ms == 0)
+	{
+		delay_ms = 1;
+	}
+
+	uint8_t interrupts_were_enabled = hal_irq_save();
+	uint8_t timer = free_timers;
+	if (timer != SWTIMER_NONE)
+	{
+		free_timers = timers[timer].next;
+		SwTimer* t = &timers[timer];
+		t->period = period_ms;
+		t->callback = callback;
+		t->state = TIMER_RUNNING;
+#ifdef TICKLESS
+		/* The wheel is only turned at deadlines, so it may be behind */
+		uint32_t now = get_current_time();
+		t->expires = (uint16_t)now + delay_ms;
+		link(timer);
+		if (!deadline_set ||
+				(int16_t)(t->expires - deadline) < 0)
+		{
+			deadline = t->expires;
+			deadline_set = 1;
+			timer1_set_deadline(now + delay_ms);
+		}
+#else
+		t->expires = wheel_time + delay_ms;
+		link(timer);
+#endif
+	}
+	hal_irq_restore(interrupts_were_enabled);
+	return timer;
+}
+
+void swtimer_cancel(uint8_t timer)
+{
+	if (timer >= SWTIMER_COUNT)
+	{
+		return;
+	}
+
+	/* A cancelled timer is left in the tickless deadline; it just wakes
+	 * us for nothing */
+	uint8_t interrupts_were_enabled = hal_irq_save();
+	if (timers[timer].state == TIMER_RUNNING)
+	{
+		unlink(timer);
+	}
+	if (timers[timer].state != TIMER_FREE)
+	{
+		expired &= ~(1 << timer);
+		free_timer(timer);
+	}
+	hal_irq_restore(interrupts_were_enabled);
+}
+
+/* The bottom half. Each timer is checked with interrupts off, since an
+ * earlier callback may have cancelled it. */
+static void run_expired(void)
+{
+	for (uint8_t timer = 0; timer < SWTIMER_COUNT; timer++)
+	{
+		SwTimerCallback callback = 0;
+		uint8_t interrupts_were_enabled = hal_irq_save();
+		if (expired & (1 << timer))
+		{
+			expired &= ~(1 << timer);
+			callback = timers[timer].callback;
+			if (timers[timer].state == TIMER_FIRED)
+			{
+				free_timer(timer);
+			}
+		}
+		hal_irq_restore(interrupts_were_enabled);
+
+		if (callback)
+		{
+			callback();
+		}
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ * swtimer.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Software timers. A fixed pool of one-shot and periodic timers kept on a
+ * hashed timer wheel: each timer sits in the bucket for the low bits of
+ * the time it expires, so starting and cancelling one are O(1) and the
+ * timer 0 interrupt only looks at one bucket each millisecond. (In the
+ * tickless mode timer 1 is set for the earliest expiry instead, and the
+ * wheel catches up then.)
+ *
+ * The callbacks are run by a bottom half (see bottomhalf.h), so they run
+ * in the main loop with interrupts enabled and may do as much as any
+ * other main loop code. A periodic timer that expires again before its
+ * callback has run only has it run once.
+ */
+
+#ifndef SWTIMER_H_
+#define SWTIMER_H_
+
+#include <stdint.h>
+
+/* Size of the timer pool */
+#define SWTIMER_COUNT 8
+
+/* Returned by swtimer_start() when the pool is empty; cancelling it has
+ * no effect */
+#define SWTIMER_NONE 0xFF
+
+/* Longest delay or period in milliseconds */
+#define SWTIMER_MAX_MS 32767
+
+typedef void (*SwTimerCallback)(void);
+
+/* Empty the pool. It is assumed that global interrupts are off when this
+ * function is called.
+ */
+void init_swtimers(void);
+
+/* Run callback delay_ms milliseconds from now (at least 1) and then, if
+ * period_ms is not 0, every period_ms milliseconds after that. Returns
+ * the timer, to cancel it with, or SWTIMER_NONE if there is no timer free.
+ */
+uint8_t swtimer_start(uint16_t delay_ms, uint16_t period_ms,
+		SwTimerCallback callback);
+
+/* Stop timer and free it. Its callback isn't run again, even if it has
+ * expired and is waiting to be run. A one-shot timer is freed when its
+ * callback runs, so only cancel one that hasn't.
+ */
+void swtimer_cancel(uint8_t timer);
+
+#ifdef TICKLESS
+
+/* Expire the timers that are due and set the deadline for the next. Called
+ * from the timer 1 interrupt handler when the deadline has passed.
+ */
+void swtimer_deadline(void);
+
+#else
+
+/* Expire the timers due this millisecond. Called from the timer 0
+ * interrupt handler every millisecond.
+ */
+void swtimer_tick(void);
+
+#endif /* TICKLESS */
+
+#endif /* SWTIMER_H_ */
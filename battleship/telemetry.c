@@ -0,0 +1,59 @@
+/*
+ * telemetry.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Debug logs on USART1 - see telemetry.h.
+ */
+
+#include "telemetry.h"
+
+#include <avr/pgmspace.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "uart1.h"
+
+static uint16_t dropped;
+
+void telemetry_printf_P(const char* format, ...)
+{
+	/* Room for every '\n' to become "\r\n" */
+	char message[TELEMETRY_MESSAGE_SIZE * 2];
+	char* text = &message[TELEMETRY_MESSAGE_SIZE];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf_P(text, TELEMETRY_MESSAGE_SIZE, format, args);
+	va_end(args);
+	if (length < 0)
+	{
+		return;
+	}
+	if (length >= TELEMETRY_MESSAGE_SIZE)
+	{
+		length = TELEMETRY_MESSAGE_SIZE - 1;
+	}
+	
+	/* Translate into the front half of the buffer, which can't overtake
+	 * the text being read from the back half */
+	uint8_t sent = 0;
+	for (uint8_t i = 0; i < length; i++)
+	{
+		char c = text[i];
+		if (c == '\n')
+		{
+			message[sent++] = '\r';
+		}
+		message[sent++] = c;
+	}
+	
+	if (uart1_put_telemetry(message, sent) && dropped < UINT16_MAX)
+	{
+		dropped++;
+	}
+}
+
+uint16_t telemetry_dropped(void)
+{
+	return dropped;
+}
@@ -0,0 +1,37 @@
+/*
+ * telemetry.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Debug logs and traces on USART1, away from the game terminal on USART0.
+ * Messages go into a buffer of their own (see uart1.h), and a message that
+ * doesn't fit is dropped rather than waited for, so diagnostics never hold
+ * up the game or its terminal.
+ *
+ * Attach a terminal at TELEMETRY_BAUD to USART1 to read them. During link
+ * play (see link.h) USART1 is the link's, at its own baud rate, and
+ * messages are dropped rather than mixed in with the frames.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+/* Baud rate of the telemetry channel, the game terminal's, so the same
+ * settings read both */
+#define TELEMETRY_BAUD 19200
+
+/* Longest message, after formatting; the rest is cut off */
+#define TELEMETRY_MESSAGE_SIZE 64
+
+/* printf a message to the telemetry channel. The format is in program
+ * memory (use PSTR()). "\n" is sent as "\r\n".
+ */
+void telemetry_printf_P(const char* format, ...);
+
+/* Number of messages dropped because the buffer was full or the link had
+ * USART1 (saturates) */
+uint16_t telemetry_dropped(void);
+
+#endif /* TELEMETRY_H_ */
@@ -9,8 +9,29 @@
  */
 
 #include "timer0.h"
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "hal.h"
+#include "isrprofile.h"
+#include "swtimer.h"
+#include "timer1.h"
+
+#ifdef TICKLESS
+
+/* In the tickless mode timer 1 keeps the time (see timer1.c) and timer 0
+ * has no interrupt, so there is none every millisecond. It only runs to
+ * time the interrupt handlers (see isrprofile.h). */
+void init_timer0(void)
+{
+#ifdef ISR_PROFILE
+	hal_timer0_start_cycles();
+#endif
+}
+
+uint32_t get_current_time(void)
+{
+	return timer1_time_ms();
+}
+
+#else
 
 /* Our internal clock tick count - incremented every 
  * millisecond. Will overflow every ~49 days. */
@@ -31,29 +52,8 @@ void init_timer0(void)
 	 */
 	clock_ticks_ms = 0L;
 	
-	/* Clear the timer */
-	TCNT0 = 0;
-
-	/* Set the output compare value to be 124 */
-	OCR0A = 124;
-	
-	/* Set the timer to clear on compare match (CTC mode)
-	 * and to divide the clock by 64. This starts the timer
-	 * running.
-	 */
-	TCCR0A = (1 << WGM01);
-	TCCR0B = (1 << CS01) | (1 << CS00);
-
-	/* Enable an interrupt on output compare match. 
-	 * Note that interrupts have to be enabled globally
-	 * before the interrupts will fire.
-	 */
-	TIMSK0 |= (1 << OCIE0A);
-	
-	/* Make sure the interrupt flag is cleared by writing a 
-	 * 1 to it.
-	 */
-	TIFR0 = (1 << OCF0A);
+	/* Start the timer - see hal_timer0_start_1ms() */
+	hal_timer0_start_1ms();
 }
 
 uint32_t get_current_time(void)
@@ -65,18 +65,26 @@ uint32_t get_current_time(void)
 	 * of the value. Interrupts are re-enabled if they were
 	 * enabled at the start.
 	 */
-	uint8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
-	cli();
+	uint8_t interrupts_were_enabled = hal_irq_save();
 	return_value = clock_ticks_ms;
-	if (interrupts_were_enabled)
-	{
-		sei();
-	}
+	hal_irq_restore(interrupts_were_enabled);
 	return return_value;
 }
 
+/* Bounded: a 32 bit increment and one bucket of the software timer wheel,
+ * which is usually empty. Budget 80 cycles plus 40 for each timer in the
+ * bucket (see isrprofile.h). */
 ISR(TIMER0_COMPA_vect)
 {
+	ISR_PROFILE_BEGIN();
+	
 	/* Increment our clock tick count */
 	clock_ticks_ms++;
+	
+	/* Expire the software timers that are due */
+	swtimer_tick();
+	
+	ISR_PROFILE_END(ISR_TIMER0_COMPA);
 }
+
+#endif /* TICKLESS */
@@ -13,6 +13,9 @@
  * (Any tasks undertaken in the interrupt handler
  * should be kept short so that we don't run the 
  * risk of missing an interrupt in future.)
+ *
+ * If TICKLESS is defined, timer 0 isn't used and the time comes from
+ * timer 1 instead (see timer1.h).
  */
 
 #ifndef TIMER0_H_
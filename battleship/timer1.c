@@ -3,16 +3,139 @@
  *
  * Author: Peter Sutton
  *
- * timer 1 skeleton
+ * Timer 1 counts CPU cycles. It runs freely with no prescaler and wraps
+ * around every 65536 cycles (8.192ms at 8MHz), which is long enough to
+ * time anything short, such as an interrupt handler (see isrprofile.h).
+ *
+ * In the tickless mode (TICKLESS defined) timer 1 keeps the time instead
+ * of timer 0. It counts in units of 1024 cycles (128us) and the overflow
+ * interrupt extends the count to 32 bits, from which the time in
+ * milliseconds is worked out when it is asked for. The output compare
+ * interrupt is programmed for the next deadline, so the CPU is only woken
+ * when there is something to do.
  */
 
 #include "timer1.h"
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "swtimer.h"
+#include "hal.h"
+#include "isrprofile.h"
+
+#ifdef TICKLESS
+
+/* High 16 bits of the 32 bit count, the low 16 are TCNT1 */
+static volatile uint16_t overflows;
+
+/* The deadline (as a count) and whether there is one */
+static volatile uint32_t deadline;
+static volatile uint8_t deadline_set;
+
+/* Set up timer 1 to keep the time - see hal_timer1_start_ticks()
+ */
+void init_timer1(void)
+{
+	overflows = 0;
+	deadline_set = 0;
+	hal_timer1_start_ticks();
+}
+
+/* The 32 bit count. Must be called with interrupts off. If the timer has
+ * overflowed but the interrupt hasn't run yet, TCNT1 has wrapped around
+ * and overflows is one short. */
+static uint32_t count_now(void)
+{
+	uint16_t high = overflows;
+	uint16_t low = hal_timer1_count();
+	if (hal_timer1_overflowed() && low < 0x8000)
+	{
+		high++;
+	}
+	return ((uint32_t)high << 16) | low;
+}
+
+uint32_t timer1_time_ms(void)
+{
+	uint8_t interrupts_were_enabled = hal_irq_save();
+	uint32_t count = count_now();
+	hal_irq_restore(interrupts_were_enabled);
+	
+	/* Each count is 128us = 16/125ms. Split the multiplication so it
+	 * can't overflow. */
+	return (count / 125) * 16 + (count % 125) * 16 / 125;
+}
+
+void timer1_set_deadline(uint32_t time_ms)
+{
+	/* Round up to a whole count so we never wake early */
+	uint32_t count = (time_ms / 16) * 125 + ((time_ms % 16) * 125 + 15) / 16;
+	
+	uint8_t interrupts_were_enabled = hal_irq_save();
+	deadline = count;
+	deadline_set = 1;
+	
+	/* The compare only matches when the timer counts to the value, so a
+	 * deadline that has passed (or is about to) is set a little ahead */
+	uint32_t now = count_now();
+	if ((int32_t)(count - now) < 2)
+	{
+		count = now + 2;
+	}
+	hal_timer1_set_compare((uint16_t)count);
+	hal_irq_restore(interrupts_were_enabled);
+}
+
+void timer1_cancel_deadline(void)
+{
+	uint8_t interrupts_were_enabled = hal_irq_save();
+	deadline_set = 0;
+	hal_timer1_compare_irq_disable();
+	hal_irq_restore(interrupts_were_enabled);
+}
+
+/* Bounded: a 16 bit increment. Budget 20 cycles (see isrprofile.h). */
+ISR(TIMER1_OVF_vect)
+{
+	ISR_PROFILE_BEGIN();
+	overflows++;
+	ISR_PROFILE_END(ISR_TIMER1_OVF);
+}
 
-/* Set up timer 1
+/* The compare matches once every 65536 counts (8.4s), so a deadline
+ * further away than that is checked and left for a later match.
+ * Bounded: turning the timer wheel is at most WHEEL_SIZE buckets, and
+ * finding the next deadline looks at each software timer once. Budget
+ * 2500 cycles, most of it the 32 bit divisions that work out the time
+ * (see isrprofile.h). */
+ISR(TIMER1_COMPA_vect)
+{
+	ISR_PROFILE_BEGIN();
+	if (deadline_set && (int32_t)(deadline - count_now()) > 0)
+	{
+		ISR_PROFILE_END(ISR_TIMER1_COMPA);
+		return;
+	}
+	deadline_set = 0;
+	hal_timer1_compare_irq_disable();
+	swtimer_deadline();
+	ISR_PROFILE_END(ISR_TIMER1_COMPA);
+}
+
+#else
+
+/* Set up timer 1 to count CPU cycles - see hal_timer1_start_cycles()
  */
 void init_timer1(void)
 {
-	TCNT1 = 0;
+	hal_timer1_start_cycles();
+}
+
+#endif /* TICKLESS */
+
+uint16_t get_cycle_count(void)
+{
+	/* Interrupt handlers may read timer 1 as well (see isrprofile.h), so
+	 * make sure one can't run between reading the low and high bytes */
+	uint8_t interrupts_were_enabled = hal_irq_save();
+	uint16_t count = hal_timer1_count();
+	hal_irq_restore(interrupts_were_enabled);
+	return count;
 }
@@ -3,7 +3,8 @@
  *
  * Author: Peter Sutton
  *
- * timer 1 skeleton
+ * Timer 1 counts CPU cycles, or keeps the time and wakes the CPU for the
+ * next deadline in the tickless mode
  */
 
 #ifndef TIMER1_H_
@@ -11,9 +12,39 @@
 
 #include <stdint.h>
 
-/* Set up our timer 
+/* Start timer 1 counting CPU cycles (or keeping the time if TICKLESS is
+ * defined)
  */
 void init_timer1(void);
 
+/* Return the cycle count. It wraps around every 65536 counts, so subtract
+ * two counts (as uint16_t) to time something shorter than that. Each
+ * count is CYCLES_PER_COUNT cycles.
+ */
+uint16_t get_cycle_count(void);
+
+#ifdef TICKLESS
+#define CYCLES_PER_COUNT 1024
+#else
+#define CYCLES_PER_COUNT 1
+#endif
+
+#ifdef TICKLESS
+
+/* Return the time in milliseconds since init_timer1(). Wraps around
+ * after about 6 days.
+ */
+uint32_t timer1_time_ms(void);
+
+/* Call swtimer_deadline() (see swtimer.h) from the timer 1 interrupt when
+ * get_current_time() reaches time_ms (or very soon if it already has).
+ * There is one deadline; setting another replaces it.
+ */
+void timer1_set_deadline(uint32_t time_ms);
+
+/* Forget the deadline */
+void timer1_cancel_deadline(void);
+
+#endif /* TICKLESS */
 
 #endif /* TIMER1_H_ */
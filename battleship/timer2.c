@@ -3,16 +3,48 @@
  *
  * Author: Peter Sutton
  *
- * timer 2 skeleton
+ * We set up timer 2 to generate an interrupt every 4ms (BUTTON_SAMPLE_MS).
+ * Each interrupt samples the push buttons - see buttons.c.
+ * In the tickless mode (TICKLESS defined) the timer only runs while a
+ * button is down.
  */
 
 #include "timer2.h"
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "buttons.h"
+#include "hal.h"
+#include "isrprofile.h"
 
-/* Set up timer 2
+/* Set up timer 2 to generate an interrupt every 4ms. We divide the
+ * clock by 256 and count up to 124, i.e. an interrupt every 256 x 125
+ * clock cycles with an 8MHz clock - see hal_timer2_start_4ms().
  */
 void init_timer2(void)
 {
-	TCNT2 = 0;
+#ifndef TICKLESS
+	hal_timer2_start_4ms();
+#endif
+}
+
+void start_button_sampling(void)
+{
+	hal_timer2_start_4ms();
+}
+
+/* Bounded: sample_buttons() has no loops. Budget 150 cycles (see
+ * isrprofile.h). */
+ISR(TIMER2_COMPA_vect)
+{
+	ISR_PROFILE_BEGIN();
+#ifdef TICKLESS
+	// Stop when there is nothing left to debounce, and wait for a pin
+	// change to start again
+	if (!sample_buttons())
+	{
+		hal_timer2_stop();
+		hal_buttons_irq_enable();
+	}
+#else
+	sample_buttons();
+#endif
+	ISR_PROFILE_END(ISR_TIMER2_COMPA);
 }
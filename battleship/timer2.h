@@ -3,7 +3,8 @@
  *
  * Author: Peter Sutton
  *
- * timer 2 skeleton
+ * Timer 2 samples the push buttons every 4ms (only while a button is down
+ * in the tickless mode)
  */
 
 #ifndef TIMER2_H_
@@ -11,9 +12,18 @@
 
 #include <stdint.h>
 
-/* Set up our timer 
+/* Set up timer 2 to interrupt every 4ms and sample the buttons. It is
+ * assumed that global interrupts are off when this function is called
+ * and are enabled sometime after this function is called. In the
+ * tickless mode the timer is started by start_button_sampling() instead.
  */
 void init_timer2(void);
 
+/* Start sampling the buttons every 4ms. Called from the pin change
+ * interrupt handler in the tickless mode; the timer 2 interrupt handler
+ * stops it again.
+ */
+void start_button_sampling(void);
+
 
 #endif /* TIMER2_H_ */
@@ -0,0 +1,245 @@
+/*
+ * uart1.c
+ *
+ * Author: Andrew Wilson
+ *
+ * USART1 byte stream - see uart1.h.
+ */
+
+#include "uart1.h"
+#include "bottomhalf.h"
+#include "hal.h"
+#include "isrprofile.h"
+
+/* Circular buffers, as in serialio.c: the bytes waiting are the
+ * bytes_in_... bytes before the insert position, wrapping around. A link
+ * frame is at most 7 bytes, so these hold a few frames each way.
+ */
+#define OUTPUT_BUFFER_SIZE 32
+static volatile uint8_t out_buffer[OUTPUT_BUFFER_SIZE];
+static volatile uint8_t out_insert_pos;
+static volatile uint8_t bytes_in_out_buffer;
+
+/* Telemetry waiting to be sent. Messages are added whole, so
+ * bytes_in_telemetry_buffer is only ever added to with interrupts off.
+ * Only one of this and the above has bytes in it at a time. */
+#define TELEMETRY_BUFFER_SIZE 128
+static volatile char telemetry_buffer[TELEMETRY_BUFFER_SIZE];
+static volatile uint8_t telemetry_insert_pos;
+static volatile uint8_t bytes_in_telemetry_buffer;
+
+#define INPUT_BUFFER_SIZE 32
+static volatile uint8_t input_buffer[INPUT_BUFFER_SIZE];
+static volatile uint8_t input_insert_pos;
+static volatile uint8_t bytes_in_input_buffer;
+static volatile uint8_t input_overruns;
+
+/* UBRR1 for each use of the wire, whether the link has it, and whether
+ * anything has been sent since the baud rate was last set (until then the
+ * transmit complete flag means nothing) */
+static uint16_t link_ubrr;
+static uint16_t telemetry_ubrr;
+static volatile uint8_t link_has_wire;
+static uint8_t sent_since_baud_set;
+
+/* Rounded to the nearest, as in init_serial_stdio() */
+static uint16_t ubrr_for(long baudrate)
+{
+	return (((HAL_SYSCLK / (8 * baudrate)) + 1) / 2) - 1;
+}
+
+void init_uart1(long link_baudrate, long telemetry_baudrate)
+{
+	out_insert_pos = 0;
+	bytes_in_out_buffer = 0;
+	telemetry_insert_pos = 0;
+	bytes_in_telemetry_buffer = 0;
+	input_insert_pos = 0;
+	bytes_in_input_buffer = 0;
+	input_overruns = 0;
+	
+	link_ubrr = ubrr_for(link_baudrate);
+	telemetry_ubrr = ubrr_for(telemetry_baudrate);
+	link_has_wire = 0;
+	sent_since_baud_set = 0;
+	hal_uart1_init(telemetry_ubrr);
+}
+
+/* Wait for everything handed to USART1 to have left it, then change its
+ * baud rate. Changing it any earlier would garble the last byte. */
+static void set_baud_when_sent(uint16_t ubrr)
+{
+	if (sent_since_baud_set)
+	{
+		while (bytes_in_out_buffer > 0 || bytes_in_telemetry_buffer > 0
+				|| !hal_uart1_tx_done())
+		{
+			hal_cpu_relax();
+		}
+	}
+	hal_uart1_set_baud(ubrr);
+	sent_since_baud_set = 0;
+}
+
+void uart1_link_start(void)
+{
+	/* The telemetry waiting is dropped, so only the bytes already in the
+	 * USART are waited for */
+	uint8_t interrupts_enabled = hal_irq_save();
+	link_has_wire = 1;
+	bytes_in_telemetry_buffer = 0;
+	hal_irq_restore(interrupts_enabled);
+	set_baud_when_sent(link_ubrr);
+	
+	/* Anything received so far was at the wrong baud rate */
+	interrupts_enabled = hal_irq_save();
+	bytes_in_input_buffer = 0;
+	hal_irq_restore(interrupts_enabled);
+}
+
+void uart1_link_stop(void)
+{
+	/* uart1_put() drops from here on, so the link buffer only empties */
+	link_has_wire = 0;
+	set_baud_when_sent(telemetry_ubrr);
+}
+
+uint8_t uart1_put(uint8_t byte)
+{
+	if (!link_has_wire)
+	{
+		return 1;
+	}
+	
+	/* Wait for space if the data register empty interrupt can make it */
+	uint8_t interrupts_enabled = hal_irq_enabled();
+	while (bytes_in_out_buffer >= OUTPUT_BUFFER_SIZE)
+	{
+		if (!interrupts_enabled)
+		{
+			return 1;
+		}
+		hal_cpu_relax();
+	}
+	
+	hal_irq_disable();
+	out_buffer[out_insert_pos++] = byte;
+	bytes_in_out_buffer++;
+	if (out_insert_pos == OUTPUT_BUFFER_SIZE)
+	{
+		out_insert_pos = 0;
+	}
+	sent_since_baud_set = 1;
+	hal_uart1_tx_irq_enable();
+	hal_irq_restore(interrupts_enabled);
+	return 0;
+}
+
+uint8_t uart1_put_telemetry(const char* bytes, uint8_t length)
+{
+	uint8_t interrupts_enabled = hal_irq_save();
+	if (link_has_wire
+			|| length > TELEMETRY_BUFFER_SIZE - bytes_in_telemetry_buffer)
+	{
+		hal_irq_restore(interrupts_enabled);
+		return 1;
+	}
+	for (uint8_t i = 0; i < length; i++)
+	{
+		telemetry_buffer[telemetry_insert_pos++] = bytes[i];
+		if (telemetry_insert_pos == TELEMETRY_BUFFER_SIZE)
+		{
+			telemetry_insert_pos = 0;
+		}
+	}
+	bytes_in_telemetry_buffer += length;
+	sent_since_baud_set = 1;
+	hal_uart1_tx_irq_enable();
+	hal_irq_restore(interrupts_enabled);
+	return 0;
+}
+
+uint8_t uart1_get(uint8_t* byte)
+{
+	uint8_t interrupts_enabled = hal_irq_save();
+	if (bytes_in_input_buffer == 0)
+	{
+		hal_irq_restore(interrupts_enabled);
+		return 0;
+	}
+	int8_t pos = input_insert_pos - bytes_in_input_buffer;
+	if (pos < 0)
+	{
+		pos += INPUT_BUFFER_SIZE;
+	}
+	*byte = input_buffer[pos];
+	bytes_in_input_buffer--;
+	hal_irq_restore(interrupts_enabled);
+	return 1;
+}
+
+uint8_t uart1_overruns(void)
+{
+	return input_overruns;
+}
+
+/* Bounded: no loops. Budget 70 cycles (see isrprofile.h). */
+ISR(USART1_UDRE_vect)
+{
+	ISR_PROFILE_BEGIN();
+	
+	/* At most one of the buffers has anything in it */
+	if (bytes_in_out_buffer > 0)
+	{
+		int8_t pos = out_insert_pos - bytes_in_out_buffer;
+		if (pos < 0)
+		{
+			pos += OUTPUT_BUFFER_SIZE;
+		}
+		bytes_in_out_buffer--;
+		hal_uart1_write(out_buffer[pos]);
+	} else if (bytes_in_telemetry_buffer > 0)
+	{
+		int16_t pos = telemetry_insert_pos - bytes_in_telemetry_buffer;
+		if (pos < 0)
+		{
+			pos += TELEMETRY_BUFFER_SIZE;
+		}
+		bytes_in_telemetry_buffer--;
+		hal_uart1_write(telemetry_buffer[pos]);
+	} else
+	{
+		/* Nothing left to send - turn the interrupt off until
+		 * uart1_put() has something */
+		hal_uart1_tx_irq_disable();
+	}
+	
+	ISR_PROFILE_END(ISR_USART1_UDRE);
+}
+
+/* Bounded: no loops, the frames are decoded by the BH_LINK bottom half.
+ * Budget 80 cycles (see isrprofile.h). */
+ISR(USART1_RX_vect)
+{
+	ISR_PROFILE_BEGIN();
+	
+	uint8_t byte = hal_uart1_read();
+	if (bytes_in_input_buffer >= INPUT_BUFFER_SIZE)
+	{
+		if (input_overruns < UINT8_MAX)
+		{
+			input_overruns++;
+		}
+	} else
+	{
+		input_buffer[input_insert_pos++] = byte;
+		bytes_in_input_buffer++;
+		if (input_insert_pos == INPUT_BUFFER_SIZE)
+		{
+			input_insert_pos = 0;
+		}
+	}
+	bh_schedule(BH_LINK);
+	
+	ISR_PROFILE_END(ISR_USART1_RX);
+}
@@ -0,0 +1,64 @@
+/*
+ * uart1.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Interrupt driven byte stream on USART1, the link to another board (see
+ * link.h). It works like serialio.c without stdio: bytes to send are put
+ * in a circular buffer that the data register empty interrupt empties,
+ * and bytes received are kept in another until the BH_LINK bottom half
+ * (see bottomhalf.h), which the receive interrupt schedules, takes them.
+ * Nothing is translated or echoed.
+ *
+ * USART1 also carries telemetry (see telemetry.h), from a second output
+ * buffer that is never waited for, at a baud rate of its own. The two
+ * never share the wire: between uart1_link_start() and uart1_link_stop()
+ * it carries only link bytes at the link's baud rate and telemetry is
+ * dropped, and the rest of the time it carries only telemetry, so the
+ * board on the other end never sees a byte that isn't part of a frame.
+ */
+
+#ifndef UART1_H_
+#define UART1_H_
+
+#include <stdint.h>
+
+/* Empty the buffers and start USART1 carrying telemetry at
+ * telemetry_baudrate. It is assumed that global interrupts are off when
+ * this function is called.
+ */
+void init_uart1(long link_baudrate, long telemetry_baudrate);
+
+/* Hand the wire to the link: drop any telemetry waiting, wait for the
+ * byte being sent to finish (at most two bytes' time) and switch to
+ * link_baudrate. Bytes received before this are dropped too.
+ */
+void uart1_link_start(void);
+
+/* Hand the wire back to telemetry once the link bytes waiting have been
+ * sent, which is waited for (at most the buffer's worth, about 8ms at
+ * 38400 baud). Interrupts must be enabled.
+ */
+void uart1_link_stop(void);
+
+/* Add a link byte to be sent. If the buffer is full this waits for space
+ * if interrupts are enabled, or drops the byte and returns 1 if not. The
+ * byte is dropped too, and 1 returned, outside uart1_link_start() and
+ * uart1_link_stop(). Returns 0 once the byte is in the buffer.
+ */
+uint8_t uart1_put(uint8_t byte);
+
+/* Add length bytes of telemetry to be sent. Never waits: if the link has
+ * the wire, or they don't all fit in the buffer, none of them are added
+ * and 1 is returned. Returns 0 once they are in the buffer.
+ */
+uint8_t uart1_put_telemetry(const char* bytes, uint8_t length);
+
+/* Take the oldest byte received. Returns 1 if there was one, 0 if not. */
+uint8_t uart1_get(uint8_t* byte);
+
+/* Number of bytes dropped because the receive buffer was full (saturates
+ * at 255) */
+uint8_t uart1_overruns(void);
+
+#endif /* UART1_H_ */
@@ -0,0 +1,337 @@
+/*
+ * ai_tables.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Generates battleship/aitables.c, the computer player's opening book and
+ * first hit replies (see battleship/aitables.h).
+ *
+ * Each move is the cell covered in the most fleets that are still
+ * possible: every way of placing all six ships (carrier 6, cruiser 4,
+ * destroyer 3, frigate 3, corvette 2, submarine 2, as in fleets.c) so that
+ * no two touch, no ship covers a miss and every hit is covered. There are
+ * about 127 million such fleets on an empty grid (counting the two ships
+ * of each length once between them), so the search for each move is split
+ * across threads by where the carrier lies.
+ *
+ * Usage: ai_tables [-j threads] [-o file] [-v]
+ *
+ *   -j threads  number of threads (default: one per CPU)
+ *   -o file     write the tables to file (default: standard output)
+ *   -v          print each move and the number of fleets to stderr
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "aitables.h"
+
+#define NUM_SHIPS 6
+#define NUM_CELLS 64
+#define MAX_PLACEMENTS 128
+
+// Longest first, so the search tree is pruned as early as possible
+static const int ship_lengths[NUM_SHIPS] = { 6, 4, 3, 3, 2, 2 };
+
+typedef struct {
+	uint64_t cells;
+	// the cells and the ones next to them, which no other ship may cover
+	uint64_t halo;
+} Placement;
+
+static Placement placements[NUM_SHIPS][MAX_PLACEMENTS];
+static int num_placements[NUM_SHIPS];
+
+// One search: the shots so far, and the work shared between the threads
+typedef struct {
+	uint64_t misses;
+	uint64_t hits;
+	pthread_mutex_t lock;
+	int next_carrier;
+} Search;
+
+typedef struct {
+	Search* search;
+	pthread_t thread;
+	// fleets found with each placement of each ship
+	uint64_t fleets[NUM_SHIPS][MAX_PLACEMENTS];
+} Worker;
+
+static void make_placements(void)
+{
+	for (int ship = 0; ship < NUM_SHIPS; ship++)
+	{
+		int length = ship_lengths[ship];
+		for (int vertical = 0; vertical < 2; vertical++)
+		{
+			for (int row = 0; row < 8; row++)
+			{
+				for (int col = 0; col < 8; col++)
+				{
+					if ((vertical ? row : col) + length > 8)
+					{
+						continue;
+					}
+					Placement* p = &placements[ship][num_placements[ship]++];
+					p->cells = 0;
+					p->halo = 0;
+					for (int i = 0; i < length; i++)
+					{
+						int r = vertical ? row + i : row;
+						int c = vertical ? col : col + i;
+						p->cells |= 1ULL << (r * 8 + c);
+						p->halo |= 1ULL << (r * 8 + c);
+						if (r > 0)
+						{
+							p->halo |= 1ULL << ((r - 1) * 8 + c);
+						}
+						if (r < 7)
+						{
+							p->halo |= 1ULL << ((r + 1) * 8 + c);
+						}
+						if (c > 0)
+						{
+							p->halo |= 1ULL << (r * 8 + c - 1);
+						}
+						if (c < 7)
+						{
+							p->halo |= 1ULL << (r * 8 + c + 1);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Count the fleets that can be completed from ship on, given the halo of
+// the ships placed so far and the hits they don't cover yet. Ships of the
+// same length are placed in order (the second after the first), so each
+// pair is only counted once.
+static uint64_t count_fleets(Worker* w, int ship, int previous,
+		uint64_t halo, uint64_t uncovered)
+{
+	uint64_t blocked = halo | w->search->misses;
+	int first = ship_lengths[ship] == ship_lengths[ship - 1] ? previous + 1 : 0;
+	uint64_t total = 0;
+	for (int i = first; i < num_placements[ship]; i++)
+	{
+		const Placement* p = &placements[ship][i];
+		if (p->cells & blocked)
+		{
+			continue;
+		}
+		uint64_t still_uncovered = uncovered & ~p->cells;
+		uint64_t fleets;
+		if (ship == NUM_SHIPS - 1)
+		{
+			fleets = still_uncovered == 0;
+		} else
+		{
+			fleets = count_fleets(w, ship + 1, i, halo | p->halo,
+					still_uncovered);
+		}
+		w->fleets[ship][i] += fleets;
+		total += fleets;
+	}
+	return total;
+}
+
+static void* worker_main(void* arg)
+{
+	Worker* w = arg;
+	Search* search = w->search;
+	while (1)
+	{
+		pthread_mutex_lock(&search->lock);
+		int carrier = search->next_carrier++;
+		pthread_mutex_unlock(&search->lock);
+		if (carrier >= num_placements[0])
+		{
+			return NULL;
+		}
+
+		const Placement* p = &placements[0][carrier];
+		if (p->cells & search->misses)
+		{
+			continue;
+		}
+		w->fleets[0][carrier] += count_fleets(w, 1, 0, p->halo,
+				search->hits & ~p->cells);
+	}
+}
+
+// Return the unshot cell in the most fleets, given the shots so far.
+// Ties go to the lowest cell.
+static int best_cell(uint64_t misses, uint64_t hits, int threads,
+		uint64_t* total_fleets)
+{
+	Search search = { misses, hits, PTHREAD_MUTEX_INITIALIZER, 0 };
+	Worker* workers = calloc(threads, sizeof(Worker));
+	if (!workers)
+	{
+		perror("ai_tables");
+		exit(1);
+	}
+	for (int t = 0; t < threads; t++)
+	{
+		workers[t].search = &search;
+		if (pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]))
+		{
+			perror("ai_tables: pthread_create");
+			exit(1);
+		}
+	}
+
+	// Add up each cell over the placements that cover it
+	uint64_t cell_fleets[NUM_CELLS] = { 0 };
+	*total_fleets = 0;
+	for (int t = 0; t < threads; t++)
+	{
+		pthread_join(workers[t].thread, NULL);
+		for (int ship = 0; ship < NUM_SHIPS; ship++)
+		{
+			for (int i = 0; i < num_placements[ship]; i++)
+			{
+				uint64_t fleets = workers[t].fleets[ship][i];
+				if (ship == 0)
+				{
+					*total_fleets += fleets;
+				}
+				for (int cell = 0; cell < NUM_CELLS; cell++)
+				{
+					if (placements[ship][i].cells & (1ULL << cell))
+					{
+						cell_fleets[cell] += fleets;
+					}
+				}
+			}
+		}
+	}
+	free(workers);
+
+	int best = -1;
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		if ((misses | hits) & (1ULL << cell))
+		{
+			continue;
+		}
+		if (best < 0 || cell_fleets[cell] > cell_fleets[best])
+		{
+			best = cell;
+		}
+	}
+	return best;
+}
+
+static void pack_cell(uint8_t* table, int n, int cell)
+{
+	int bit = n * AI_TABLE_CELL_BITS;
+	uint16_t value = cell << (bit & 7);
+	table[bit / 8] |= value;
+	table[bit / 8 + 1] |= value >> 8;
+}
+
+static void write_table(FILE* f, const char* name, const char* comment,
+		const uint8_t* table, const int* cells)
+{
+	fprintf(f, "\n// %s\n//", comment);
+	for (int n = 0; n < AI_BOOK_LENGTH; n++)
+	{
+		fprintf(f, " %d,%d", cells[n] / 8, cells[n] % 8);
+	}
+	fprintf(f, "\nconst uint8_t %s[AI_TABLE_BYTES] PROGMEM = {", name);
+	for (int i = 0; i < AI_TABLE_BYTES; i++)
+	{
+		fprintf(f, "%s0x%02x", i ? ", " : "", table[i]);
+	}
+	fprintf(f, "};\n");
+}
+
+int main(int argc, char** argv)
+{
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	const char* output = NULL;
+	int verbose = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "j:o:v")) != -1)
+	{
+		switch (opt)
+		{
+			case 'j':
+				threads = atoi(optarg);
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			default:
+				fprintf(stderr, "usage: ai_tables [-j threads] [-o file] [-v]\n");
+				return 2;
+		}
+	}
+	if (threads < 1)
+	{
+		threads = 1;
+	}
+	make_placements();
+
+	int book[AI_BOOK_LENGTH];
+	int replies[AI_BOOK_LENGTH];
+	uint8_t packed_book[AI_TABLE_BYTES] = { 0 };
+	uint8_t packed_replies[AI_TABLE_BYTES] = { 0 };
+	uint64_t misses = 0;
+	uint64_t fleets;
+	for (int n = 0; n < AI_BOOK_LENGTH; n++)
+	{
+		book[n] = best_cell(misses, 0, threads, &fleets);
+		if (verbose)
+		{
+			fprintf(stderr, "book %d: %d,%d of %llu fleets\n", n,
+					book[n] / 8, book[n] % 8, (unsigned long long)fleets);
+		}
+
+		replies[n] = best_cell(misses, 1ULL << book[n], threads, &fleets);
+		if (verbose)
+		{
+			fprintf(stderr, "reply %d: %d,%d of %llu fleets\n", n,
+					replies[n] / 8, replies[n] % 8, (unsigned long long)fleets);
+		}
+		pack_cell(packed_book, n, book[n]);
+		pack_cell(packed_replies, n, replies[n]);
+		misses |= 1ULL << book[n];
+	}
+
+	FILE* f = output ? fopen(output, "w") : stdout;
+	if (!f)
+	{
+		perror(output);
+		return 1;
+	}
+	fprintf(f, "/*\n"
+			" * aitables.c\n"
+			" *\n"
+			" * Generated by tools/ai_tables - do not edit. See aitables.h.\n"
+			" */\n"
+			"\n"
+			"#include \"aitables.h\"\n"
+			"\n"
+			"#include <avr/pgmspace.h>\n");
+	write_table(f, "ai_book", "Opening book (row,column of each move)",
+			packed_book, book);
+	write_table(f, "ai_first_hit_replies",
+			"Replies to a first hit on each book move", packed_replies,
+			replies);
+	if (f != stdout && fclose(f))
+	{
+		perror(output);
+		return 1;
+	}
+	return 0;
+}
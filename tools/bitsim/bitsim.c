@@ -0,0 +1,333 @@
+/*
+ * bitsim.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Batched bitboard engine - see bitsim.h.
+ */
+
+/* for posix_memalign() */
+#define _POSIX_C_SOURCE 200112L
+
+#include "bitsim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITSIM_X86
+#endif
+
+/* Boards are allocated in multiples of this, so the vector loops only
+ * need a tail for the last few */
+#define PAD 8
+
+int bitsim_init(BitsimBatch* batch, size_t count)
+{
+	size_t padded = (count + PAD - 1) / PAD * PAD;
+	size_t bytes = (padded ? padded : PAD) * sizeof(uint64_t);
+	memset(batch, 0, sizeof(*batch));
+	batch->count = count;
+	uint64_t** arrays[BITSIM_SHIP_TYPES + 3];
+	for (int t = 0; t < BITSIM_SHIP_TYPES; t++)
+	{
+		arrays[t] = &batch->ships[t];
+	}
+	arrays[BITSIM_SHIP_TYPES] = &batch->fleet;
+	arrays[BITSIM_SHIP_TYPES + 1] = &batch->hits;
+	arrays[BITSIM_SHIP_TYPES + 2] = &batch->sunk;
+	for (int a = 0; a < BITSIM_SHIP_TYPES + 3; a++)
+	{
+		/* 32 byte aligned for the AVX2 loads */
+		void* array;
+		if (posix_memalign(&array, 32, bytes))
+		{
+			bitsim_free(batch);
+			return -1;
+		}
+		memset(array, 0, bytes);
+		*arrays[a] = array;
+	}
+	return 0;
+}
+
+void bitsim_free(BitsimBatch* batch)
+{
+	for (int t = 0; t < BITSIM_SHIP_TYPES; t++)
+	{
+		free(batch->ships[t]);
+	}
+	free(batch->fleet);
+	free(batch->hits);
+	free(batch->sunk);
+	memset(batch, 0, sizeof(*batch));
+}
+
+void bitsim_load(BitsimBatch* batch, size_t i, uint8_t grid[8][8])
+{
+	for (int t = 0; t < BITSIM_SHIP_TYPES; t++)
+	{
+		batch->ships[t][i] = 0;
+	}
+	batch->fleet[i] = 0;
+	batch->hits[i] = 0;
+	batch->sunk[i] = 0;
+	for (int cell = 0; cell < 64; cell++)
+	{
+		uint8_t value = grid[cell / 8][cell % 8];
+		uint64_t bit = 1ULL << cell;
+		uint8_t ship = value & SHIP_MASK;
+		if (ship >= CARRIER && ship <= SUBMARINE)
+		{
+			batch->ships[ship - CARRIER][i] |= bit;
+			batch->fleet[i] |= bit;
+		}
+		if (value & HIT)
+		{
+			batch->hits[i] |= bit;
+		}
+		if (value & SUNK)
+		{
+			batch->sunk[i] |= bit;
+		}
+	}
+}
+
+/*
+ * Portable kernels, one board at a time. The vector kernels use these for
+ * the boards left over at the end.
+ */
+
+static void fire_board(BitsimBatch* batch, size_t i, uint8_t shot)
+{
+	uint64_t hits = batch->hits[i];
+	if (shot < 64)
+	{
+		hits |= 1ULL << shot;
+	}
+	batch->hits[i] = hits;
+
+	uint64_t sunk = batch->sunk[i];
+	for (int t = 0; t < BITSIM_SHIP_TYPES; t++)
+	{
+		uint64_t ship = batch->ships[t][i];
+		if ((ship & ~hits) == 0)
+		{
+			sunk |= ship;
+		}
+	}
+	batch->sunk[i] = sunk;
+}
+
+static void fire_portable(BitsimBatch* batch, const uint8_t* shots)
+{
+	for (size_t i = 0; i < batch->count; i++)
+	{
+		fire_board(batch, i, shots[i]);
+	}
+}
+
+static void fleet_sunk_portable(const BitsimBatch* batch, uint8_t* over)
+{
+	for (size_t i = 0; i < batch->count; i++)
+	{
+		over[i] = (batch->fleet[i] & ~batch->sunk[i]) == 0;
+	}
+}
+
+#ifdef BITSIM_X86
+
+/*
+ * SSE2 kernels, two boards to a register. SSE2 has neither a shift by a
+ * different count in each lane nor a 64 bit compare, so the shot bits are
+ * made in scalar registers and the compare is done as two 32 bit halves.
+ */
+
+static inline uint64_t shot_bit(uint8_t shot)
+{
+	return shot < 64 ? 1ULL << shot : 0;
+}
+
+__attribute__((target("sse2")))
+static inline __m128i is_zero_sse2(__m128i x)
+{
+	__m128i halves = _mm_cmpeq_epi32(x, _mm_setzero_si128());
+	return _mm_and_si128(halves,
+			_mm_shuffle_epi32(halves, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+__attribute__((target("sse2")))
+static void fire_sse2(BitsimBatch* batch, const uint8_t* shots)
+{
+	size_t i = 0;
+	for (; i + 4 <= batch->count; i += 4)
+	{
+		__m128i hits0 = _mm_or_si128(_mm_load_si128((__m128i*)&batch->hits[i]),
+				_mm_set_epi64x(shot_bit(shots[i + 1]), shot_bit(shots[i])));
+		__m128i hits1 = _mm_or_si128(
+				_mm_load_si128((__m128i*)&batch->hits[i + 2]),
+				_mm_set_epi64x(shot_bit(shots[i + 3]), shot_bit(shots[i + 2])));
+		__m128i sunk0 = _mm_load_si128((__m128i*)&batch->sunk[i]);
+		__m128i sunk1 = _mm_load_si128((__m128i*)&batch->sunk[i + 2]);
+		for (int t = 0; t < BITSIM_SHIP_TYPES; t++)
+		{
+			__m128i ship0 = _mm_load_si128((__m128i*)&batch->ships[t][i]);
+			__m128i ship1 = _mm_load_si128((__m128i*)&batch->ships[t][i + 2]);
+			sunk0 = _mm_or_si128(sunk0, _mm_and_si128(ship0,
+					is_zero_sse2(_mm_andnot_si128(hits0, ship0))));
+			sunk1 = _mm_or_si128(sunk1, _mm_and_si128(ship1,
+					is_zero_sse2(_mm_andnot_si128(hits1, ship1))));
+		}
+		_mm_store_si128((__m128i*)&batch->hits[i], hits0);
+		_mm_store_si128((__m128i*)&batch->hits[i + 2], hits1);
+		_mm_store_si128((__m128i*)&batch->sunk[i], sunk0);
+		_mm_store_si128((__m128i*)&batch->sunk[i + 2], sunk1);
+	}
+	for (; i < batch->count; i++)
+	{
+		fire_board(batch, i, shots[i]);
+	}
+}
+
+__attribute__((target("sse2")))
+static void fleet_sunk_sse2(const BitsimBatch* batch, uint8_t* over)
+{
+	size_t i = 0;
+	for (; i + 2 <= batch->count; i += 2)
+	{
+		__m128i left = _mm_andnot_si128(
+				_mm_load_si128((__m128i*)&batch->sunk[i]),
+				_mm_load_si128((__m128i*)&batch->fleet[i]));
+		int mask = _mm_movemask_pd(_mm_castsi128_pd(is_zero_sse2(left)));
+		over[i] = mask & 1;
+		over[i + 1] = mask >> 1;
+	}
+	for (; i < batch->count; i++)
+	{
+		over[i] = (batch->fleet[i] & ~batch->sunk[i]) == 0;
+	}
+}
+
+/*
+ * AVX2 kernels, four boards to a register, two registers at a time. A
+ * shift by 64 or more gives 0, so BITSIM_NO_SHOT needs no special case.
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i shot_bits_avx2(const uint8_t* shots)
+{
+	uint32_t four;
+	memcpy(&four, shots, sizeof(four));
+	__m256i counts = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(four));
+	return _mm256_sllv_epi64(_mm256_set1_epi64x(1), counts);
+}
+
+__attribute__((target("avx2")))
+static void fire_avx2(BitsimBatch* batch, const uint8_t* shots)
+{
+	__m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= batch->count; i += 8)
+	{
+		__m256i hits0 = _mm256_or_si256(
+				_mm256_load_si256((__m256i*)&batch->hits[i]),
+				shot_bits_avx2(&shots[i]));
+		__m256i hits1 = _mm256_or_si256(
+				_mm256_load_si256((__m256i*)&batch->hits[i + 4]),
+				shot_bits_avx2(&shots[i + 4]));
+		__m256i sunk0 = _mm256_load_si256((__m256i*)&batch->sunk[i]);
+		__m256i sunk1 = _mm256_load_si256((__m256i*)&batch->sunk[i + 4]);
+		for (int t = 0; t < BITSIM_SHIP_TYPES; t++)
+		{
+			__m256i ship0 = _mm256_load_si256((__m256i*)&batch->ships[t][i]);
+			__m256i ship1 = _mm256_load_si256(
+					(__m256i*)&batch->ships[t][i + 4]);
+			sunk0 = _mm256_or_si256(sunk0, _mm256_and_si256(ship0,
+					_mm256_cmpeq_epi64(_mm256_andnot_si256(hits0, ship0), zero)));
+			sunk1 = _mm256_or_si256(sunk1, _mm256_and_si256(ship1,
+					_mm256_cmpeq_epi64(_mm256_andnot_si256(hits1, ship1), zero)));
+		}
+		_mm256_store_si256((__m256i*)&batch->hits[i], hits0);
+		_mm256_store_si256((__m256i*)&batch->hits[i + 4], hits1);
+		_mm256_store_si256((__m256i*)&batch->sunk[i], sunk0);
+		_mm256_store_si256((__m256i*)&batch->sunk[i + 4], sunk1);
+	}
+	for (; i < batch->count; i++)
+	{
+		fire_board(batch, i, shots[i]);
+	}
+}
+
+__attribute__((target("avx2")))
+static void fleet_sunk_avx2(const BitsimBatch* batch, uint8_t* over)
+{
+	__m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 4 <= batch->count; i += 4)
+	{
+		__m256i left = _mm256_andnot_si256(
+				_mm256_load_si256((__m256i*)&batch->sunk[i]),
+				_mm256_load_si256((__m256i*)&batch->fleet[i]));
+		int mask = _mm256_movemask_pd(_mm256_castsi256_pd(
+				_mm256_cmpeq_epi64(left, zero)));
+		for (int lane = 0; lane < 4; lane++)
+		{
+			over[i + lane] = (mask >> lane) & 1;
+		}
+	}
+	for (; i < batch->count; i++)
+	{
+		over[i] = (batch->fleet[i] & ~batch->sunk[i]) == 0;
+	}
+}
+
+#endif /* BITSIM_X86 */
+
+static const BitsimKernels all_kernels[] = {
+	{ "portable", fire_portable, fleet_sunk_portable },
+#ifdef BITSIM_X86
+	{ "sse2", fire_sse2, fleet_sunk_sse2 },
+	{ "avx2", fire_avx2, fleet_sunk_avx2 },
+#endif
+	{ NULL, NULL, NULL }
+};
+
+const BitsimKernels* bitsim_kernels(void)
+{
+	static BitsimKernels usable[sizeof(all_kernels) / sizeof(all_kernels[0])];
+	if (!usable[0].name)
+	{
+		size_t n = 0;
+		for (size_t k = 0; all_kernels[k].name; k++)
+		{
+#ifdef BITSIM_X86
+			if ((strcmp(all_kernels[k].name, "sse2") == 0 &&
+					!__builtin_cpu_supports("sse2")) ||
+					(strcmp(all_kernels[k].name, "avx2") == 0 &&
+					!__builtin_cpu_supports("avx2")))
+			{
+				continue;
+			}
+#endif
+			usable[n++] = all_kernels[k];
+		}
+	}
+	return usable;
+}
+
+const BitsimKernels* bitsim_select(const char* name)
+{
+	const BitsimKernels* k = bitsim_kernels();
+	const BitsimKernels* chosen = NULL;
+	for (; k->name; k++)
+	{
+		if (!name || strcmp(k->name, name) == 0)
+		{
+			chosen = k;
+		}
+	}
+	return chosen;
+}
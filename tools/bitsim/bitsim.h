@@ -0,0 +1,67 @@
+/*
+ * bitsim.h
+ *
+ * Author: Andrew Wilson
+ *
+ * Batched bitboard engine for simulating many games at once on the host.
+ * A batch holds any number of boards (one fleet being fired at each) as a
+ * structure of arrays of 64 bit masks, bit row * 8 + column for cell
+ * grid[row][column] as in game.c: the cells of each ship type, the cells
+ * that have been fired at, and the cells of ships that are sunk.
+ *
+ * The kernels work on whole batches and come in portable, SSE2 and AVX2
+ * versions (2 and 4 boards per instruction, unrolled to 4 and 8) that all
+ * give the same result. They follow the rules in game.c: a ship is sunk
+ * once every one of its cells has been hit, and is_game_over() is true
+ * once every ship on both boards is sunk. tools/bitsim/bitsim_check.c
+ * checks that against game.c itself.
+ */
+
+#ifndef BITSIM_H_
+#define BITSIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Ship types 1 to 6, as in game.h */
+#define BITSIM_SHIP_TYPES 6
+
+/* A shot at this cell (or any above 63) does nothing */
+#define BITSIM_NO_SHOT 0xFF
+
+typedef struct {
+	/* Number of boards; the arrays are padded to a multiple of 8 */
+	size_t count;
+	/* ships[t][i] is the cells of ship type t + 1 on board i */
+	uint64_t* ships[BITSIM_SHIP_TYPES];
+	uint64_t* fleet;
+	uint64_t* hits;
+	uint64_t* sunk;
+} BitsimBatch;
+
+typedef struct {
+	const char* name;
+	/* Fire shots[i] at board i, then sink any ship whose cells have all
+	 * been hit */
+	void (*fire)(BitsimBatch* batch, const uint8_t* shots);
+	/* over[i] = 1 if every ship on board i is sunk, else 0 */
+	void (*fleet_sunk)(const BitsimBatch* batch, uint8_t* over);
+} BitsimKernels;
+
+/* Allocate a batch of count empty boards. Returns 0 on success, -1 if
+ * out of memory. */
+int bitsim_init(BitsimBatch* batch, size_t count);
+void bitsim_free(BitsimBatch* batch);
+
+/* Set board i from a grid in game.c's encoding: the ship type of each
+ * cell, and the HIT and SUNK bits */
+void bitsim_load(BitsimBatch* batch, size_t i, uint8_t grid[8][8]);
+
+/* The kernels this CPU can run, best last, ending with a null name */
+const BitsimKernels* bitsim_kernels(void);
+
+/* The best kernels this CPU can run, or those called name (NULL if there
+ * are none by that name or the CPU can't run them) */
+const BitsimKernels* bitsim_select(const char* name);
+
+#endif /* BITSIM_H_ */
@@ -0,0 +1,316 @@
+/*
+ * bitsim_check.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Checks the batched bitboard engine (bitsim.h) against the firmware's own
+ * game logic. Every game has a human and a computer board, each a random
+ * fleet (or one of the fleet layouts in fleets.c) fired at in a random
+ * order. The game is stepped one shot per board at a time with game.c,
+ * which marks the cells HIT, sinks ships with check_for_sunken_ships() and
+ * decides is_game_over(); each set of kernels fires the same shots at the
+ * whole batch, and the HIT and SUNK cells and game over must match after
+ * every step.
+ *
+ * Usage: bitsim_check [-g games] [-s seed]
+ *
+ *   -g games   number of games to play at once (default 1000)
+ *   -s seed    seed for the fleets and shots (default 1)
+ *
+ * Exits with status 1 if any kernels disagree with game.c.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bitsim.h"
+#include "fleets.h"
+#include "game.h"
+
+#define NUM_SHIPS 6
+#define NUM_CELLS 64
+
+typedef uint8_t Grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS];
+
+static const uint8_t ship_lengths[NUM_SHIPS] = { 6, 4, 3, 3, 2, 2 };
+
+static FILE* out;
+static uint32_t random_state;
+
+static uint32_t next_random(void)
+{
+	// xorshift32
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+// Place the fleet at random, ships never touching, in game.c's encoding:
+// both ends marked SHIP_END and every cell of a horizontal ship HORIZONTAL
+static void random_fleet(Grid grid)
+{
+	while (1)
+	{
+		memset(grid, 0, sizeof(Grid));
+		uint8_t ship;
+		for (ship = 0; ship < NUM_SHIPS; ship++)
+		{
+			uint8_t length = ship_lengths[ship];
+			uint8_t tries;
+			for (tries = 0; tries < 100; tries++)
+			{
+				uint8_t vertical = next_random() & 1;
+				uint8_t row = next_random() % (vertical ? 9 - length : 8);
+				uint8_t col = next_random() % (vertical ? 8 : 9 - length);
+
+				// no cell or its neighbours may be taken
+				uint8_t clear = 1;
+				for (uint8_t i = 0; i < length && clear; i++)
+				{
+					int8_t r = vertical ? row + i : row;
+					int8_t c = vertical ? col : col + i;
+					clear = !grid[r][c] && (r == 0 || !grid[r - 1][c]) &&
+							(r == 7 || !grid[r + 1][c]) &&
+							(c == 0 || !grid[r][c - 1]) &&
+							(c == 7 || !grid[r][c + 1]);
+				}
+				if (!clear)
+				{
+					continue;
+				}
+				for (uint8_t i = 0; i < length; i++)
+				{
+					uint8_t cell = (CARRIER + ship) |
+							(vertical ? 0 : HORIZONTAL) |
+							(i == 0 || i == length - 1 ? SHIP_END : 0);
+					grid[vertical ? row + i : row][vertical ? col : col + i] =
+							cell;
+				}
+				break;
+			}
+			if (tries == 100)
+			{
+				break;
+			}
+		}
+		if (ship == NUM_SHIPS)
+		{
+			return;
+		}
+	}
+}
+
+// A random order to fire at every cell in
+static void random_shots(uint8_t shots[NUM_CELLS])
+{
+	for (uint8_t cell = 0; cell < NUM_CELLS; cell++)
+	{
+		shots[cell] = cell;
+	}
+	for (uint8_t cell = NUM_CELLS - 1; cell > 0; cell--)
+	{
+		uint8_t other = next_random() % (cell + 1);
+		uint8_t swap = shots[cell];
+		shots[cell] = shots[other];
+		shots[other] = swap;
+	}
+}
+
+// Fire at cell of grid as player_turn() and computer_turn() do
+static void game_fire(uint8_t player, Grid grid, uint8_t cell)
+{
+	uint8_t* value = &grid[cell / 8][cell % 8];
+	*value |= HIT;
+	if (*value & SHIP_MASK)
+	{
+		check_for_sunken_ships(player, grid);
+	}
+}
+
+static uint64_t grid_mask(Grid grid, uint8_t flag)
+{
+	uint64_t mask = 0;
+	for (uint8_t cell = 0; cell < NUM_CELLS; cell++)
+	{
+		if (grid[cell / 8][cell % 8] & flag)
+		{
+			mask |= 1ULL << cell;
+		}
+	}
+	return mask;
+}
+
+static double seconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t games = 1000;
+	uint32_t seed = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "g:s:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'g':
+				games = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-g games] [-s seed]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (games < 1)
+	{
+		games = 1;
+	}
+	random_state = seed ? seed : 1;
+
+	// The game prints sunk ships etc. to stdout, keep it quiet
+	out = fdopen(dup(fileno(stdout)), "w");
+	if (!out || !freopen("/dev/null", "w", stdout))
+	{
+		return 2;
+	}
+
+	// Board 2g is game g's human grid and 2g + 1 its computer grid, so
+	// game over is the two boards' fleet_sunk ANDed. The first games use
+	// the fleet layouts so those are always covered.
+	uint32_t boards = games * 2;
+	Grid* grids = malloc(boards * sizeof(Grid));
+	uint8_t (*shots)[NUM_CELLS] = malloc(boards * NUM_CELLS);
+	uint8_t* step_shots = malloc(boards);
+	uint8_t* over = malloc(boards);
+	uint8_t* game_over = malloc(games);
+	if (!grids || !shots || !step_shots || !over || !game_over)
+	{
+		fprintf(stderr, "bitsim_check: out of memory\n");
+		return 2;
+	}
+	for (uint32_t b = 0; b < boards; b++)
+	{
+		if (b < NUM_FLEET_LAYOUTS)
+		{
+			fleet_load(b, grids[b]);
+		} else
+		{
+			random_fleet(grids[b]);
+		}
+		random_shots(shots[b]);
+	}
+
+	const BitsimKernels* kernels = bitsim_kernels();
+	uint32_t num_kernels = 0;
+	while (kernels[num_kernels].name)
+	{
+		num_kernels++;
+	}
+	BitsimBatch* batches = calloc(num_kernels, sizeof(BitsimBatch));
+	double* kernel_seconds = calloc(num_kernels, sizeof(double));
+	uint32_t* mismatches = calloc(num_kernels, sizeof(uint32_t));
+	if (!batches || !kernel_seconds || !mismatches)
+	{
+		fprintf(stderr, "bitsim_check: out of memory\n");
+		return 2;
+	}
+	for (uint32_t k = 0; k < num_kernels; k++)
+	{
+		if (bitsim_init(&batches[k], boards))
+		{
+			fprintf(stderr, "bitsim_check: out of memory\n");
+			return 2;
+		}
+		for (uint32_t b = 0; b < boards; b++)
+		{
+			bitsim_load(&batches[k], b, grids[b]);
+		}
+	}
+
+	// game.c's state for the game being stepped; no computer plays it
+	GameState state;
+	init_game_state(&state, NULL);
+
+	uint32_t games_over = 0;
+	for (uint8_t step = 0; step < NUM_CELLS; step++)
+	{
+		// game.c, one game at a time. A game that is over takes no more
+		// shots.
+		for (uint32_t g = 0; g < games; g++)
+		{
+			Grid* human = &grids[g * 2];
+			Grid* computer = &grids[g * 2 + 1];
+			if (step > 0 && game_over[g])
+			{
+				step_shots[g * 2] = BITSIM_NO_SHOT;
+				step_shots[g * 2 + 1] = BITSIM_NO_SHOT;
+				continue;
+			}
+			memcpy(state.human_grid, *human, sizeof(Grid));
+			memcpy(state.computer_grid, *computer, sizeof(Grid));
+			step_shots[g * 2] = shots[g * 2][step];
+			step_shots[g * 2 + 1] = shots[g * 2 + 1][step];
+			game_fire(1, state.computer_grid, step_shots[g * 2 + 1]);
+			game_fire(0, state.human_grid, step_shots[g * 2]);
+			game_over[g] = is_game_over(&state);
+			memcpy(*human, state.human_grid, sizeof(Grid));
+			memcpy(*computer, state.computer_grid, sizeof(Grid));
+		}
+
+		// each set of kernels, the whole batch at once
+		for (uint32_t k = 0; k < num_kernels; k++)
+		{
+			double start = seconds();
+			kernels[k].fire(&batches[k], step_shots);
+			kernels[k].fleet_sunk(&batches[k], over);
+			kernel_seconds[k] += seconds() - start;
+
+			for (uint32_t b = 0; b < boards; b++)
+			{
+				uint64_t hits = grid_mask(grids[b], HIT);
+				uint64_t sunk = grid_mask(grids[b], SUNK);
+				uint8_t bad = batches[k].hits[b] != hits ||
+						batches[k].sunk[b] != sunk ||
+						(b & 1 && (over[b - 1] && over[b]) != game_over[b / 2]);
+				if (bad && mismatches[k]++ < 5)
+				{
+					fprintf(out, "%s: game %u %s board, shot %u: hits %016llx/"
+							"%016llx sunk %016llx/%016llx\n", kernels[k].name,
+							b / 2, b & 1 ? "computer" : "human", step,
+							(unsigned long long)batches[k].hits[b],
+							(unsigned long long)hits,
+							(unsigned long long)batches[k].sunk[b],
+							(unsigned long long)sunk);
+				}
+			}
+		}
+	}
+	for (uint32_t g = 0; g < games; g++)
+	{
+		games_over += game_over[g];
+	}
+
+	uint32_t total_mismatches = 0;
+	fprintf(out, "%-10s %10s %12s\n", "kernels", "mismatches", "shots/s");
+	for (uint32_t k = 0; k < num_kernels; k++)
+	{
+		fprintf(out, "%-10s %10u %12.0f\n", kernels[k].name, mismatches[k],
+				boards * (double)NUM_CELLS / kernel_seconds[k]);
+		total_mismatches += mismatches[k];
+		bitsim_free(&batches[k]);
+	}
+	fprintf(out, "%u games (%u over), %u kernels, %s\n", games, games_over,
+			num_kernels, total_mismatches ? "MISMATCHES" : "all match");
+	return total_mismatches != 0;
+}
@@ -0,0 +1,331 @@
+/*
+ * matrix_check.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Plays the firmware's game logic on the host against the LED matrix model
+ * (battleship/host/matrix_model.h) and checks after every step that the
+ * matrix shows exactly what the game state says it should. It also counts
+ * the SPI traffic each kind of step generates and compares it with what a
+ * batched update of the same pixels would have cost.
+ *
+ * Usage: matrix_check [-g games] [-s seed] [-m mode] [-d divider]
+ *                     [-p ppm_dir] [-v]
+ *
+ *   -g games   number of games to play (default 8), fleets taken in turn
+ *   -m mode    game mode (see game.h): 0 classic (default), 1 salvo,
+ *              2 area strike
+ *   -s seed    seed for the player's shots (default 1)
+ *   -d divider SPI clock divider to drive the matrix at (default 128),
+ *              paced by ledmatrix.c below 128
+ *   -p dir     write a PPM snapshot of the matrix after every turn to dir
+ *   -v         draw the matrix on the terminal at the end of each game
+ *
+ * Exits with status 1 if any pixel is wrong or the model lost a byte
+ * because it came faster than the board could take it.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "display.h"
+#include "fleets.h"
+#include "game.h"
+#include "hal.h"
+#include "ledmatrix.h"
+#include "matrix_model.h"
+#include "pixel_colour.h"
+
+// The game being played, and the computer playing it
+static GameState game_state;
+static AiState computer_ai;
+
+// The kinds of step traffic is reported for
+enum {
+	STEP_START_SCREEN,
+	STEP_NEW_GAME,
+	STEP_CURSOR_MOVE,
+	STEP_CURSOR_FLASH,
+	STEP_TURN,
+	NUM_STEPS
+};
+
+static const char* const step_names[NUM_STEPS] = {
+	"start screen", "new game", "cursor move", "cursor flash", "turn"
+};
+
+typedef struct {
+	uint32_t frames;
+	uint32_t bytes;
+	uint32_t commands;
+	uint32_t batched_bytes;
+	uint32_t changed_pixels;
+} StepTraffic;
+
+static MatrixModel model;
+static StepTraffic traffic[NUM_STEPS];
+static uint32_t mismatches;
+static const char* ppm_dir;
+static uint32_t snapshot;
+// Cells of the computer's grid the player has fired at, one bit per cell
+// (row * 8 + column). In a salvo the ones that aren't hit yet are aimed at.
+static uint64_t targeted;
+// Where the report goes, the game's own output is thrown away
+static FILE* out;
+
+// Close the model's frame and account for it as the given kind of step
+static void end_step(uint8_t step)
+{
+	StepTraffic* t = &traffic[step];
+	t->frames++;
+	t->bytes += model.frame.bytes;
+	t->commands += model.frame.commands;
+	t->batched_bytes += matrix_model_batched_bytes(&model);
+	t->changed_pixels += matrix_model_changed_pixels(&model);
+	matrix_model_end_frame(&model);
+}
+
+// The colour a cell of a grid should be, from its state. Ships are shown
+// on the human's grid and aimed cells on the computer's.
+static PixelColour cell_colour(uint8_t cell, uint8_t show_ships,
+		uint8_t aimed)
+{
+	if (cell & HIT)
+	{
+		return (cell & SHIP_MASK) ? COLOUR_RED : COLOUR_GREEN;
+	}
+	return ((show_ships && (cell & SHIP_MASK)) || aimed) ? COLOUR_ORANGE
+			: COLOUR_BLACK;
+}
+
+// Compare every pixel with the game state. The cell under the cursor may
+// also be showing the cursor.
+static void check_pixels(uint32_t game, const char* after)
+{
+	for (uint8_t x = 0; x < GRID_NUM_COLUMNS; x++)
+	{
+		for (uint8_t y = 0; y < GRID_NUM_ROWS; y++)
+		{
+			PixelColour human = cell_colour(game_state.human_grid[y][x], 1,
+					0);
+			PixelColour computer = cell_colour(
+					game_state.computer_grid[7 - y][x], 0,
+					(targeted >> ((7 - y) * 8 + x)) & 1);
+			PixelColour shown_human = model.pixels[x][y];
+			PixelColour shown_computer =
+					model.pixels[x + GRID_NUM_COLUMNS][y];
+			uint8_t under_cursor = x == game_state.cursor_x &&
+					y == game_state.cursor_y;
+			
+			if (shown_human != human)
+			{
+				fprintf(out, "game %u, after %s: human (%u,%u) is 0x%02X, "
+						"expected 0x%02X\n", game, after, x, y,
+						shown_human, human);
+				mismatches++;
+			}
+			if (shown_computer != computer && !(under_cursor
+					&& (shown_computer == COLOUR_YELLOW
+					|| shown_computer == COLOUR_DARK_YELLOW)))
+			{
+				fprintf(out, "game %u, after %s: computer (%u,%u) is 0x%02X, "
+						"expected 0x%02X\n", game, after, x, y,
+						shown_computer, computer);
+				mismatches++;
+			}
+		}
+	}
+}
+
+static void write_snapshot(void)
+{
+	if (!ppm_dir)
+	{
+		return;
+	}
+	char path[512];
+	snprintf(path, sizeof(path), "%s/frame%05u.ppm", ppm_dir, snapshot++);
+	if (matrix_model_write_ppm(&model, path, 16) != 0)
+	{
+		perror(path);
+		exit(2);
+	}
+}
+
+static void play_start_screen(void)
+{
+	show_start_screen();
+	end_step(STEP_START_SCREEN);
+	for (int8_t frame = 0; frame < ANIMATION_LENGTH; frame++)
+	{
+		update_start_screen(frame);
+		end_step(STEP_START_SCREEN);
+	}
+}
+
+// Walk the cursor to (x, y) one key press at a time, flashing it on the
+// way like the main loop would
+static void walk_cursor(uint32_t game, int8_t x, int8_t y)
+{
+	while (game_state.cursor_x != x || game_state.cursor_y != y)
+	{
+		if (game_state.cursor_x != x)
+		{
+			move_cursor(&game_state, game_state.cursor_x < x ? 1 : -1, 0);
+		} else
+		{
+			move_cursor(&game_state, 0, game_state.cursor_y < y ? 1 : -1);
+		}
+		end_step(STEP_CURSOR_MOVE);
+		check_pixels(game, "cursor move");
+		
+		flash_cursor(&game_state);
+		end_step(STEP_CURSOR_FLASH);
+		check_pixels(game, "cursor flash");
+	}
+}
+
+static void play_game(uint32_t game)
+{
+	select_fleet(&game_state, game % NUM_FLEET_LAYOUTS);
+	initialise_game(&game_state);
+	targeted = 0;
+	end_step(STEP_NEW_GAME);
+	check_pixels(game, "new game");
+	
+	// Fire at every cell of the computer's grid in a random order
+	uint8_t targets[GRID_NUM_ROWS * GRID_NUM_COLUMNS];
+	for (uint8_t i = 0; i < sizeof(targets); i++)
+	{
+		targets[i] = i;
+	}
+	for (uint8_t i = sizeof(targets) - 1; i > 0; i--)
+	{
+		uint8_t j = rand() % (i + 1);
+		uint8_t t = targets[i];
+		targets[i] = targets[j];
+		targets[j] = t;
+	}
+	
+	for (uint8_t i = 0; i < sizeof(targets) && !is_game_over(&game_state);
+			i++)
+	{
+		walk_cursor(game, targets[i] % GRID_NUM_COLUMNS,
+				targets[i] / GRID_NUM_COLUMNS);
+		player_turn(&game_state);
+		targeted |= 1ULL << ((7 - game_state.cursor_y) * 8 +
+				game_state.cursor_x);
+		end_step(STEP_TURN);
+		check_pixels(game, "turn");
+		write_snapshot();
+	}
+}
+
+static void report(void)
+{
+	StepTraffic all = { 0 };
+	fprintf(out, "%-14s %7s %9s %9s %9s %9s %7s\n", "step", "frames", "bytes",
+			"commands", "pixels", "batched", "waste");
+	for (uint8_t i = 0; i < NUM_STEPS; i++)
+	{
+		StepTraffic* t = &traffic[i];
+		fprintf(out, "%-14s %7u %9u %9u %9u %9u %6.1f%%\n", step_names[i],
+				t->frames, t->bytes, t->commands, t->changed_pixels,
+				t->batched_bytes, t->bytes ? 100.0
+				* ((double)t->bytes - t->batched_bytes) / t->bytes : 0.0);
+		all.frames += t->frames;
+		all.bytes += t->bytes;
+		all.commands += t->commands;
+		all.changed_pixels += t->changed_pixels;
+		all.batched_bytes += t->batched_bytes;
+	}
+	fprintf(out, "%-14s %7u %9u %9u %9u %9u %6.1f%%\n", "total", all.frames,
+			all.bytes, all.commands, all.changed_pixels, all.batched_bytes,
+			all.bytes ? 100.0 * ((double)all.bytes - all.batched_bytes)
+			/ all.bytes
+			: 0.0);
+	if (model.total.bad_commands)
+	{
+		fprintf(out, "%u unknown commands\n", model.total.bad_commands);
+	}
+	if (model.total.overruns)
+	{
+		fprintf(out, "%u bytes lost to overruns\n", model.total.overruns);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t games = 8;
+	unsigned seed = 1;
+	uint8_t divider = 128;
+	uint8_t verbose = 0;
+	int option;
+	init_game_state(&game_state, &computer_ai);
+	while ((option = getopt(argc, argv, "g:s:m:d:p:v")) != -1)
+	{
+		switch (option)
+		{
+			case 'g':
+				games = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			case 'm':
+				select_mode(&game_state, strtoul(optarg, NULL, 0));
+				if (selected_mode(&game_state) == MODE_LINK)
+				{
+					fprintf(stderr, "%s: link play needs another board\n",
+							argv[0]);
+					return 2;
+				}
+				break;
+			case 'd':
+				divider = strtoul(optarg, NULL, 0);
+				break;
+			case 'p':
+				ppm_dir = optarg;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-g games] [-s seed] [-m mode] "
+						"[-d divider] [-p ppm_dir] [-v]\n", argv[0]);
+				return 2;
+		}
+	}
+	srand(seed);
+	
+	ledmatrix_setup_divider(divider);
+	matrix_model_init(&model);
+	hal_host_set_spi_slave(matrix_model_spi, &model);
+	
+	// The game prints sunk ships etc. to stdout, keep it quiet
+	out = fdopen(dup(fileno(stdout)), "w");
+	if (!out || !freopen("/dev/null", "w", stdout))
+	{
+		return 2;
+	}
+	
+	play_start_screen();
+	for (uint32_t game = 0; game < games; game++)
+	{
+		play_game(game);
+		if (verbose)
+		{
+			fprintf(out, "game %u (%s):\n", game,
+					fleet_name(selected_fleet(&game_state)));
+			matrix_model_render(&model, out);
+		}
+	}
+	
+	report();
+	fprintf(out, "%u games, %u frames, %s\n", games, model.frames,
+			mismatches ? "PIXEL MISMATCHES" : "all pixels match");
+	return mismatches != 0 || model.total.overruns != 0;
+}
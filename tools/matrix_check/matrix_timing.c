@@ -0,0 +1,219 @@
+/*
+ * matrix_timing.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Times the LED matrix commands at each SPI clock divider, and checks the
+ * pacing ledmatrix.c adds below 128 against the LED matrix model's
+ * estimate of how long the board takes over each byte (see
+ * battleship/host/matrix_model.h). Times are on the host's SPI clock, so
+ * they are what the game would spend sending (and pausing after) each
+ * command on the device, without the few cycles of code around it.
+ *
+ * For each divider it reports the time for a full frame (CMD_UPDATE_ALL),
+ * a pixel, a row, a column, a shift and a clear, then sends a random mix
+ * of those commands back to back and counts the bytes the board would
+ * have lost. The mix is sent again with the bus at the same divider but
+ * the pacing left as for 128, to show the model catches a clock that is
+ * too fast for the board.
+ *
+ * Usage: matrix_timing [-n commands] [-s seed]
+ *
+ *   -n commands  length of the mix (default 20000)
+ *   -s seed      seed for the mix (default 1)
+ *
+ * Exits with status 1 if the board would have lost a byte, or seen an
+ * unknown command, at any divider with its pacing.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "ledmatrix.h"
+#include "matrix_model.h"
+#include "pixel_colour.h"
+#include "spi.h"
+
+// The commands timed, in the order they are reported
+enum {
+	TIME_FRAME,
+	TIME_PIXEL,
+	TIME_ROW,
+	TIME_COLUMN,
+	TIME_SHIFT,
+	TIME_CLEAR,
+	NUM_TIMES
+};
+
+static const char* const time_names[NUM_TIMES] = {
+	"frame", "pixel", "row", "column", "shift", "clear"
+};
+
+static const uint8_t dividers[] = { 128, 64, 32, 16, 8, 4 };
+
+static const PixelColour colours[] = {
+	COLOUR_BLACK, COLOUR_RED, COLOUR_GREEN, COLOUR_ORANGE, COLOUR_YELLOW,
+	COLOUR_DARK_YELLOW
+};
+
+static MatrixModel model;
+
+static PixelColour random_colour(void)
+{
+	return colours[rand() % sizeof(colours)];
+}
+
+// Send one of the commands timed, with random contents
+static void send_command(uint8_t which)
+{
+	MatrixData data;
+	MatrixRow row;
+	MatrixColumn column;
+	switch (which)
+	{
+		case TIME_FRAME:
+			for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++)
+			{
+				for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++)
+				{
+					data[x][y] = random_colour();
+				}
+			}
+			ledmatrix_update_all(data);
+			break;
+		case TIME_PIXEL:
+			ledmatrix_update_pixel(rand() % MATRIX_NUM_COLUMNS,
+					rand() % MATRIX_NUM_ROWS, random_colour());
+			break;
+		case TIME_ROW:
+			for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++)
+			{
+				row[x] = random_colour();
+			}
+			ledmatrix_update_row(rand() % MATRIX_NUM_ROWS, row);
+			break;
+		case TIME_COLUMN:
+			for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++)
+			{
+				column[y] = random_colour();
+			}
+			ledmatrix_update_column(rand() % MATRIX_NUM_COLUMNS, column);
+			break;
+		case TIME_SHIFT:
+			switch (rand() % 4)
+			{
+				case 0:
+					ledmatrix_shift_display_left();
+					break;
+				case 1:
+					ledmatrix_shift_display_right();
+					break;
+				case 2:
+					ledmatrix_shift_display_up();
+					break;
+				default:
+					ledmatrix_shift_display_down();
+					break;
+			}
+			break;
+		default:
+			ledmatrix_clear();
+			break;
+	}
+}
+
+// A random command, mostly pixels as in a game
+static uint8_t random_command(void)
+{
+	uint8_t r = rand() % 16;
+	if (r < 8)
+	{
+		return TIME_PIXEL;
+	}
+	return r - 8 < NUM_TIMES ? r - 8 : TIME_PIXEL;
+}
+
+// Send a mix of commands starting from a fresh model and an idle board.
+// Returns the bytes lost.
+static uint32_t send_mix(uint32_t commands, unsigned seed)
+{
+	matrix_model_init(&model);
+	srand(seed);
+	for (uint32_t i = 0; i < commands; i++)
+	{
+		send_command(random_command());
+	}
+	matrix_model_end_frame(&model);
+	return model.total.overruns;
+}
+
+static double cycles_to_us(uint32_t cycles)
+{
+	return cycles * 1e6 / HAL_SYSCLK;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t commands = 20000;
+	unsigned seed = 1;
+	int option;
+	while ((option = getopt(argc, argv, "n:s:")) != -1)
+	{
+		switch (option)
+		{
+			case 'n':
+				commands = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n commands] [-s seed]\n",
+						argv[0]);
+				return 2;
+		}
+	}
+	
+	hal_host_set_spi_slave(matrix_model_spi, &model);
+	
+	uint8_t failed = 0;
+	printf("%7s", "divider");
+	for (uint8_t i = 0; i < NUM_TIMES; i++)
+	{
+		printf(" %8s", time_names[i]);
+	}
+	printf(" %8s %9s\n", "lost", "unpaced");
+	for (uint8_t d = 0; d < sizeof(dividers); d++)
+	{
+		ledmatrix_setup_divider(dividers[d]);
+	
+		// Each command from an idle board, in microseconds
+		printf("%7u", dividers[d]);
+		srand(seed);
+		for (uint8_t i = 0; i < NUM_TIMES; i++)
+		{
+			matrix_model_init(&model);
+			uint32_t start = hal_host_spi_clock();
+			send_command(i);
+			printf(" %8.1f", cycles_to_us(hal_host_spi_clock() - start));
+		}
+	
+		uint32_t lost = send_mix(commands, seed);
+		uint32_t bad = model.total.bad_commands;
+		failed |= lost != 0 || bad != 0;
+	
+		// The same mix with the pacing for 128
+		ledmatrix_setup_divider(128);
+		spi_setup_master(dividers[d]);
+		uint32_t unpaced = send_mix(commands, seed);
+	
+		printf(" %8u %9u%s\n", lost, unpaced,
+				bad ? " UNKNOWN COMMANDS" : "");
+	}
+	printf("times in us, bytes lost in %u commands%s\n", commands,
+			failed ? ", PACING TOO FAST" : "");
+	return failed;
+}
@@ -0,0 +1,109 @@
+/*
+ * headless.c
+ *
+ * Author: Andrew Wilson
+ *
+ * The device's outputs, for the games battleship_server runs: nothing.
+ * game.c draws on the LED matrix, prints to the terminal and the telemetry
+ * channel and drives the link as it goes, through drivers whose state is
+ * one device's, shared by every thread of the server. The server draws
+ * each client's screen from its GameState instead (see server.c), so these
+ * stand in for the drivers game.c calls and touch nothing, which lets
+ * sessions play on every thread at once without a lock. Being defined
+ * here, they keep the drivers' own objects out of the link; a driver that
+ * game.c starts to call shows up as a duplicate or missing symbol.
+ */
+
+#include <stdint.h>
+
+#include "ledmatrix.h"
+#include "link.h"
+#include "log.h"
+#include "telemetry.h"
+#include "terminalio.h"
+
+void ledmatrix_draw_pixel_in_human_grid(uint8_t x, uint8_t y, PixelColour pixel)
+{
+	(void)x;
+	(void)y;
+	(void)pixel;
+}
+
+void ledmatrix_draw_pixel_in_computer_grid(uint8_t x, uint8_t y,
+		PixelColour pixel)
+{
+	(void)x;
+	(void)y;
+	(void)pixel;
+}
+
+void ledmatrix_update_column(uint8_t x, MatrixColumn col)
+{
+	(void)x;
+	(void)col;
+}
+
+void ledmatrix_clear(void)
+{
+}
+
+void log_at_P(uint8_t level, int8_t x, int8_t y, const char* format, ...)
+{
+	(void)level;
+	(void)x;
+	(void)y;
+	(void)format;
+}
+
+void telemetry_printf_P(const char* format, ...)
+{
+	(void)format;
+}
+
+void move_terminal_cursor(int x, int y)
+{
+	(void)x;
+	(void)y;
+}
+
+void set_scroll_region(int8_t y1, int8_t y2)
+{
+	(void)y1;
+	(void)y2;
+}
+
+/* There is no other board: link play can't be chosen (see server.c) */
+
+void link_start(void)
+{
+}
+
+void link_stop(void)
+{
+}
+
+uint8_t link_first(void)
+{
+	return 0;
+}
+
+uint8_t link_fire(uint8_t cell)
+{
+	(void)cell;
+	return 0;
+}
+
+uint8_t link_result(void)
+{
+	return 0;
+}
+
+uint8_t link_incoming(void)
+{
+	return 0;
+}
+
+void link_answer(uint8_t result)
+{
+	(void)result;
+}
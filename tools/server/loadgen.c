@@ -0,0 +1,410 @@
+/*
+ * loadgen.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Load generator for the game server (server.c). Each client connects,
+ * starts a classic game and plays it to the end as a human would at the
+ * terminal, a key at a time: it walks the cursor to each cell of the
+ * computer's grid in a random order and fires. Once the game is over it
+ * hangs up and connects again as a new session. A key is only sent once
+ * the whole screen for the last one has come back, and the time from
+ * sending a key to the first byte of its screen is the latency reported.
+ *
+ * Usage: loadgen [-s socket] [-c clients] [-d seconds] [-j threads]
+ *
+ *   -s socket   server's socket (default /tmp/battleship.sock)
+ *   -c clients  clients connected at once (default 200)
+ *   -d seconds  how long to run for (default 10)
+ *   -j threads  threads to share the clients between (default 1)
+ *
+ * Exits with status 1 if no session was handled or the server went away.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server.h"
+
+#define NUM_CELLS 64
+#define MAX_EVENTS 64
+
+typedef struct {
+	int fd;
+	// where the cursor is (it starts at (3, 3)), the cells to fire at
+	// and how many of them have been
+	int8_t x, y;
+	uint8_t targets[NUM_CELLS];
+	uint8_t fired;
+	// whether the game has started and is over, how much of
+	// SERVER_FRAME_END and SERVER_GAME_OVER has been seen, and when the
+	// last key was sent (0 once its screen has started to come back)
+	uint8_t started;
+	uint8_t over;
+	uint8_t end_matched;
+	uint8_t over_matched;
+	uint64_t sent_at;
+} Client;
+
+typedef struct {
+	pthread_t thread;
+	uint32_t first_client;
+	uint32_t num_clients;
+	uint32_t sessions;
+	uint32_t keys;
+	uint32_t errors;
+	// latency of every key, in microseconds
+	uint32_t* latencies;
+	size_t num_latencies;
+	size_t latencies_size;
+} Worker;
+
+static struct sockaddr_un address = { .sun_family = AF_UNIX };
+static Client* clients;
+static uint64_t deadline;
+static uint32_t random_state = 1;
+
+static uint64_t now_us(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static uint32_t next_random(uint32_t* state)
+{
+	// xorshift32
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+// Connect client c as a new session. Returns -1 if the server isn't there.
+static int connect_client(int epoll, Client* c)
+{
+	memset(c, 0, sizeof(*c));
+	c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (c->fd < 0 ||
+			connect(c->fd, (struct sockaddr*)&address, sizeof(address)))
+	{
+		if (c->fd >= 0)
+		{
+			close(c->fd);
+		}
+		c->fd = -1;
+		return -1;
+	}
+	c->x = 3;
+	c->y = 3;
+	for (uint8_t i = 0; i < NUM_CELLS; i++)
+	{
+		c->targets[i] = i;
+	}
+	uint32_t state = random_state += 0x9E3779B9;
+	for (uint8_t i = NUM_CELLS - 1; i > 0; i--)
+	{
+		uint8_t j = next_random(&state) % (i + 1);
+		uint8_t t = c->targets[i];
+		c->targets[i] = c->targets[j];
+		c->targets[j] = t;
+	}
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = c };
+	return epoll_ctl(epoll, EPOLL_CTL_ADD, c->fd, &event);
+}
+
+// The next key to press: 's' to start, then a step towards the next cell
+// to fire at, or 'f' once the cursor is on it
+static char next_key(Client* c)
+{
+	if (!c->started)
+	{
+		c->started = 1;
+		return 's';
+	}
+	int8_t x = c->targets[c->fired] % 8;
+	int8_t y = c->targets[c->fired] / 8;
+	// d and a move right and left, w and s up and down (see keymap.c)
+	if (c->x != x)
+	{
+		int8_t dx = c->x < x ? 1 : -1;
+		c->x += dx;
+		return dx > 0 ? 'd' : 'a';
+	}
+	if (c->y != y)
+	{
+		int8_t dy = c->y < y ? 1 : -1;
+		c->y += dy;
+		return dy > 0 ? 'w' : 's';
+	}
+	c->fired++;
+	return 'f';
+}
+
+static void record(Worker* w, uint32_t latency)
+{
+	if (w->num_latencies == w->latencies_size)
+	{
+		w->latencies_size = w->latencies_size ? w->latencies_size * 2 : 4096;
+		w->latencies = realloc(w->latencies,
+				w->latencies_size * sizeof(uint32_t));
+		if (!w->latencies)
+		{
+			fprintf(stderr, "loadgen: out of memory\n");
+			exit(2);
+		}
+	}
+	w->latencies[w->num_latencies++] = latency;
+}
+
+// Match text against pattern a character at a time, matched being how
+// much of it has been seen so far. Neither pattern repeats its first
+// character, so a mismatch can start again from there.
+static uint8_t match(const char* pattern, uint8_t* matched, char c)
+{
+	if (c == pattern[*matched])
+	{
+		(*matched)++;
+	} else
+	{
+		*matched = c == pattern[0];
+	}
+	if (pattern[*matched] == 0)
+	{
+		*matched = 0;
+		return 1;
+	}
+	return 0;
+}
+
+static int send_key(Worker* w, Client* c)
+{
+	char key = next_key(c);
+	c->sent_at = now_us();
+	if (send(c->fd, &key, 1, MSG_NOSIGNAL) != 1)
+	{
+		return -1;
+	}
+	w->keys++;
+	return 0;
+}
+
+static void hang_up(int epoll, Client* c)
+{
+	epoll_ctl(epoll, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+}
+
+// Read what has come back for client c, and send it the next key once
+// the whole screen is in
+static void serve(Worker* w, int epoll, Client* c)
+{
+	char input[4096];
+	ssize_t n = recv(c->fd, input, sizeof(input), MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+	{
+		return;
+	}
+	if (n <= 0)
+	{
+		w->errors++;
+		hang_up(epoll, c);
+		return;
+	}
+	if (c->sent_at)
+	{
+		record(w, now_us() - c->sent_at);
+		c->sent_at = 0;
+	}
+	uint8_t screens = 0;
+	for (ssize_t i = 0; i < n; i++)
+	{
+		c->over |= match(SERVER_GAME_OVER, &c->over_matched, input[i]);
+		screens += match(SERVER_FRAME_END, &c->end_matched, input[i]);
+	}
+	if (!screens)
+	{
+		return;
+	}
+	if (c->over)
+	{
+		w->sessions++;
+		hang_up(epoll, c);
+		if (now_us() < deadline && connect_client(epoll, c))
+		{
+			w->errors++;
+		}
+		return;
+	}
+	if (now_us() < deadline && send_key(w, c))
+	{
+		w->errors++;
+		hang_up(epoll, c);
+	}
+}
+
+static void* worker_main(void* arg)
+{
+	Worker* w = arg;
+	int epoll = epoll_create1(EPOLL_CLOEXEC);
+	uint32_t connected = 0;
+	for (uint32_t i = 0; i < w->num_clients; i++)
+	{
+		if (connect_client(epoll, &clients[w->first_client + i]) == 0)
+		{
+			connected++;
+		} else
+		{
+			w->errors++;
+		}
+	}
+	struct epoll_event events[MAX_EVENTS];
+	while (connected && now_us() < deadline)
+	{
+		int n = epoll_wait(epoll, events, MAX_EVENTS, 100);
+		for (int i = 0; i < n; i++)
+		{
+			serve(w, epoll, events[i].data.ptr);
+		}
+	}
+	for (uint32_t i = 0; i < w->num_clients; i++)
+	{
+		if (clients[w->first_client + i].fd >= 0)
+		{
+			close(clients[w->first_client + i].fd);
+		}
+	}
+	close(epoll);
+	return NULL;
+}
+
+static int compare(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char** argv)
+{
+	const char* path = SERVER_SOCKET;
+	uint32_t num_clients = 200;
+	uint32_t seconds = 10;
+	uint32_t num_threads = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:c:d:j:")) != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				path = optarg;
+				break;
+			case 'c':
+				num_clients = strtoul(optarg, NULL, 0);
+				break;
+			case 'd':
+				seconds = strtoul(optarg, NULL, 0);
+				break;
+			case 'j':
+				num_threads = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-s socket] [-c clients] "
+						"[-d seconds] [-j threads]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (num_threads < 1)
+	{
+		num_threads = 1;
+	}
+	if (num_threads > num_clients)
+	{
+		num_threads = num_clients ? num_clients : 1;
+	}
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "%s: socket path too long\n", argv[0]);
+		return 2;
+	}
+	strcpy(address.sun_path, path);
+
+	struct rlimit files;
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0)
+	{
+		files.rlim_cur = files.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &files);
+	}
+
+	clients = calloc(num_clients, sizeof(Client));
+	Worker* workers = calloc(num_threads, sizeof(Worker));
+	if (!clients || !workers)
+	{
+		fprintf(stderr, "%s: out of memory\n", argv[0]);
+		return 2;
+	}
+	uint64_t start = now_us();
+	deadline = start + (uint64_t)seconds * 1000000;
+	for (uint32_t t = 0; t < num_threads; t++)
+	{
+		workers[t].first_client = num_clients * t / num_threads;
+		workers[t].num_clients =
+				num_clients * (t + 1) / num_threads - workers[t].first_client;
+		if (pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]))
+		{
+			perror("pthread_create");
+			return 2;
+		}
+	}
+
+	uint32_t sessions = 0, keys = 0, errors = 0;
+	size_t num_latencies = 0;
+	for (uint32_t t = 0; t < num_threads; t++)
+	{
+		pthread_join(workers[t].thread, NULL);
+		sessions += workers[t].sessions;
+		keys += workers[t].keys;
+		errors += workers[t].errors;
+		num_latencies += workers[t].num_latencies;
+	}
+	double elapsed = (now_us() - start) * 1e-6;
+
+	uint32_t* latencies = malloc((num_latencies + 1) * sizeof(uint32_t));
+	if (!latencies)
+	{
+		fprintf(stderr, "%s: out of memory\n", argv[0]);
+		return 2;
+	}
+	size_t n = 0;
+	for (uint32_t t = 0; t < num_threads; t++)
+	{
+		memcpy(&latencies[n], workers[t].latencies,
+				workers[t].num_latencies * sizeof(uint32_t));
+		n += workers[t].num_latencies;
+		free(workers[t].latencies);
+	}
+	qsort(latencies, n, sizeof(uint32_t), compare);
+
+	printf("%u clients, %.1f s: %u sessions handled, %u keys (%.0f/s), "
+			"%u errors\n", num_clients, elapsed, sessions, keys, keys / elapsed,
+			errors);
+	if (n)
+	{
+		printf("latency: p50 %u us, p99 %u us, max %u us\n",
+				latencies[n / 2], latencies[n * 99 / 100], latencies[n - 1]);
+	}
+	return sessions == 0 || errors != 0;
+}
@@ -0,0 +1,748 @@
+/*
+ * server.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Runs many independent games of Battleship in one process on the host,
+ * one for each client connected to a Unix socket. A client's terminal is
+ * driven as the device drives its own: the same keys (see keymap.c)
+ * choose the fleet and mode and play the game, the messages are in the
+ * same places, and the LED matrix is drawn above the battle log. Connect
+ * a terminal with
+ *
+ *   socat -,raw,echo=0 UNIX-CONNECT:/tmp/battleship.sock
+ *
+ * A session is the game's GameState, the AiState playing it (see game.h)
+ * and a few bytes more; no output is buffered for it. The screen is drawn
+ * whole from the game after each read of input, so if the client's socket
+ * is full the server only remembers how much of the screen went, and
+ * draws the same screen again to send the rest once there is room. Input
+ * isn't read meanwhile, so a client that doesn't read holds nothing more
+ * than its session.
+ *
+ * The screen is the server's own drawing of the session's GameState, not
+ * what the device would send: the device's terminal output is one stream
+ * that is only ever added to (scroll regions, cursor moves, lines that
+ * scroll away), which would have to be kept for each session and sent to
+ * a client that reconnects or falls behind, while a drawing of the state
+ * is the same size whenever it is sent. It is laid out as the device lays
+ * out its terminal, with the LED matrix drawn above the battle log.
+ *
+ * The sessions are shared out between a small pool of threads, each with
+ * an epoll set of its own, by whichever thread accepts the client. A
+ * session is only ever played by the thread that accepted it, and the
+ * game (game.c and the AI) only touches the session's own state: the LED
+ * matrix, terminal, telemetry and link it would drive are stood in for by
+ * headless.c, which touches nothing. So no thread waits for another.
+ *
+ * Usage: battleship_server [-s socket] [-j threads] [-r seconds]
+ *
+ *   -s socket   socket to listen on (default /tmp/battleship.sock)
+ *   -j threads  number of threads (default: one per CPU)
+ *   -r seconds  report the sessions and memory every so many seconds as
+ *               well as at the end (default 0, only at the end)
+ *
+ * Runs until SIGINT or SIGTERM.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ai.h"
+#include "fleets.h"
+#include "game.h"
+#include "keymap.h"
+#include "server.h"
+
+#define NUM_SHIPS 6
+
+// Epoll events handled at a time, clients accepted at a time (so that the
+// other threads get some), and how long a thread waits before checking
+// whether the server is stopping, in milliseconds
+#define MAX_EVENTS 64
+#define MAX_ACCEPTS 16
+#define WAIT_MS 200
+
+// Input read at a time, and the most a screen can take
+#define INPUT_SIZE 64
+#define SCREEN_SIZE 8192
+
+// What a session is showing
+#define SCREEN_START 0
+#define SCREEN_GAME 1
+#define SCREEN_OVER 2
+
+typedef struct {
+	GameState game;
+	AiState ai;
+	int fd;
+	// while sending is set, the bytes of the screen already sent, the
+	// rest waiting for room in the socket
+	uint16_t sent;
+	uint8_t sending;
+	uint8_t screen;
+	// the sunken ships, in the order they sank: the player (as for
+	// check_for_sunken_ships()) in bit 3 and the ship type below it
+	uint8_t log_length;
+	uint8_t log[2 * NUM_SHIPS];
+} Session;
+
+// A thread of the pool. The counts are read by the main thread for the
+// reports.
+typedef struct {
+	pthread_t thread;
+	int epoll;
+	uint32_t active;
+	uint32_t handled;
+	uint32_t games;
+	uint32_t keys;
+	char screen[SCREEN_SIZE];
+} Worker;
+
+static const char* const ship_names[SHIP_MASK + 1] = {
+	"", "Carrier", "Cruiser", "Destroyer", "Frigate", "Corvette",
+	"Submarine", ""
+};
+
+static int listener;
+static volatile sig_atomic_t stopping;
+static FILE* out;
+
+static void stop(int signal_number)
+{
+	(void)signal_number;
+	stopping = 1;
+}
+
+static uint32_t count(const uint32_t* counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void add(uint32_t* counter, int32_t n)
+{
+	__atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Drawing the screen
+ */
+
+typedef struct {
+	char* text;
+	size_t length;
+} Screen;
+
+static void put(Screen* screen, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(&screen->text[screen->length],
+			SCREEN_SIZE - screen->length, format, args);
+	va_end(args);
+	if (n > 0)
+	{
+		screen->length += n;
+		if (screen->length >= SCREEN_SIZE)
+		{
+			screen->length = SCREEN_SIZE - 1;
+		}
+	}
+}
+
+// Bit n set for each ship type n that has been sunk on grid
+static uint8_t sunk_ships(uint8_t grid[GRID_NUM_ROWS][GRID_NUM_COLUMNS])
+{
+	uint8_t sunk = 0;
+	for (uint8_t row = 0; row < GRID_NUM_ROWS; row++)
+	{
+		for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++)
+		{
+			if (grid[row][col] & SUNK)
+			{
+				sunk |= 1 << (grid[row][col] & SHIP_MASK);
+			}
+		}
+	}
+	return sunk;
+}
+
+static uint8_t bit_count(uint8_t bits)
+{
+	uint8_t n = 0;
+	for (; bits; bits &= bits - 1)
+	{
+		n++;
+	}
+	return n;
+}
+
+// The shots in the human's salvo, as game.c works it out: one for each
+// ship afloat, but no more than there are cells left to fire at
+static uint8_t salvo_size(const GameState* game)
+{
+	uint8_t afloat = 0;
+	uint8_t cells = 0;
+	for (uint8_t row = 0; row < GRID_NUM_ROWS; row++)
+	{
+		for (uint8_t col = 0; col < GRID_NUM_COLUMNS; col++)
+		{
+			uint8_t cell = game->human_grid[row][col];
+			if ((cell & SHIP_MASK) && !(cell & SUNK))
+			{
+				afloat |= 1 << (cell & SHIP_MASK);
+			}
+			cells += !(game->computer_grid[row][col] & HIT);
+		}
+	}
+	uint8_t shots = bit_count(afloat);
+	return shots < cells ? shots : cells;
+}
+
+// The colour pixel (x, y) of the LED matrix shows, as game.c draws it
+static PixelColour pixel(const GameState* game, uint8_t x, uint8_t y)
+{
+	if (x < GRID_NUM_COLUMNS)
+	{
+		uint8_t cell = game->human_grid[y][x];
+		if (cell & HIT)
+		{
+			return (cell & SHIP_MASK) ? COLOUR_RED : COLOUR_GREEN;
+		}
+		return (cell & SHIP_MASK) ? COLOUR_ORANGE : COLOUR_BLACK;
+	}
+
+	// the computer's grid is drawn upside down, with the cursor on it
+	x -= GRID_NUM_COLUMNS;
+	uint8_t row = 7 - y;
+	uint8_t cell = game->computer_grid[row][x];
+	if (x == game->cursor_x && y == game->cursor_y)
+	{
+		return (cell & HIT) ? COLOUR_DARK_YELLOW : COLOUR_YELLOW;
+	}
+	if (cell & HIT)
+	{
+		return (cell & SHIP_MASK) ? COLOUR_RED : COLOUR_GREEN;
+	}
+	return (game->salvo_aim[row] & (1 << x)) ? COLOUR_ORANGE : COLOUR_BLACK;
+}
+
+// Draw the matrix as matrix_model_render() does, row 7 at the top
+static void draw_matrix(const GameState* game, Screen* screen)
+{
+	for (int8_t y = MATRIX_NUM_ROWS - 1; y >= 0; y--)
+	{
+		int16_t last = -1;
+		for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++)
+		{
+			// 4 bits of green in the high nibble, red in the low
+			PixelColour colour = pixel(game, x, y);
+			if (colour != last)
+			{
+				put(screen, "\x1b[48;2;%d;%d;0m", (colour & 0x0F) * 17,
+						(colour >> 4) * 17);
+				last = colour;
+			}
+			put(screen, "  ");
+		}
+		put(screen, "\x1b[0m\x1b[K\r\n");
+	}
+}
+
+static void draw_start(const Session* s, Screen* screen)
+{
+	put(screen, "\x1b[K\r\n\x1b[K\r\n\x1b[K\r\n");
+	put(screen, "\x1b[10GBATTLESHIP\x1b[K\r\n\x1b[K\r\n");
+	put(screen, "\x1b[10GFleet: %s (press 1-%d to choose)\x1b[K\r\n",
+			fleet_name(selected_fleet(&s->game)), NUM_FLEET_LAYOUTS);
+	put(screen, "\x1b[10GMode: %s (press g to change)\x1b[K\r\n",
+			mode_name(selected_mode(&s->game)));
+	put(screen, "\x1b[K\r\n\x1b[10GPress s to start\x1b[K\r\n");
+}
+
+static void draw_game(const Session* s, Screen* screen)
+{
+	const GameState* game = &s->game;
+
+	// rows 1 to 3 are as on the device: an invalid move, the salvo and
+	// game over
+	if (s->screen == SCREEN_GAME && game->invalid_moves)
+	{
+		put(screen, "Invalid move%.*s", game->invalid_moves - 1, "!!!");
+	}
+	put(screen, "\x1b[K\r\n");
+	if (game->mode == MODE_SALVO && s->screen == SCREEN_GAME)
+	{
+		uint8_t aimed = 0;
+		for (uint8_t row = 0; row < GRID_NUM_ROWS; row++)
+		{
+			aimed += bit_count(game->salvo_aim[row]);
+		}
+		put(screen, "Salvo %u/%u ", aimed, salvo_size(game));
+	}
+	put(screen, "\x1b[K\r\n");
+	if (s->screen == SCREEN_OVER)
+	{
+		put(screen, SERVER_GAME_OVER " Press s to start a new game");
+	}
+	put(screen, "\x1b[K\r\n\x1b[K\r\n");
+
+	draw_matrix(game, screen);
+	put(screen, "\x1b[K\r\n");
+
+	// the battle log, right aligned against column 80 for the human's
+	// ships sunk and from column 20 for the computer's, as on the device
+	for (uint8_t i = 0; i < s->log_length; i++)
+	{
+		uint8_t player = s->log[i] >> 3;
+		const char* name = ship_names[s->log[i] & SHIP_MASK];
+		if (player)
+		{
+			put(screen, "\x1b[%uGYou Sunk My %s\x1b[K\r\n",
+					(unsigned)(80 - 12 - strlen(name)), name);
+		} else
+		{
+			put(screen, "\x1b[20GI Sunk Your %s\x1b[K\r\n", name);
+		}
+	}
+}
+
+// Draw the whole screen into the worker's buffer, returning its length
+static size_t draw_screen(const Session* s, Worker* w)
+{
+	Screen screen = { w->screen, 0 };
+	put(&screen, "\x1b[H");
+	if (s->screen == SCREEN_START)
+	{
+		draw_start(s, &screen);
+	} else
+	{
+		draw_game(s, &screen);
+	}
+	put(&screen, "\x1b[J" SERVER_FRAME_END);
+	return screen.length;
+}
+
+/*
+ * Sessions
+ */
+
+static void close_session(Worker* w, Session* s)
+{
+	epoll_ctl(w->epoll, EPOLL_CTL_DEL, s->fd, NULL);
+	close(s->fd);
+	free(s);
+	add(&w->active, -1);
+	add(&w->handled, 1);
+}
+
+static int watch(Worker* w, Session* s, int op, uint32_t events)
+{
+	struct epoll_event event = { .events = events, .data.ptr = s };
+	return epoll_ctl(w->epoll, op, s->fd, &event);
+}
+
+// Send the rest of the screen. Returns -1 if the client has gone.
+static int send_screen(Worker* w, Session* s)
+{
+	size_t length = draw_screen(s, w);
+	if (!s->sending)
+	{
+		s->sent = 0;
+	}
+	while (s->sent < length)
+	{
+		ssize_t n = send(s->fd, &w->screen[s->sent], length - s->sent,
+				MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			// wait for room, and don't read any more input meanwhile
+			if (!s->sending)
+			{
+				s->sending = 1;
+				return watch(w, s, EPOLL_CTL_MOD, EPOLLOUT);
+			}
+			return 0;
+		}
+		if (n < 0)
+		{
+			return -1;
+		}
+		s->sent += n;
+	}
+	if (s->sending)
+	{
+		s->sending = 0;
+		return watch(w, s, EPOLL_CTL_MOD, EPOLLIN);
+	}
+	return 0;
+}
+
+static void start_game(Worker* w, Session* s)
+{
+	initialise_game(&s->game);
+	s->screen = SCREEN_GAME;
+	s->log_length = 0;
+	add(&w->games, 1);
+}
+
+// Fire, and let the computer fire back, adding any ships sunk to the log
+static void fire(Session* s)
+{
+	GameState* game = &s->game;
+	uint8_t human_sunk = sunk_ships(game->human_grid);
+	uint8_t computer_sunk = sunk_ships(game->computer_grid);
+
+	// the search the device does while the human thinks
+	ai_finish(&s->ai);
+	player_turn(game);
+
+	computer_sunk ^= sunk_ships(game->computer_grid);
+	human_sunk ^= sunk_ships(game->human_grid);
+	for (uint8_t ship = CARRIER; ship <= SUBMARINE; ship++)
+	{
+		if (computer_sunk & (1 << ship))
+		{
+			s->log[s->log_length++] = 1 << 3 | ship;
+		}
+	}
+	for (uint8_t ship = CARRIER; ship <= SUBMARINE; ship++)
+	{
+		if (human_sunk & (1 << ship))
+		{
+			s->log[s->log_length++] = ship;
+		}
+	}
+	if (is_game_over(game))
+	{
+		s->screen = SCREEN_OVER;
+	}
+}
+
+static void move(Session* s, int8_t dx, int8_t dy)
+{
+	move_cursor(&s->game, dx, dy);
+}
+
+static void handle_key(Worker* w, Session* s, uint8_t key)
+{
+	Event event = { EVENT_SERIAL, key, 0 };
+	if (s->screen != SCREEN_GAME)
+	{
+		switch (event_action(&event, start_keymap))
+		{
+			case ACTION_START:
+				start_game(w, s);
+				break;
+			case ACTION_SELECT_FLEET:
+				if (s->screen == SCREEN_START)
+				{
+					select_fleet(&s->game, key - '1');
+				}
+				break;
+			case ACTION_SELECT_MODE:
+				// there is no other board to play over a link
+				if (s->screen == SCREEN_START)
+				{
+					uint8_t mode = selected_mode(&s->game) + 1;
+					select_mode(&s->game, mode == MODE_LINK ? mode + 1 : mode);
+				}
+				break;
+		}
+		return;
+	}
+	switch (event_action(&event, game_keymap))
+	{
+		case ACTION_MOVE_RIGHT:
+			move(s, 1, 0);
+			break;
+		case ACTION_MOVE_DOWN:
+			move(s, 0, -1);
+			break;
+		case ACTION_MOVE_UP:
+			move(s, 0, 1);
+			break;
+		case ACTION_MOVE_LEFT:
+			move(s, -1, 0);
+			break;
+		case ACTION_FIRE:
+			fire(s);
+			break;
+	}
+}
+
+static void serve(Worker* w, Session* s, uint32_t events)
+{
+	if (s->sending)
+	{
+		if ((events & (EPOLLERR | EPOLLHUP)) || send_screen(w, s))
+		{
+			close_session(w, s);
+		}
+		return;
+	}
+
+	uint8_t input[INPUT_SIZE];
+	ssize_t n = recv(s->fd, input, sizeof(input), 0);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+	{
+		return;
+	}
+	if (n <= 0)
+	{
+		close_session(w, s);
+		return;
+	}
+	for (ssize_t i = 0; i < n; i++)
+	{
+		handle_key(w, s, input[i]);
+	}
+	add(&w->keys, n);
+	if (send_screen(w, s))
+	{
+		close_session(w, s);
+	}
+}
+
+static void accept_clients(Worker* w)
+{
+	for (uint8_t i = 0; i < MAX_ACCEPTS; i++)
+	{
+		int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+		{
+			return;
+		}
+		Session* s = calloc(1, sizeof(Session));
+		if (!s)
+		{
+			close(fd);
+			continue;
+		}
+		init_game_state(&s->game, &s->ai);
+		s->fd = fd;
+		if (watch(w, s, EPOLL_CTL_ADD, EPOLLIN))
+		{
+			close(fd);
+			free(s);
+			continue;
+		}
+		add(&w->active, 1);
+		if (send_screen(w, s))
+		{
+			close_session(w, s);
+		}
+	}
+}
+
+static void* worker_main(void* arg)
+{
+	Worker* w = arg;
+	struct epoll_event events[MAX_EVENTS];
+	while (!stopping)
+	{
+		int n = epoll_wait(w->epoll, events, MAX_EVENTS, WAIT_MS);
+		for (int i = 0; i < n; i++)
+		{
+			if (events[i].data.ptr)
+			{
+				serve(w, events[i].data.ptr, events[i].events);
+			} else
+			{
+				accept_clients(w);
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Reports
+ */
+
+static long rss_bytes(void)
+{
+	long pages = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		if (fscanf(statm, "%*d %ld", &pages) != 1)
+		{
+			pages = 0;
+		}
+		fclose(statm);
+	}
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+typedef struct {
+	long rss_start;
+	uint32_t peak_sessions;
+	long peak_rss;
+} Memory;
+
+static void report(Worker* workers, int num_workers, Memory* memory,
+		uint8_t show)
+{
+	uint32_t active = 0, handled = 0, games = 0, keys = 0;
+	for (int t = 0; t < num_workers; t++)
+	{
+		active += count(&workers[t].active);
+		handled += count(&workers[t].handled);
+		games += count(&workers[t].games);
+		keys += count(&workers[t].keys);
+	}
+	long rss = rss_bytes() - memory->rss_start;
+	if (active > memory->peak_sessions)
+	{
+		memory->peak_sessions = active;
+		memory->peak_rss = rss;
+	}
+	if (!show)
+	{
+		return;
+	}
+	fprintf(out, "%u sessions (%u handled), %u games, %u keys, rss %+ld KB",
+			active, handled, games, keys, rss / 1024);
+	if (memory->peak_sessions)
+	{
+		fprintf(out, "; peak %u sessions, rss %+ld KB, %ld bytes a session",
+				memory->peak_sessions, memory->peak_rss / 1024,
+				memory->peak_rss / (long)memory->peak_sessions);
+	}
+	fprintf(out, "\n");
+	fflush(out);
+}
+
+int main(int argc, char** argv)
+{
+	const char* path = SERVER_SOCKET;
+	int num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	int report_seconds = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:j:r:")) != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				path = optarg;
+				break;
+			case 'j':
+				num_workers = atoi(optarg);
+				break;
+			case 'r':
+				report_seconds = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-s socket] [-j threads] "
+						"[-r seconds]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (num_workers < 1)
+	{
+		num_workers = 1;
+	}
+
+	// stdout is the device's terminal on the host, which nothing the game
+	// calls here should print to: keep it quiet all the same, and report
+	// on a copy
+	out = fdopen(dup(fileno(stdout)), "w");
+	if (!out || !freopen("/dev/null", "w", stdout))
+	{
+		return 2;
+	}
+
+	// a file descriptor for each session
+	struct rlimit files;
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0)
+	{
+		files.rlim_cur = files.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &files);
+	}
+
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "%s: socket path too long\n", argv[0]);
+		return 2;
+	}
+	strcpy(address.sun_path, path);
+	unlink(path);
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listener < 0 ||
+			bind(listener, (struct sockaddr*)&address, sizeof(address)) ||
+			listen(listener, SOMAXCONN))
+	{
+		perror(path);
+		return 2;
+	}
+
+	struct sigaction action = { .sa_handler = stop };
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	// every thread waits for clients, and only one is woken for each
+	Worker* workers = calloc(num_workers, sizeof(Worker));
+	if (!workers)
+	{
+		fprintf(stderr, "%s: out of memory\n", argv[0]);
+		return 2;
+	}
+	for (int t = 0; t < num_workers; t++)
+	{
+		struct epoll_event event = { .events = EPOLLIN | EPOLLEXCLUSIVE };
+		workers[t].epoll = epoll_create1(EPOLL_CLOEXEC);
+		if (workers[t].epoll < 0 ||
+				epoll_ctl(workers[t].epoll, EPOLL_CTL_ADD, listener, &event))
+		{
+			perror("epoll");
+			return 2;
+		}
+		if (pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]))
+		{
+			perror("pthread_create");
+			return 2;
+		}
+	}
+
+	Memory memory = { rss_bytes(), 0, 0 };
+	fprintf(out, "listening on %s with %d threads, %zu bytes a session\n",
+			path, num_workers, sizeof(Session));
+	fflush(out);
+	// check for a new peak every 100ms
+	struct timespec tick = { 0, 100000000 };
+	uint32_t ticks = 0;
+	while (!stopping)
+	{
+		nanosleep(&tick, NULL);
+		ticks++;
+		report(workers, num_workers, &memory,
+				report_seconds && ticks % (report_seconds * 10) == 0);
+	}
+	for (int t = 0; t < num_workers; t++)
+	{
+		pthread_join(workers[t].thread, NULL);
+	}
+	report(workers, num_workers, &memory, 1);
+	unlink(path);
+	return 0;
+}
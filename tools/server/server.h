@@ -0,0 +1,24 @@
+/*
+ * server.h
+ *
+ * Author: Andrew Wilson
+ *
+ * What the game server (server.c) and its load generator (loadgen.c)
+ * agree on.
+ */
+
+#ifndef SERVER_H_
+#define SERVER_H_
+
+// Where the server listens unless told otherwise
+#define SERVER_SOCKET "/tmp/battleship.sock"
+
+// Every screen the server sends ends with this (it hides the terminal's
+// cursor, and appears nowhere else), so a client can tell when it has
+// all of one
+#define SERVER_FRAME_END "\x1b[?25l"
+
+// Shown once a game is over, until the next one starts
+#define SERVER_GAME_OVER "Game over!"
+
+#endif /* SERVER_H_ */
@@ -0,0 +1,394 @@
+/*
+ * bench.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Cycle accurate benchmarks for the battleship firmware. Runs the real
+ * battleship.elf under simavr, feeds it UART keystrokes and button edges
+ * from a script and records how many CPU cycles each step takes until the
+ * firmware has finished reacting to it. Results are written as JSON;
+ * compare.py checks them against a stored baseline.
+ *
+ * Usage: simavr_bench [-o results.json] firmware.elf script.bench
+ *
+ * A step is over when neither the SPI bus (LED matrix) nor the UART have
+ * produced output for SETTLE_CYCLES (BUTTON_SETTLE_CYCLES for a button,
+ * which is only seen once it has been debounced). Its cost is the number of cycles
+ * from the input to the last byte of output. The cursor flashing every
+ * 200ms can land inside a step, so look at the minimum as well as the
+ * mean.
+ *
+ * Script commands, one per line ('#' starts a comment):
+ *   settle NAME          run until quiet, recorded as NAME (e.g. boot)
+ *   key C                send character C and wait until quiet, unrecorded
+ *   measure NAME C       send character C and record the step as NAME. If
+ *                        the terminal output of the step contains
+ *                        "You Sunk", it is recorded as "sink" instead.
+ *   press N / release N  push or release button N (0 to 3) and record the
+ *                        step as "button"
+ *   begin NAME           start a span
+ *   end NAME             record the cycles since "begin NAME"
+ *   repeat N ... done    run the enclosed commands N times
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_spi.h>
+#include <simavr/avr_uart.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+
+#define CPU_FREQUENCY 8000000
+// 2ms without output means the firmware has finished with a step
+#define SETTLE_CYCLES (CPU_FREQUENCY / 500)
+// Buttons are debounced over 16ms, so allow 40ms for the first output
+#define BUTTON_SETTLE_CYCLES (CPU_FREQUENCY / 25)
+// No step should take longer than 5s
+#define STEP_LIMIT_CYCLES (CPU_FREQUENCY * 5ULL)
+
+#define MAX_METRICS 32
+#define MAX_SPANS 8
+#define MAX_LINES 1024
+#define TEXT_WINDOW 256
+
+typedef struct {
+	char name[32];
+	uint32_t count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	uint64_t spi_bytes;
+	uint64_t uart_bytes;
+} Metric;
+
+typedef struct {
+	char name[32];
+	avr_cycle_count_t start;
+} Span;
+
+static avr_t* avr;
+static avr_irq_t* uart_input;
+static avr_irq_t* button_pins[4];
+
+static avr_cycle_count_t last_activity;
+static uint64_t spi_bytes;
+static uint64_t uart_bytes;
+// The most recent terminal output, for recognising what a step did
+static char text[TEXT_WINDOW];
+static size_t text_length;
+
+static Metric metrics[MAX_METRICS];
+static int num_metrics;
+static Span spans[MAX_SPANS];
+static int num_spans;
+
+static void uart_output_hook(struct avr_irq_t* irq, uint32_t value,
+		void* param)
+{
+	(void)irq;
+	(void)param;
+	last_activity = avr->cycle;
+	uart_bytes++;
+	if (text_length < TEXT_WINDOW - 1)
+	{
+		text[text_length++] = (char)value;
+		text[text_length] = '\0';
+	}
+}
+
+static void spi_output_hook(struct avr_irq_t* irq, uint32_t value,
+		void* param)
+{
+	(void)irq;
+	(void)value;
+	(void)param;
+	last_activity = avr->cycle;
+	spi_bytes++;
+}
+
+static Metric* find_metric(const char* name)
+{
+	for (int i = 0; i < num_metrics; i++)
+	{
+		if (strcmp(metrics[i].name, name) == 0)
+		{
+			return &metrics[i];
+		}
+	}
+	if (num_metrics == MAX_METRICS)
+	{
+		fprintf(stderr, "simavr_bench: too many metrics\n");
+		exit(2);
+	}
+	Metric* metric = &metrics[num_metrics++];
+	snprintf(metric->name, sizeof(metric->name), "%s", name);
+	metric->min = UINT64_MAX;
+	return metric;
+}
+
+static void record(const char* name, uint64_t cycles, uint64_t spi,
+		uint64_t uart)
+{
+	Metric* metric = find_metric(name);
+	metric->count++;
+	metric->total += cycles;
+	metric->spi_bytes += spi;
+	metric->uart_bytes += uart;
+	if (cycles < metric->min)
+	{
+		metric->min = cycles;
+	}
+	if (cycles > metric->max)
+	{
+		metric->max = cycles;
+	}
+}
+
+/* Run until there has been no output for quiet cycles, returning the
+ * number of cycles from start to the last output (0 if there was none) */
+static uint64_t run_until_settled(avr_cycle_count_t start,
+		avr_cycle_count_t quiet)
+{
+	last_activity = start;
+	while (avr->cycle - last_activity < quiet)
+	{
+		int state = avr_run(avr);
+		if (state == cpu_Done || state == cpu_Crashed)
+		{
+			fprintf(stderr, "simavr_bench: firmware stopped (state %d)\n",
+					state);
+			exit(2);
+		}
+		if (avr->cycle - start > STEP_LIMIT_CYCLES)
+		{
+			fprintf(stderr, "simavr_bench: step did not settle\n");
+			exit(2);
+		}
+	}
+	return last_activity - start;
+}
+
+/* Apply an input, wait for the firmware to finish with it and record the
+ * step under name (unless name is NULL) */
+static void step(const char* name, int character, int button, int level)
+{
+	uint64_t spi_before = spi_bytes;
+	uint64_t uart_before = uart_bytes;
+	text_length = 0;
+	text[0] = '\0';
+	
+	avr_cycle_count_t start = avr->cycle;
+	avr_cycle_count_t quiet = SETTLE_CYCLES;
+	if (character >= 0)
+	{
+		avr_raise_irq(uart_input, (uint8_t)character);
+	} else
+	{
+		avr_raise_irq(button_pins[button], level);
+		quiet = BUTTON_SETTLE_CYCLES;
+	}
+	uint64_t cycles = run_until_settled(start, quiet);
+	
+	if (name)
+	{
+		if (strstr(text, "You Sunk"))
+		{
+			name = "sink";
+		}
+		record(name, cycles, spi_bytes - spi_before,
+				uart_bytes - uart_before);
+	}
+}
+
+static Span* find_span(const char* name, int create)
+{
+	for (int i = 0; i < num_spans; i++)
+	{
+		if (strcmp(spans[i].name, name) == 0)
+		{
+			return &spans[i];
+		}
+	}
+	if (!create || num_spans == MAX_SPANS)
+	{
+		return NULL;
+	}
+	Span* span = &spans[num_spans++];
+	snprintf(span->name, sizeof(span->name), "%s", name);
+	return span;
+}
+
+/* Run script lines [first, last), returning the index after the last line
+ * consumed */
+static int run_lines(char lines[][128], int first, int last)
+{
+	int i = first;
+	while (i < last)
+	{
+		char command[32] = "", name[32] = "", argument[32] = "";
+		int fields = sscanf(lines[i], "%31s %31s %31s", command, name,
+				argument);
+		i++;
+		if (fields <= 0 || command[0] == '#')
+		{
+			continue;
+		}
+		if (strcmp(command, "settle") == 0)
+		{
+			avr_cycle_count_t start = avr->cycle;
+			uint64_t spi_before = spi_bytes, uart_before = uart_bytes;
+			record(name, run_until_settled(start, SETTLE_CYCLES),
+					spi_bytes - spi_before, uart_bytes - uart_before);
+		} else if (strcmp(command, "key") == 0)
+		{
+			step(NULL, name[0], 0, 0);
+		} else if (strcmp(command, "measure") == 0 && fields == 3)
+		{
+			step(name, argument[0], 0, 0);
+		} else if (strcmp(command, "press") == 0
+				|| strcmp(command, "release") == 0)
+		{
+			int button = atoi(name) & 3;
+			step("button", -1, button, command[0] == 'p');
+		} else if (strcmp(command, "begin") == 0)
+		{
+			find_span(name, 1)->start = avr->cycle;
+		} else if (strcmp(command, "end") == 0)
+		{
+			Span* span = find_span(name, 0);
+			if (span)
+			{
+				record(name, avr->cycle - span->start, 0, 0);
+			}
+		} else if (strcmp(command, "repeat") == 0)
+		{
+			// Find the matching "done"
+			int depth = 1, body = i;
+			while (i < last && depth > 0)
+			{
+				char word[32] = "";
+				sscanf(lines[i], "%31s", word);
+				depth += strcmp(word, "repeat") == 0;
+				depth -= strcmp(word, "done") == 0;
+				i++;
+			}
+			for (int n = atoi(name); n > 0; n--)
+			{
+				run_lines(lines, body, i - 1);
+			}
+		} else
+		{
+			fprintf(stderr, "simavr_bench: bad script line: %s",
+					lines[i - 1]);
+			exit(2);
+		}
+	}
+	return i;
+}
+
+static void write_results(FILE* out, const char* firmware)
+{
+	fprintf(out, "{\n  \"firmware\": \"%s\",\n  \"frequency\": %d,\n",
+			firmware, CPU_FREQUENCY);
+	fprintf(out, "  \"metrics\": {\n");
+	for (int i = 0; i < num_metrics; i++)
+	{
+		Metric* m = &metrics[i];
+		fprintf(out, "    \"%s\": {\"count\": %u, \"mean\": %llu, "
+				"\"min\": %llu, \"max\": %llu, \"spi_bytes\": %llu, "
+				"\"uart_bytes\": %llu}%s\n",
+				m->name, m->count,
+				(unsigned long long)(m->total / m->count),
+				(unsigned long long)m->min, (unsigned long long)m->max,
+				(unsigned long long)(m->spi_bytes / m->count),
+				(unsigned long long)(m->uart_bytes / m->count),
+				i + 1 < num_metrics ? "," : "");
+	}
+	fprintf(out, "  }\n}\n");
+}
+
+int main(int argc, char* argv[])
+{
+	const char* output = NULL;
+	int arg = 1;
+	if (argc > 2 && strcmp(argv[1], "-o") == 0)
+	{
+		output = argv[2];
+		arg = 3;
+	}
+	if (argc - arg != 2)
+	{
+		fprintf(stderr, "usage: %s [-o results.json] firmware.elf "
+				"script.bench\n", argv[0]);
+		return 2;
+	}
+	
+	elf_firmware_t firmware;
+	memset(&firmware, 0, sizeof(firmware));
+	if (elf_read_firmware(argv[arg], &firmware) != 0)
+	{
+		fprintf(stderr, "simavr_bench: can't load %s\n", argv[arg]);
+		return 2;
+	}
+	avr = avr_make_mcu_by_name("atmega324a");
+	if (!avr)
+	{
+		fprintf(stderr, "simavr_bench: simavr has no atmega324a\n");
+		return 2;
+	}
+	avr_init(avr);
+	avr->frequency = CPU_FREQUENCY;
+	avr_load_firmware(avr, &firmware);
+	
+	// Keep the firmware's output to ourselves
+	uint32_t flags = 0;
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+	
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+			UART_IRQ_OUTPUT), uart_output_hook, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0),
+			SPI_IRQ_OUTPUT), spi_output_hook, NULL);
+	uart_input = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+			UART_IRQ_INPUT);
+	for (int i = 0; i < 4; i++)
+	{
+		button_pins[i] = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), i);
+	}
+	
+	static char lines[MAX_LINES][128];
+	int num_lines = 0;
+	FILE* script = fopen(argv[arg + 1], "r");
+	if (!script)
+	{
+		fprintf(stderr, "simavr_bench: can't open %s\n", argv[arg + 1]);
+		return 2;
+	}
+	while (num_lines < MAX_LINES
+			&& fgets(lines[num_lines], sizeof(lines[0]), script))
+	{
+		num_lines++;
+	}
+	fclose(script);
+	
+	run_lines(lines, 0, num_lines);
+	
+	FILE* out = output ? fopen(output, "w") : stdout;
+	if (!out)
+	{
+		fprintf(stderr, "simavr_bench: can't write %s\n", output);
+		return 2;
+	}
+	write_results(out, argv[arg]);
+	if (output)
+	{
+		fclose(out);
+	}
+	return 0;
+}
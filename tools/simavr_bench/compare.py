@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""Compare simavr_bench results against a stored baseline.
+
+Prints each metric's mean cycles next to the baseline and flags any that
+are slower by more than the tolerance, or that move more SPI or UART bytes.
+Exits with status 1 if anything regressed, and 2 if either file is
+missing.
+
+Usage: compare.py [--tolerance 0.05] results.json baseline.json
+"""
+
+import argparse
+import json
+import os
+import sys
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("results")
+    parser.add_argument("baseline")
+    parser.add_argument("--tolerance", type=float, default=0.05,
+                        help="allowed fractional slowdown (default 0.05)")
+    args = parser.parse_args()
+
+    for path, missing in ((args.results, "run the bench target first"),
+                          (args.baseline, "record one with the bench_baseline "
+                           "target and commit it")):
+        if not os.path.exists(path):
+            print("compare.py: no %s: %s" % (path, missing), file=sys.stderr)
+            return 2
+    with open(args.results) as f:
+        results = json.load(f)["metrics"]
+    with open(args.baseline) as f:
+        baseline = json.load(f)["metrics"]
+
+    regressed = False
+    print("%-10s %12s %12s %8s" % ("metric", "baseline", "now", "change"))
+    for name in sorted(set(results) | set(baseline)):
+        if name not in results or name not in baseline:
+            print("%-10s %s" % (name, "only in " + ("results" if name in results else "baseline")))
+            continue
+        old, new = baseline[name], results[name]
+        change = (new["mean"] - old["mean"]) / old["mean"] if old["mean"] else 0.0
+        flags = []
+        if change > args.tolerance:
+            flags.append("SLOWER")
+        for kind in ("spi_bytes", "uart_bytes"):
+            if new.get(kind, 0) > old.get(kind, 0):
+                flags.append("more " + kind)
+        regressed |= bool(flags)
+        print("%-10s %12d %12d %+7.1f%% %s"
+              % (name, old["mean"], new["mean"], 100 * change, " ".join(flags)))
+    return 1 if regressed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""Static SRAM report for the battleship firmware.
+
+Parses the GNU ld map file produced by the AVR build (battleship.map) and
+prints the .data/.bss footprint of every object file, the totals and the
+SRAM left over for the stack. Exits with status 1 if any limit in the
+budget file is exceeded so it can be used as a post-build step.
+
+Usage: sram_report.py [--budget FILE] battleship.map
+"""
+
+import argparse
+import re
+import sys
+from collections import defaultdict
+
+# ATmega324A
+SRAM_SIZE = 2048
+
+# An input section line is either " .data.name  0xADDR  0xSIZE object" on
+# one line, or the section name alone followed by the address/size/object
+# on the next line when the name is too long.
+SECTION_RE = re.compile(r"^ (\.data\S*|\.rodata\S*|\.bss\S*|COMMON)(?:\s+(.*))?$")
+PLACEMENT_RE = re.compile(r"^\s*0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(.+)$")
+OUTPUT_RE = re.compile(r"^(\.data|\.bss|\.noinit)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)")
+
+
+def module_name(path):
+    """Reduce an object path (possibly inside a library) to a short name."""
+    path = path.strip().replace("\\", "/")
+    match = re.search(r"([^/]+\.a)\(([^)]+)\)$", path)
+    if match:
+        return "%s(%s)" % (match.group(1), match.group(2))
+    return path.rsplit("/", 1)[-1]
+
+
+def parse_map(lines):
+    """Return ({output_section: size}, {module: {"data": n, "bss": n}})."""
+    totals = {}
+    modules = defaultdict(lambda: {"data": 0, "bss": 0})
+    current = None
+    pending = None
+    for line in lines:
+        line = line.rstrip("\n")
+        match = OUTPUT_RE.match(line)
+        if match:
+            current = match.group(1)
+            totals[current] = int(match.group(3), 16)
+            pending = None
+            continue
+        if current is None:
+            continue
+        if line and not line.startswith(" "):
+            # Some other output section - stop attributing to .data/.bss
+            current = None
+            continue
+        match = SECTION_RE.match(line)
+        if match:
+            pending = None
+            rest = match.group(2)
+            if rest is None:
+                pending = match.group(1)
+                continue
+            line = rest
+        elif pending is None:
+            continue
+        match = PLACEMENT_RE.match(line)
+        pending = None
+        if not match:
+            continue
+        address, size = int(match.group(1), 16), int(match.group(2), 16)
+        # Discarded sections are listed at address 0 outside RAM
+        if size == 0 or address < 0x800000:
+            continue
+        kind = "data" if current == ".data" else "bss"
+        modules[module_name(match.group(3))][kind] += size
+    return totals, modules
+
+
+def load_budget(path):
+    """Read "key = value" lines; # starts a comment."""
+    budget = {}
+    with open(path) as f:
+        for line in f:
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            key, value = (part.strip() for part in line.split("=", 1))
+            budget[key] = int(value, 0)
+    return budget
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("map", help="linker map file (battleship.map)")
+    parser.add_argument("--budget", help="budget file (see sram_budget.cfg)")
+    args = parser.parse_args()
+
+    with open(args.map, errors="replace") as f:
+        totals, modules = parse_map(f)
+
+    data = totals.get(".data", 0)
+    bss = totals.get(".bss", 0)
+    noinit = totals.get(".noinit", 0)
+    static = data + bss + noinit
+    free = SRAM_SIZE - static
+
+    print("%-40s %6s %6s" % ("module", "data", "bss"))
+    for name, sizes in sorted(modules.items(),
+                              key=lambda item: -(item[1]["data"] + item[1]["bss"])):
+        print("%-40s %6d %6d" % (name, sizes["data"], sizes["bss"]))
+    print("%-40s %6d %6d" % ("total", data, bss))
+    print("static %d bytes, %d bytes of %d left for stack and heap"
+          % (static, free, SRAM_SIZE))
+
+    if not args.budget:
+        return 0
+
+    budget = load_budget(args.budget)
+    failures = []
+    checks = [("max_data", data), ("max_bss", bss), ("max_static", static)]
+    for key, value in checks:
+        if key in budget and value > budget[key]:
+            failures.append("%s: %d > %d" % (key, value, budget[key]))
+    if "min_free" in budget and free < budget["min_free"]:
+        failures.append("min_free: %d < %d" % (free, budget["min_free"]))
+    for key, limit in budget.items():
+        if key.startswith("module."):
+            name = key[len("module."):]
+            used = modules[name]["data"] + modules[name]["bss"] if name in modules else 0
+            if used > limit:
+                failures.append("%s: %d > %d" % (key, used, limit))
+
+    for failure in failures:
+        print("error: SRAM budget exceeded - %s" % failure, file=sys.stderr)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
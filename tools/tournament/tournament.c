@@ -0,0 +1,651 @@
+/*
+ * tournament.c
+ *
+ * Author: Andrew Wilson
+ *
+ * Plays computer player strategies against each other on the host, round
+ * robin, and reports how many shots each takes to sink a fleet and who
+ * beats whom. The strategies are:
+ *
+ *   raster  the original computer_turn(): the first cell not fired at,
+ *           top row first
+ *   random  any cell not fired at
+ *   hunt    cells of one colour of a checkerboard at random until a hit,
+ *           then the cells next to the hits that aren't sunk
+ *   ai      the firmware's computer player (battleship/ai.h), searching
+ *           to the end for every move
+ *
+ * Game g of every match is played on the same two random fleets (all six
+ * ships, not touching, as in fleets.c), and the random strategies are
+ * seeded from the game too, so everything follows from the seed. A
+ * strategy's shots on a fleet don't depend on its opponent, so each
+ * strategy plays each fleet once and the matches are scored from that:
+ * the player with fewer shots wins, and a tie goes to whoever fired first,
+ * which alternates from game to game.
+ *
+ * The games are shared out between threads in chunks, and a thread that
+ * runs out of chunks steals them from the others.
+ *
+ * Usage: tournament [-g games] [-s seed] [-j threads] [strategy...]
+ *
+ *   -g games    games per match (default 1000)
+ *   -s seed     seed for the fleets and random strategies (default 1)
+ *   -j threads  number of threads (default: one per CPU)
+ *   strategy    the strategies to play (default: all of them)
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ai.h"
+#include "game.h"
+
+#define NUM_SHIPS 6
+#define MAX_SHOTS 255
+
+// Games per task
+#define CHUNK_GAMES 32
+
+typedef uint8_t Grid[8][8];
+
+// A strategy's state for one game
+typedef struct {
+	uint32_t random;
+	AiState ai;
+} Player;
+
+typedef struct {
+	const char* name;
+	// Called at the start of a game on grid
+	void (*start)(Player* p, Grid grid);
+	// Choose the next shot
+	void (*choose)(Player* p, Grid grid, uint8_t* row, uint8_t* col);
+	// Called once the shot's result is in grid
+	void (*result)(Player* p, Grid grid);
+} Strategy;
+
+/*
+ * Random numbers. splitmix64 turns the seed and a game into the seed for
+ * a fleet or a player, which then uses xorshift32.
+ */
+
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+static uint32_t game_seed(uint64_t seed, uint32_t game, uint32_t stream)
+{
+	uint32_t s = (uint32_t)splitmix64(seed ^ splitmix64(
+			((uint64_t)game << 8) | stream));
+	return s ? s : 1;
+}
+
+static uint32_t next_random(uint32_t* state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+// A random cell that hasn't been fired at, of the given parity (0 or 1 for
+// a checkerboard colour, 2 for either). Returns 0 if there is none.
+static uint8_t random_unhit(uint32_t* random, Grid grid, uint8_t parity,
+		uint8_t* row, uint8_t* col)
+{
+	uint8_t cells[64];
+	uint8_t n = 0;
+	for (uint8_t cell = 0; cell < 64; cell++)
+	{
+		uint8_t r = cell / 8;
+		uint8_t c = cell % 8;
+		if (!(grid[r][c] & HIT) && (parity == 2 || (r + c) % 2 == parity))
+		{
+			cells[n++] = cell;
+		}
+	}
+	if (n == 0)
+	{
+		return 0;
+	}
+	uint8_t cell = cells[next_random(random) % n];
+	*row = cell / 8;
+	*col = cell % 8;
+	return 1;
+}
+
+/*
+ * Strategies
+ */
+
+static void start_nothing(Player* p, Grid grid)
+{
+}
+
+static void result_nothing(Player* p, Grid grid)
+{
+}
+
+static void choose_raster(Player* p, Grid grid, uint8_t* row, uint8_t* col)
+{
+	for (int8_t r = 7; r >= 0; r--)
+	{
+		for (uint8_t c = 0; c < 8; c++)
+		{
+			if (!(grid[r][c] & HIT))
+			{
+				*row = r;
+				*col = c;
+				return;
+			}
+		}
+	}
+	*row = 0;
+	*col = 0;
+}
+
+static void choose_random(Player* p, Grid grid, uint8_t* row, uint8_t* col)
+{
+	if (!random_unhit(&p->random, grid, 2, row, col))
+	{
+		*row = 0;
+		*col = 0;
+	}
+}
+
+static void choose_hunt(Player* p, Grid grid, uint8_t* row, uint8_t* col)
+{
+	static const int8_t steps[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 },
+			{ 0, -1 } };
+	uint8_t cells[64];
+	uint8_t n = 0;
+	uint64_t seen = 0;
+	for (uint8_t r = 0; r < 8; r++)
+	{
+		for (uint8_t c = 0; c < 8; c++)
+		{
+			uint8_t cell = grid[r][c];
+			if (!(cell & HIT) || !(cell & SHIP_MASK) || (cell & SUNK))
+			{
+				continue;
+			}
+			for (uint8_t i = 0; i < 4; i++)
+			{
+				int8_t rr = r + steps[i][0];
+				int8_t cc = c + steps[i][1];
+				if (rr < 0 || rr > 7 || cc < 0 || cc > 7 ||
+						(grid[rr][cc] & HIT) || (seen & (1ULL << (rr * 8 + cc))))
+				{
+					continue;
+				}
+				seen |= 1ULL << (rr * 8 + cc);
+				cells[n++] = rr * 8 + cc;
+			}
+		}
+	}
+	if (n)
+	{
+		uint8_t cell = cells[next_random(&p->random) % n];
+		*row = cell / 8;
+		*col = cell % 8;
+		return;
+	}
+	if (!random_unhit(&p->random, grid, 0, row, col))
+	{
+		choose_random(p, grid, row, col);
+	}
+}
+
+static void start_ai(Player* p, Grid grid)
+{
+	ai_reset(&p->ai, grid);
+}
+
+static void choose_ai(Player* p, Grid grid, uint8_t* row, uint8_t* col)
+{
+	ai_finish(&p->ai);
+	ai_best_move(&p->ai, row, col);
+}
+
+static void result_ai(Player* p, Grid grid)
+{
+	ai_next_turn(&p->ai, grid);
+}
+
+static const Strategy strategies[] = {
+	{ "raster", start_nothing, choose_raster, result_nothing },
+	{ "random", start_nothing, choose_random, result_nothing },
+	{ "hunt", start_nothing, choose_hunt, result_nothing },
+	{ "ai", start_ai, choose_ai, result_ai },
+};
+#define NUM_STRATEGIES (sizeof(strategies) / sizeof(strategies[0]))
+
+/*
+ * Games
+ */
+
+static const uint8_t ship_lengths[NUM_SHIPS] = { 6, 4, 3, 3, 2, 2 };
+
+// Place the fleet at random, ships never touching
+static void random_fleet(uint32_t seed, Grid grid)
+{
+	uint32_t random = seed;
+	while (1)
+	{
+		memset(grid, 0, sizeof(Grid));
+		uint8_t ship;
+		for (ship = 0; ship < NUM_SHIPS; ship++)
+		{
+			uint8_t length = ship_lengths[ship];
+			uint8_t tries;
+			for (tries = 0; tries < 100; tries++)
+			{
+				uint8_t vertical = next_random(&random) & 1;
+				uint8_t row = next_random(&random) % (vertical ? 9 - length : 8);
+				uint8_t col = next_random(&random) % (vertical ? 8 : 9 - length);
+
+				// no cell or its neighbours may be taken
+				uint8_t clear = 1;
+				for (uint8_t i = 0; i < length && clear; i++)
+				{
+					int8_t r = vertical ? row + i : row;
+					int8_t c = vertical ? col : col + i;
+					clear = !grid[r][c] && (r == 0 || !grid[r - 1][c]) &&
+							(r == 7 || !grid[r + 1][c]) &&
+							(c == 0 || !grid[r][c - 1]) &&
+							(c == 7 || !grid[r][c + 1]);
+				}
+				if (!clear)
+				{
+					continue;
+				}
+				for (uint8_t i = 0; i < length; i++)
+				{
+					grid[vertical ? row + i : row][vertical ? col : col + i] =
+							CARRIER + ship;
+				}
+				break;
+			}
+			if (tries == 100)
+			{
+				break;
+			}
+		}
+		if (ship == NUM_SHIPS)
+		{
+			return;
+		}
+	}
+}
+
+// Fire at a cell, sinking the ship if that was its last cell
+static void fire(Grid grid, uint8_t row, uint8_t col)
+{
+	grid[row][col] |= HIT;
+	uint8_t ship = grid[row][col] & SHIP_MASK;
+	if (!ship)
+	{
+		return;
+	}
+	for (uint8_t r = 0; r < 8; r++)
+	{
+		for (uint8_t c = 0; c < 8; c++)
+		{
+			if ((grid[r][c] & SHIP_MASK) == ship && !(grid[r][c] & HIT))
+			{
+				return;
+			}
+		}
+	}
+	for (uint8_t r = 0; r < 8; r++)
+	{
+		for (uint8_t c = 0; c < 8; c++)
+		{
+			if ((grid[r][c] & SHIP_MASK) == ship)
+			{
+				grid[r][c] |= SUNK;
+			}
+		}
+	}
+}
+
+static uint8_t fleet_sunk(Grid grid)
+{
+	for (uint8_t r = 0; r < 8; r++)
+	{
+		for (uint8_t c = 0; c < 8; c++)
+		{
+			if ((grid[r][c] & SHIP_MASK) && !(grid[r][c] & SUNK))
+			{
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+// Return the number of shots strategy takes to sink the fleet
+static uint8_t play(const Strategy* strategy, Grid fleet, uint32_t seed)
+{
+	Player player;
+	player.random = seed;
+	Grid grid;
+	memcpy(grid, fleet, sizeof(Grid));
+	strategy->start(&player, grid);
+	uint8_t shots = 0;
+	while (!fleet_sunk(grid) && shots < MAX_SHOTS)
+	{
+		uint8_t row, col;
+		strategy->choose(&player, grid, &row, &col);
+		fire(grid, row & 7, col & 7);
+		strategy->result(&player, grid);
+		shots++;
+	}
+	return shots;
+}
+
+/*
+ * Work stealing thread pool. Each task is a chunk of games for one
+ * strategy. Every thread has its own deque of tasks: it takes from the
+ * back of its own and steals from the front of the others'.
+ */
+
+typedef struct {
+	uint16_t strategy;
+	uint32_t first_game;
+} Task;
+
+typedef struct {
+	pthread_mutex_t lock;
+	Task* tasks;
+	size_t front;
+	size_t back;
+} Deque;
+
+typedef struct {
+	pthread_t thread;
+	uint32_t index;
+	uint32_t steals;
+	// CPU time spent on each strategy's games
+	double seconds[NUM_STRATEGIES];
+} Worker;
+
+static uint64_t seed = 1;
+static uint32_t games = 1000;
+static uint32_t num_threads;
+static uint8_t num_playing;
+static uint8_t playing[NUM_STRATEGIES];
+static Deque* deques;
+static Worker* workers;
+// shots[s][game * 2 + fleet] is how many shots playing[s] took on fleet
+// 0 or 1 of a game
+static uint8_t* shots[NUM_STRATEGIES];
+
+static uint8_t take_task(Worker* w, Task* task)
+{
+	Deque* own = &deques[w->index];
+	pthread_mutex_lock(&own->lock);
+	uint8_t found = own->back > own->front;
+	if (found)
+	{
+		*task = own->tasks[--own->back];
+	}
+	pthread_mutex_unlock(&own->lock);
+	if (found)
+	{
+		return 1;
+	}
+
+	// Tasks don't make new tasks, so once every deque is empty there is
+	// nothing left to do
+	for (uint32_t i = 1; i < num_threads; i++)
+	{
+		Deque* victim = &deques[(w->index + i) % num_threads];
+		pthread_mutex_lock(&victim->lock);
+		found = victim->back > victim->front;
+		if (found)
+		{
+			*task = victim->tasks[victim->front++];
+		}
+		pthread_mutex_unlock(&victim->lock);
+		if (found)
+		{
+			w->steals++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static double thread_seconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void* worker_main(void* arg)
+{
+	Worker* w = arg;
+	Task task;
+	while (take_task(w, &task))
+	{
+		const Strategy* strategy = &strategies[playing[task.strategy]];
+		double start = thread_seconds();
+		for (uint32_t game = task.first_game;
+				game < task.first_game + CHUNK_GAMES && game < games; game++)
+		{
+			for (uint8_t fleet = 0; fleet < 2; fleet++)
+			{
+				Grid grid;
+				random_fleet(game_seed(seed, game, fleet), grid);
+				shots[task.strategy][game * 2 + fleet] = play(strategy, grid,
+						game_seed(seed, game, 2 + fleet));
+			}
+		}
+		w->seconds[task.strategy] += thread_seconds() - start;
+	}
+	return NULL;
+}
+
+static double wall_seconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: tournament [-g games] [-s seed] [-j threads] "
+			"[strategy...]\nstrategies:");
+	for (uint8_t s = 0; s < NUM_STRATEGIES; s++)
+	{
+		fprintf(stderr, " %s", strategies[s].name);
+	}
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+	while ((opt = getopt(argc, argv, "g:s:j:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'g':
+				games = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'j':
+				num_threads = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage();
+		}
+	}
+	if (games == 0 || num_threads == 0)
+	{
+		usage();
+	}
+	for (int i = optind; i < argc; i++)
+	{
+		uint8_t s;
+		for (s = 0; s < NUM_STRATEGIES; s++)
+		{
+			if (strcmp(argv[i], strategies[s].name) == 0)
+			{
+				break;
+			}
+		}
+		if (s == NUM_STRATEGIES)
+		{
+			usage();
+		}
+		playing[num_playing++] = s;
+	}
+	if (num_playing == 0)
+	{
+		for (uint8_t s = 0; s < NUM_STRATEGIES; s++)
+		{
+			playing[num_playing++] = s;
+		}
+	}
+
+	// Deal the tasks out to the threads in turn
+	uint32_t chunks = (games + CHUNK_GAMES - 1) / CHUNK_GAMES;
+	uint32_t num_tasks = chunks * num_playing;
+	deques = calloc(num_threads, sizeof(Deque));
+	workers = calloc(num_threads, sizeof(Worker));
+	if (!deques || !workers)
+	{
+		perror("tournament");
+		return 1;
+	}
+	for (uint32_t t = 0; t < num_threads; t++)
+	{
+		pthread_mutex_init(&deques[t].lock, NULL);
+		deques[t].tasks = calloc(num_tasks / num_threads + 1, sizeof(Task));
+		workers[t].index = t;
+	}
+	for (uint32_t i = 0; i < num_tasks; i++)
+	{
+		Deque* d = &deques[i % num_threads];
+		d->tasks[d->back].strategy = i % num_playing;
+		d->tasks[d->back].first_game = i / num_playing * CHUNK_GAMES;
+		d->back++;
+	}
+	for (uint8_t s = 0; s < num_playing; s++)
+	{
+		shots[s] = calloc(games * 2, 1);
+		if (!shots[s])
+		{
+			perror("tournament");
+			return 1;
+		}
+	}
+
+	double start = wall_seconds();
+	for (uint32_t t = 0; t < num_threads; t++)
+	{
+		if (pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]))
+		{
+			perror("tournament: pthread_create");
+			return 1;
+		}
+	}
+	uint32_t steals = 0;
+	for (uint32_t t = 0; t < num_threads; t++)
+	{
+		pthread_join(workers[t].thread, NULL);
+		steals += workers[t].steals;
+	}
+	double elapsed = wall_seconds() - start;
+
+	// Shots to sink a fleet, over every fleet each strategy played
+	printf("%-8s %7s %7s %7s %4s %4s %12s\n", "strategy", "fleets", "mean",
+			"stddev", "min", "max", "fleets/s/cpu");
+	for (uint8_t s = 0; s < num_playing; s++)
+	{
+		uint64_t sum = 0;
+		uint64_t sum_squares = 0;
+		uint8_t min = MAX_SHOTS;
+		uint8_t max = 0;
+		for (uint32_t i = 0; i < games * 2; i++)
+		{
+			uint8_t n = shots[s][i];
+			sum += n;
+			sum_squares += n * n;
+			min = n < min ? n : min;
+			max = n > max ? n : max;
+		}
+		double count = games * 2;
+		double mean = sum / count;
+		double variance = count > 1 ?
+				(sum_squares - sum * mean) / (count - 1) : 0;
+		double seconds = 0;
+		for (uint32_t t = 0; t < num_threads; t++)
+		{
+			seconds += workers[t].seconds[s];
+		}
+		printf("%-8s %7u %7.2f %7.2f %4u %4u %12.0f\n",
+				strategies[playing[s]].name, games * 2, mean,
+				variance > 0 ? sqrt(variance) : 0, min, max,
+				seconds > 0 ? count / seconds : 0);
+	}
+
+	// Matches: games the row strategy won against the column one
+	printf("\nwins of %u games (row against column)\n%-8s", games, "");
+	for (uint8_t b = 0; b < num_playing; b++)
+	{
+		printf(" %7s", strategies[playing[b]].name);
+	}
+	printf("\n");
+	for (uint8_t a = 0; a < num_playing; a++)
+	{
+		printf("%-8s", strategies[playing[a]].name);
+		for (uint8_t b = 0; b < num_playing; b++)
+		{
+			if (a == b)
+			{
+				printf(" %7s", "-");
+				continue;
+			}
+			// a fires at fleet 1 and b at fleet 0 when a is listed first,
+			// and a fires first in even games
+			uint8_t a_fleet = a < b ? 1 : 0;
+			uint32_t wins = 0;
+			for (uint32_t game = 0; game < games; game++)
+			{
+				uint8_t a_shots = shots[a][game * 2 + a_fleet];
+				uint8_t b_shots = shots[b][game * 2 + 1 - a_fleet];
+				uint8_t a_first = (game % 2 == 0) == (a < b);
+				wins += a_first ? a_shots <= b_shots : a_shots < b_shots;
+			}
+			printf(" %7u", wins);
+		}
+		printf("\n");
+	}
+
+	double fleets = (double)games * 2 * num_playing;
+	printf("\n%.0f fleets in %.2fs on %u threads (%u steals): "
+			"%.0f fleets/s, %.0f per thread\n", fleets, elapsed, num_threads,
+			steals, fleets / elapsed, fleets / elapsed / num_threads);
+	return 0;
+}